@@ -0,0 +1,357 @@
+/*
+ * Base64 kernel check and benchmark. volc_base64.c is built once per kernel
+ * the host can run (word scalar, SSSE3, AVX2 or NEON, see CMakeLists.txt),
+ * each one under its own b64_<kernel>_ symbols. Every kernel is first
+ * checked against mbedtls_base64_encode/decode: round trips of all lengths
+ * and offsets, input with line breaks and spaces, json "\/" escapes and
+ * malformed input must give the same output or the same rejection. Then the
+ * encode and decode throughput of each kernel and of mbedtls is reported.
+ *
+ *   base64_bench [seconds] [pcm_bytes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "mbedtls/version.h"
+#include "mbedtls/base64.h"
+
+#define BENCH_DEFAULT_SECONDS   (1)
+#define BENCH_DEFAULT_PCM_BYTES (3840)  // 80 ms of 24 kHz 16 bit mono
+#define BENCH_CHECK_MAX_LEN     (300)
+#define BENCH_FUZZ_ROUNDS       (20000)
+#define BENCH_BUF_SIZE          (4096)
+
+typedef void (*bench_codec_fn)(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen);
+typedef int (*bench_inplace_fn)(unsigned char* dst, size_t* olen, const unsigned char* src, size_t slen);
+
+typedef struct {
+    const char* name;
+    bench_codec_fn encode;
+    bench_codec_fn decode;
+    bench_inplace_fn decode_inplace;
+    const char* cpu_feature;    // NULL: runs on every cpu of the target
+} bench_kernel_t;
+
+#define BENCH_DECLARE_KERNEL(k)                                                                                  \
+    void b64_##k##_encode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen); \
+    void b64_##k##_decode(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen); \
+    int b64_##k##_decode_inplace(unsigned char* dst, size_t* olen, const unsigned char* src, size_t slen);
+#define BENCH_KERNEL(k, feature) { #k, b64_##k##_encode, b64_##k##_decode, b64_##k##_decode_inplace, feature }
+
+#if defined(BASE64_BENCH_SCALAR)
+BENCH_DECLARE_KERNEL(scalar)
+#endif
+#if defined(BASE64_BENCH_SSSE3)
+BENCH_DECLARE_KERNEL(ssse3)
+#endif
+#if defined(BASE64_BENCH_AVX2)
+BENCH_DECLARE_KERNEL(avx2)
+#endif
+#if defined(BASE64_BENCH_NEON)
+BENCH_DECLARE_KERNEL(neon)
+#endif
+
+static bench_kernel_t s_kernels[] = {
+#if defined(BASE64_BENCH_SCALAR)
+    BENCH_KERNEL(scalar, NULL),
+#endif
+#if defined(BASE64_BENCH_SSSE3)
+    BENCH_KERNEL(ssse3, "ssse3"),
+#endif
+#if defined(BASE64_BENCH_AVX2)
+    BENCH_KERNEL(avx2, "avx2"),
+#endif
+#if defined(BASE64_BENCH_NEON)
+    BENCH_KERNEL(neon, NULL),
+#endif
+};
+
+#define BENCH_KERNEL_COUNT ((int) (sizeof(s_kernels) / sizeof(s_kernels[0])))
+
+static uint32_t g_seed = 0x2545F491;
+static int g_failed = 0;
+
+static uint32_t __bench_rand(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+
+static bool __bench_supported(const bench_kernel_t* k)
+{
+    if (NULL == k->cpu_feature) {
+        return true;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(k->cpu_feature, "ssse3") == 0) {
+        return __builtin_cpu_supports("ssse3");
+    }
+    if (strcmp(k->cpu_feature, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return false;
+}
+
+static double __now_seconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void __bench_report(const char* what, const bench_kernel_t* k, const unsigned char* in, size_t len)
+{
+    if (g_failed++ < 20) {
+        printf("MISMATCH %s, kernel %s, input %zu bytes: %.*s\n", what, k->name, len, (int) (len > 80 ? 80 : len), in);
+    }
+}
+
+// mbedtls 2.x takes a tail without its '=' padding and silently drops it, 3.x
+// rejects it as we do; such input is only compared against 3.x
+static bool __bench_mbedtls_comparable(const unsigned char* src, size_t len)
+{
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    (void) src;
+    (void) len;
+    return true;
+#else
+    size_t n = 0;
+    size_t i = 0;
+    for (i = 0; i < len; i++) {
+        if (src[i] != ' ' && src[i] != '\r' && src[i] != '\n') {
+            n++;
+        }
+    }
+    return n % 4 == 0;
+#endif
+}
+
+// same verdict and output as mbedtls for src, through both decode entries
+static void __bench_check_decode(const bench_kernel_t* k, const unsigned char* src, size_t len)
+{
+    unsigned char ref[BENCH_BUF_SIZE];
+    unsigned char out[BENCH_BUF_SIZE];
+    unsigned char inplace[BENCH_BUF_SIZE];
+    size_t ref_len = 0;
+    size_t out_len = 0;
+    int ref_ret = 0;
+    int ret = 0;
+
+    if (!__bench_mbedtls_comparable(src, len)) {
+        return;
+    }
+    ref_ret = mbedtls_base64_decode(ref, sizeof(ref), &ref_len, src, len);
+    k->decode(out, sizeof(out), &out_len, src, len);
+    if (ref_ret != 0 ? out_len != 0 : (out_len != ref_len || memcmp(out, ref, ref_len) != 0)) {
+        // an empty result is all volc_base64_decode can say about a rejection
+        if (!(ref_ret == 0 && ref_len == 0 && out_len == 0)) {
+            __bench_report("decode", k, src, len);
+        }
+    }
+    memcpy(inplace, src, len);
+    ret = k->decode_inplace(inplace, &out_len, inplace, len);
+    if ((ret != 0) != (ref_ret != 0) || (ret == 0 && (out_len != ref_len || memcmp(inplace, ref, ref_len) != 0))) {
+        __bench_report("decode_inplace", k, src, len);
+    }
+}
+
+// "\/" escapes decode as '/' in place only, a lone '\' is rejected everywhere
+static void __bench_check_escaped(const bench_kernel_t* k, const unsigned char* enc, size_t enc_len,
+                                  const unsigned char* raw, size_t raw_len)
+{
+    unsigned char buf[BENCH_BUF_SIZE];
+    size_t len = 0;
+    size_t out_len = 0;
+    size_t i = 0;
+
+    for (i = 0; i < enc_len && len + 2 < sizeof(buf); i++) {
+        if (enc[i] == '/') {
+            buf[len++] = '\\';
+        }
+        buf[len++] = enc[i];
+    }
+    if (len == enc_len) {
+        return;
+    }
+    if (k->decode_inplace(buf, &out_len, buf, len) != 0 || out_len != raw_len || memcmp(buf, raw, raw_len) != 0) {
+        __bench_report("escaped decode_inplace", k, enc, enc_len);
+    }
+    memcpy(buf, enc, enc_len);
+    buf[enc_len - 1] = '\\';
+    __bench_check_decode(k, buf, enc_len);
+}
+
+static void __bench_check_kernel(const bench_kernel_t* k)
+{
+    unsigned char raw[BENCH_CHECK_MAX_LEN + 16];
+    unsigned char enc[BENCH_BUF_SIZE];
+    unsigned char ref[BENCH_BUF_SIZE];
+    unsigned char mod[BENCH_BUF_SIZE];
+    static const char* s_noise[] = { "\n", "\r\n", " \n", "  \r\n", " ", "\t", "\r", "\\", "=", "==", "===", "A", "-" };
+    size_t raw_len = 0;
+    size_t enc_len = 0;
+    size_t ref_len = 0;
+    size_t pos = 0;
+    size_t off = 0;
+    size_t i = 0;
+    const char* noise = NULL;
+    int round = 0;
+
+    // every length from a few source alignments, encode and decode
+    for (raw_len = 0; raw_len <= BENCH_CHECK_MAX_LEN; raw_len++) {
+        for (off = 0; off < 16; off += 5) {
+            for (i = 0; i < raw_len; i++) {
+                raw[off + i] = (unsigned char) __bench_rand();
+            }
+            mbedtls_base64_encode(ref, sizeof(ref), &ref_len, raw + off, raw_len);
+            k->encode(enc + off, sizeof(enc) - off, &enc_len, raw + off, raw_len);
+            if (enc_len != ref_len || memcmp(enc + off, ref, ref_len) != 0) {
+                __bench_report("encode", k, ref, ref_len);
+            }
+            __bench_check_decode(k, ref, ref_len);
+            __bench_check_escaped(k, ref, ref_len, raw + off, raw_len);
+        }
+    }
+
+    // valid text with line breaks, spaces and junk dropped in
+    for (round = 0; round < BENCH_FUZZ_ROUNDS; round++) {
+        raw_len = __bench_rand() % 200;
+        for (i = 0; i < raw_len; i++) {
+            raw[i] = (unsigned char) __bench_rand();
+        }
+        mbedtls_base64_encode(ref, sizeof(ref), &ref_len, raw, raw_len);
+        noise = s_noise[__bench_rand() % (sizeof(s_noise) / sizeof(s_noise[0]))];
+        pos = ref_len ? __bench_rand() % (ref_len + 1) : 0;
+        memcpy(mod, ref, pos);
+        memcpy(mod + pos, noise, strlen(noise));
+        memcpy(mod + pos + strlen(noise), ref + pos, ref_len - pos);
+        __bench_check_decode(k, mod, ref_len + strlen(noise));
+        if (ref_len > 0) {
+            // a wrong char at a random spot, after the vector blocks or inside them
+            memcpy(mod, ref, ref_len);
+            mod[__bench_rand() % ref_len] = (unsigned char) (__bench_rand() % 256);
+            __bench_check_decode(k, mod, ref_len);
+        }
+    }
+}
+
+typedef void (*bench_loop_fn)(const bench_kernel_t* k, unsigned char* dst, const unsigned char* src, size_t len);
+
+static void __bench_enc_kernel(const bench_kernel_t* k, unsigned char* dst, const unsigned char* src, size_t len)
+{
+    size_t olen = 0;
+    k->encode(dst, BENCH_BUF_SIZE * 2, &olen, src, len);
+}
+
+static void __bench_dec_kernel(const bench_kernel_t* k, unsigned char* dst, const unsigned char* src, size_t len)
+{
+    size_t olen = 0;
+    k->decode(dst, BENCH_BUF_SIZE * 2, &olen, src, len);
+}
+
+static void __bench_enc_mbedtls(const bench_kernel_t* k, unsigned char* dst, const unsigned char* src, size_t len)
+{
+    size_t olen = 0;
+    (void) k;
+    mbedtls_base64_encode(dst, BENCH_BUF_SIZE * 2, &olen, src, len);
+}
+
+static void __bench_dec_mbedtls(const bench_kernel_t* k, unsigned char* dst, const unsigned char* src, size_t len)
+{
+    size_t olen = 0;
+    (void) k;
+    mbedtls_base64_decode(dst, BENCH_BUF_SIZE * 2, &olen, src, len);
+}
+
+// MB/s of the base64 text side
+static double __bench_rate(bench_loop_fn fn, const bench_kernel_t* k, unsigned char* dst, const unsigned char* src,
+                           size_t len, size_t text_len, double seconds)
+{
+    double start = __now_seconds();
+    double wall = 0;
+    uint64_t rounds = 0;
+    int i = 0;
+
+    do {
+        for (i = 0; i < 256; i++) {
+            fn(k, dst, src, len);
+        }
+        rounds += 256;
+        wall = __now_seconds() - start;
+    } while (wall < seconds);
+    return rounds * text_len / wall / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = BENCH_DEFAULT_SECONDS;
+    int pcm_bytes = BENCH_DEFAULT_PCM_BYTES;
+    unsigned char* pcm = NULL;
+    unsigned char* text = NULL;
+    unsigned char* out = NULL;
+    size_t text_len = 0;
+    int ret = 1;
+    int i = 0;
+
+    if (argc > 1) seconds = atof(argv[1]);
+    if (argc > 2) pcm_bytes = atoi(argv[2]);
+    if (seconds <= 0 || pcm_bytes <= 0 || pcm_bytes > BENCH_BUF_SIZE) {
+        printf("usage: %s [seconds=%d] [pcm_bytes=%d, at most %d]\n", argv[0], BENCH_DEFAULT_SECONDS,
+               BENCH_DEFAULT_PCM_BYTES, BENCH_BUF_SIZE);
+        return 1;
+    }
+
+    for (i = 0; i < BENCH_KERNEL_COUNT; i++) {
+        if (!__bench_supported(&s_kernels[i])) {
+            printf("%-8s not supported by this cpu, skipped\n", s_kernels[i].name);
+            continue;
+        }
+        __bench_check_kernel(&s_kernels[i]);
+    }
+    if (g_failed > 0) {
+        printf("%d mismatches against mbedtls %s\n", g_failed, MBEDTLS_VERSION_STRING);
+        return 1;
+    }
+    printf("all kernels match mbedtls %s\n", MBEDTLS_VERSION_STRING);
+
+    pcm = (unsigned char*) malloc(pcm_bytes);
+    text = (unsigned char*) malloc(BENCH_BUF_SIZE * 2);
+    out = (unsigned char*) malloc(BENCH_BUF_SIZE * 2);
+    if (NULL == pcm || NULL == text || NULL == out) {
+        printf("init failed\n");
+        goto err_out_label;
+    }
+    for (i = 0; i < pcm_bytes; i++) {
+        pcm[i] = (unsigned char) __bench_rand();
+    }
+    mbedtls_base64_encode(text, BENCH_BUF_SIZE * 2, &text_len, pcm, pcm_bytes);
+
+    printf("%d bytes pcm, %zu chars, MB/s of base64 text\n", pcm_bytes, text_len);
+    printf("%-8s %10s %10s\n", "kernel", "encode", "decode");
+    printf("%-8s %10.0f %10.0f\n", "mbedtls",
+           __bench_rate(__bench_enc_mbedtls, NULL, out, pcm, pcm_bytes, text_len, seconds),
+           __bench_rate(__bench_dec_mbedtls, NULL, out, text, text_len, text_len, seconds));
+    for (i = 0; i < BENCH_KERNEL_COUNT; i++) {
+        if (!__bench_supported(&s_kernels[i])) {
+            continue;
+        }
+        printf("%-8s %10.0f %10.0f\n", s_kernels[i].name,
+               __bench_rate(__bench_enc_kernel, &s_kernels[i], out, pcm, pcm_bytes, text_len, seconds),
+               __bench_rate(__bench_dec_kernel, &s_kernels[i], out, text, text_len, text_len, seconds));
+    }
+    ret = 0;
+
+err_out_label:
+    free(pcm);
+    free(text);
+    free(out);
+    return ret;
+}
@@ -0,0 +1,194 @@
+/*
+ * Websocket load generator: opens many sessions on the reactor, sends an
+ * audio sized frame per session every interval_ms to an echo server and
+ * reports the CPU the process spent, as sessions per core.
+ *
+ *   ws_bench <ws://host:port/path> [sessions] [threads] [seconds] [interval_ms] [payload]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "volc_platform.h"
+#include "websocket.h"
+
+#define BENCH_DEFAULT_SESSIONS    (100)
+#define BENCH_DEFAULT_THREADS     (1)
+#define BENCH_DEFAULT_SECONDS     (10)
+#define BENCH_DEFAULT_INTERVAL_MS (20)
+#define BENCH_DEFAULT_PAYLOAD     (640)     // 20 ms of 16 kHz 16 bit mono
+#define BENCH_CONNECT_WAIT_MS     (30000)
+
+typedef struct {
+    volc_ws_client_t* client;
+    volatile bool connected;
+} bench_session_t;
+
+static uint64_t g_rx_frames = 0;
+static uint64_t g_rx_bytes = 0;
+static uint64_t g_tx_frames = 0;
+static uint64_t g_tx_failed = 0;
+static int g_connected = 0;
+static int g_disconnected = 0;
+
+static void __bench_ws_event_handler(void* user_context, int32_t event_id, void* event_data)
+{
+    bench_session_t* session = (bench_session_t*) user_context;
+    volc_ws_event_data_t* data = (volc_ws_event_data_t*) event_data;
+
+    switch (event_id) {
+        case VOLC_WS_EVENT_CONNECTED:
+            session->connected = true;
+            __atomic_add_fetch(&g_connected, 1, __ATOMIC_RELAXED);
+            break;
+        case VOLC_WS_EVENT_DISCONNECTED:
+            if (session->connected) {
+                session->connected = false;
+                __atomic_sub_fetch(&g_connected, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&g_disconnected, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        case VOLC_WS_EVENT_DATA:
+            if (data->op_code <= VOLC_WS_OPCODES_BINARY) {
+                if (data->payload_offset + data->data_len >= data->payload_len) {
+                    __atomic_add_fetch(&g_rx_frames, 1, __ATOMIC_RELAXED);
+                }
+                __atomic_add_fetch(&g_rx_bytes, (uint64_t) data->data_len, __ATOMIC_RELAXED);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static double __cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    const char* uri = NULL;
+    int sessions = BENCH_DEFAULT_SESSIONS;
+    int threads = BENCH_DEFAULT_THREADS;
+    int seconds = BENCH_DEFAULT_SECONDS;
+    int interval_ms = BENCH_DEFAULT_INTERVAL_MS;
+    int payload_len = BENCH_DEFAULT_PAYLOAD;
+    volc_ws_reactor_t* reactor = NULL;
+    bench_session_t* bench = NULL;
+    volc_ws_config_t config = {0};
+    char* payload = NULL;
+    uint64_t start_ms = 0;
+    uint64_t end_ms = 0;
+    uint64_t tick_ms = 0;
+    uint64_t rx_frames = 0;
+    uint64_t rx_bytes = 0;
+    double cpu_start = 0;
+    double cpu_used = 0;
+    double wall = 0;
+    double cores = 0;
+    int connected = 0;
+    int i = 0;
+
+    if (argc < 2) {
+        printf("usage: %s <ws://host:port/path> [sessions=%d] [threads=%d] [seconds=%d] [interval_ms=%d] [payload=%d]\n",
+               argv[0], BENCH_DEFAULT_SESSIONS, BENCH_DEFAULT_THREADS, BENCH_DEFAULT_SECONDS,
+               BENCH_DEFAULT_INTERVAL_MS, BENCH_DEFAULT_PAYLOAD);
+        return 1;
+    }
+    uri = argv[1];
+    if (argc > 2) sessions = atoi(argv[2]);
+    if (argc > 3) threads = atoi(argv[3]);
+    if (argc > 4) seconds = atoi(argv[4]);
+    if (argc > 5) interval_ms = atoi(argv[5]);
+    if (argc > 6) payload_len = atoi(argv[6]);
+    if (sessions <= 0 || seconds <= 0 || interval_ms <= 0 || payload_len <= 0) {
+        printf("invalid arguments\n");
+        return 1;
+    }
+
+    bench = (bench_session_t*) calloc(sessions, sizeof(bench_session_t));
+    payload = (char*) malloc(payload_len);
+    reactor = volc_ws_reactor_create(threads);
+    if (NULL == bench || NULL == payload || NULL == reactor) {
+        printf("init failed\n");
+        goto err_out_label;
+    }
+    memset(payload, 'a', payload_len);
+
+    config.uri = uri;
+    config.buffer_size = payload_len + 64;
+    config.ws_event_handler = __bench_ws_event_handler;
+    for (i = 0; i < sessions; i++) {
+        config.user_context = &bench[i];
+        if (NULL == (bench[i].client = volc_ws_client_init(&config))) {
+            printf("client %d init failed\n", i);
+            goto err_out_label;
+        }
+        if (volc_ws_client_start_on(bench[i].client, reactor) != 0) {
+            printf("client %d start failed\n", i);
+            goto err_out_label;
+        }
+    }
+
+    start_ms = hal_get_time_ms();
+    while (__atomic_load_n(&g_connected, __ATOMIC_RELAXED) < sessions && hal_get_time_ms() - start_ms < BENCH_CONNECT_WAIT_MS) {
+        hal_thread_sleep(100);
+    }
+    connected = __atomic_load_n(&g_connected, __ATOMIC_RELAXED);
+    printf("%d of %d sessions connected in %llu ms\n", connected, sessions, (unsigned long long) (hal_get_time_ms() - start_ms));
+
+    // steady state only, the connects are not counted
+    rx_frames = __atomic_load_n(&g_rx_frames, __ATOMIC_RELAXED);
+    rx_bytes = __atomic_load_n(&g_rx_bytes, __ATOMIC_RELAXED);
+    cpu_start = __cpu_seconds();
+    start_ms = hal_get_time_ms();
+    end_ms = start_ms + (uint64_t) seconds * 1000;
+    tick_ms = start_ms;
+    while (hal_get_time_ms() < end_ms) {
+        for (i = 0; i < sessions; i++) {
+            if (!bench[i].connected) {
+                continue;
+            }
+            if (volc_ws_client_send_text(bench[i].client, payload, payload_len, 1000) < 0) {
+                g_tx_failed++;
+            } else {
+                g_tx_frames++;
+            }
+        }
+        tick_ms += interval_ms;
+        if (tick_ms > hal_get_time_ms()) {
+            hal_thread_sleep((int) (tick_ms - hal_get_time_ms()));
+        }
+    }
+    // the echoes of the last round
+    hal_thread_sleep(interval_ms);
+    wall = (hal_get_time_ms() - start_ms) / 1000.0;
+    cpu_used = __cpu_seconds() - cpu_start;
+    rx_frames = __atomic_load_n(&g_rx_frames, __ATOMIC_RELAXED) - rx_frames;
+    rx_bytes = __atomic_load_n(&g_rx_bytes, __ATOMIC_RELAXED) - rx_bytes;
+    cores = cpu_used / wall;
+
+    printf("sessions %d, loop threads %d, %d byte frames every %d ms\n", connected, threads, payload_len, interval_ms);
+    printf("tx %llu frames (%llu failed), rx %llu frames %llu bytes, %d disconnects\n",
+           (unsigned long long) g_tx_frames, (unsigned long long) g_tx_failed, (unsigned long long) rx_frames,
+           (unsigned long long) rx_bytes, g_disconnected);
+    printf("cpu %.2f s in %.2f s: %.1f%% of a core, %.0f sessions per core\n",
+           cpu_used, wall, cores * 100, cores > 0 ? connected / cores : 0);
+
+err_out_label:
+    for (i = 0; bench && i < sessions; i++) {
+        // sends the close frame, then stops and frees the client
+        volc_ws_client_destroy(bench[i].client);
+    }
+    volc_ws_reactor_destroy(reactor);
+    free(payload);
+    free(bench);
+    return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Realtime event parse benchmark: feeds server events through the single
+ * pass volc_ws_event_parse and through the cJSON tree walk it replaced
+ * (cJSON_ParseWithLength + volc_json_read_string per field), and reports
+ * events per second and heap allocations per event for both. Allocations are
+ * counted by the hal_malloc family defined here, cJSON is routed to them too.
+ *
+ *   ws_event_bench [seconds] [audio_delta_bytes] [events_file]
+ *
+ * events_file holds recorded server events, one json per line. Without it a
+ * built in turn is used, with audio deltas of audio_delta_bytes decoded pcm.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "volc_platform.h"
+#include "volc_ws_event.h"
+#include "util/volc_json.h"
+
+#define BENCH_DEFAULT_SECONDS     (2)
+#define BENCH_DEFAULT_AUDIO_BYTES (3840)    // 80 ms of 24 kHz 16 bit mono
+#define BENCH_MAX_EVENTS          (4096)
+#define BENCH_CHECK_EVERY         (1024)
+
+typedef struct {
+    char* data;
+    int len;
+} bench_event_t;
+
+typedef int (*bench_parse_fn)(const char* data, int len);
+
+static uint64_t g_allocs = 0;
+static uint64_t g_frees = 0;
+
+void* hal_malloc(size_t size) {
+    g_allocs++;
+    return malloc(size);
+}
+
+void* hal_calloc(size_t num, size_t size) {
+    g_allocs++;
+    return calloc(num, size);
+}
+
+void* hal_realloc(void* ptr, size_t new_size) {
+    g_allocs++;
+    return realloc(ptr, new_size);
+}
+
+void hal_free(void* ptr) {
+    if (ptr) {
+        g_frees++;
+    }
+    free(ptr);
+}
+
+static const char* s_turn[] = {
+    "{\"event_id\":\"event_7f2c9a0e41\",\"type\":\"session.created\",\"session\":{\"id\":\"sess_0c5d1e8b\",\"object\":\"realtime.session\","
+    "\"model\":\"AG-voice-chat-agent\",\"modalities\":[\"text\",\"audio\"],\"instructions\":\"\",\"voice\":\"zh_female_tianmeixiaoyuan_moon_bigtts\","
+    "\"input_audio_format\":\"pcm16\",\"output_audio_format\":\"pcm16\",\"input_audio_transcription\":{\"model\":\"any\"},"
+    "\"turn_detection\":{\"type\":\"server_vad\",\"threshold\":0.5,\"prefix_padding_ms\":300,\"silence_duration_ms\":500},"
+    "\"tools\":[],\"tool_choice\":\"auto\",\"temperature\":0.8,\"max_response_output_tokens\":\"inf\"}}",
+    "{\"event_id\":\"event_7f2c9a0e42\",\"type\":\"input_audio_buffer.speech_started\",\"audio_start_ms\":1280,\"item_id\":\"item_9a41f2\"}",
+    "{\"event_id\":\"event_7f2c9a0e43\",\"type\":\"input_audio_buffer.speech_stopped\",\"audio_end_ms\":2960,\"item_id\":\"item_9a41f2\"}",
+    "{\"event_id\":\"event_7f2c9a0e44\",\"type\":\"response.audio_transcript.delta\",\"response_id\":\"resp_5e7b13d0\",\"item_id\":\"item_9a41f3\","
+    "\"output_index\":0,\"content_index\":0,\"delta\":\"\\u4eca\\u5929\\u5929\\u6c14\\u4e0d\\u9519\"}",
+    "{\"event_id\":\"event_7f2c9a0e46\",\"type\":\"response.audio.done\",\"response_id\":\"resp_5e7b13d0\",\"item_id\":\"item_9a41f3\","
+    "\"output_index\":0,\"content_index\":0}",
+    "{\"event_id\":\"event_7f2c9a0e47\",\"type\":\"response.audio_transcript.done\",\"response_id\":\"resp_5e7b13d0\",\"item_id\":\"item_9a41f3\","
+    "\"output_index\":0,\"content_index\":0,\"transcript\":\"\\u4eca\\u5929\\u5929\\u6c14\\u4e0d\\u9519\\uff0c\\u9002\\u5408\\u51fa\\u95e8\"}",
+    "{\"event_id\":\"event_7f2c9a0e48\",\"type\":\"response.done\",\"response\":{\"id\":\"resp_5e7b13d0\",\"object\":\"realtime.response\","
+    "\"status\":\"completed\",\"status_details\":null,\"output\":[{\"id\":\"item_9a41f3\",\"object\":\"realtime.item\",\"type\":\"message\","
+    "\"status\":\"completed\",\"role\":\"assistant\",\"content\":[{\"type\":\"audio\",\"transcript\":\"\\u4eca\\u5929\\u5929\\u6c14\\u4e0d\\u9519\"}]}],"
+    "\"usage\":{\"total_tokens\":412,\"input_tokens\":298,\"output_tokens\":114}}}",
+};
+
+static const char s_base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static double __now_seconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int __bench_add(bench_event_t* events, int count, const char* data, int len)
+{
+    if (count >= BENCH_MAX_EVENTS || len <= 0) {
+        return count;
+    }
+    events[count].data = (char*) malloc(len + 1);
+    if (NULL == events[count].data) {
+        return count;
+    }
+    memcpy(events[count].data, data, len);
+    events[count].data[len] = '\0';
+    events[count].len = len;
+    return count + 1;
+}
+
+static char* __bench_audio_delta(int pcm_bytes, int* out_len)
+{
+    static const char head[] = "{\"event_id\":\"event_7f2c9a0e45\",\"type\":\"response.audio.delta\",\"response_id\":\"resp_5e7b13d0\","
+                               "\"item_id\":\"item_9a41f3\",\"output_index\":0,\"content_index\":0,\"delta\":\"";
+    static const char tail[] = "\"}";
+    int b64_len = (pcm_bytes + 2) / 3 * 4;
+    int len = (int) sizeof(head) - 1 + b64_len + (int) sizeof(tail) - 1;
+    char* p = (char*) malloc(len + 1);
+    int i = 0;
+
+    if (NULL == p) {
+        return NULL;
+    }
+    memcpy(p, head, sizeof(head) - 1);
+    for (i = 0; i < b64_len; i++) {
+        p[sizeof(head) - 1 + i] = s_base64_chars[(i * 37 + 11) & 63];
+    }
+    if (pcm_bytes % 3) {
+        p[sizeof(head) - 1 + b64_len - 1] = '=';
+        if (pcm_bytes % 3 == 1) {
+            p[sizeof(head) - 1 + b64_len - 2] = '=';
+        }
+    }
+    memcpy(p + sizeof(head) - 1 + b64_len, tail, sizeof(tail));
+    *out_len = len;
+    return p;
+}
+
+static int __bench_load_file(bench_event_t* events, const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    char* buf = NULL;
+    long size = 0;
+    int count = 0;
+    char* line = NULL;
+    char* end = NULL;
+
+    if (NULL == fp) {
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0 || NULL == (buf = (char*) malloc(size + 1)) || fread(buf, 1, size, fp) != (size_t) size) {
+        goto err_out_label;
+    }
+    buf[size] = '\0';
+    for (line = buf; line < buf + size; line = end + 1) {
+        end = memchr(line, '\n', buf + size - line);
+        if (NULL == end) {
+            end = buf + size;
+        }
+        if (end > line && end[-1] == '\r') {
+            count = __bench_add(events, count, line, (int) (end - line - 1));
+        } else {
+            count = __bench_add(events, count, line, (int) (end - line));
+        }
+    }
+err_out_label:
+    free(buf);
+    fclose(fp);
+    return count;
+}
+
+// the fields the single pass captures, read back the way the cJSON path did
+static int __bench_parse_scan(const char* data, int len)
+{
+    volc_ws_event_t ev;
+
+    if (volc_ws_event_parse(data, len, &ev) != 0) {
+        return -1;
+    }
+    return (int) ev.type + ev.delta.len + ev.response_id.len + ev.status.len;
+}
+
+static int __bench_parse_cjson(const char* data, int len)
+{
+    cJSON* p_json = NULL;
+    char* p_type = NULL;
+    char* p_delta = NULL;
+    char* p_status = NULL;
+    char* p_response_id = NULL;
+    int ret = -1;
+
+    p_json = cJSON_ParseWithLength(data, len);
+    if (!p_json) {
+        return -1;
+    }
+    volc_json_read_string(p_json, "type", &p_type);
+    volc_json_read_string(p_json, "delta", &p_delta);
+    volc_json_read_string(p_json, "response.status", &p_status);
+    volc_json_read_string(p_json, "response_id", &p_response_id);
+    if (p_type) {
+        ret = (int) strlen(p_type) + (p_delta ? (int) strlen(p_delta) : 0) +
+              (p_response_id ? (int) strlen(p_response_id) : 0) + (p_status ? (int) strlen(p_status) : 0);
+    }
+    HAL_SAFE_FREE(p_type);
+    HAL_SAFE_FREE(p_delta);
+    HAL_SAFE_FREE(p_status);
+    HAL_SAFE_FREE(p_response_id);
+    cJSON_Delete(p_json);
+    return ret;
+}
+
+static void __bench_run(const char* label, bench_parse_fn fn, bench_event_t* events, int count, double seconds)
+{
+    uint64_t allocs = g_allocs;
+    uint64_t bytes = 0;
+    uint64_t parsed = 0;
+    uint64_t failed = 0;
+    double start = __now_seconds();
+    double wall = 0;
+    int i = 0;
+
+    do {
+        for (i = 0; i < BENCH_CHECK_EVERY; i++) {
+            bench_event_t* e = &events[parsed % count];
+            if (fn(e->data, e->len) < 0) {
+                failed++;
+            }
+            bytes += (uint64_t) e->len;
+            parsed++;
+        }
+        wall = __now_seconds() - start;
+    } while (wall < seconds);
+
+    printf("%-10s %12.0f events/s %10.1f MB/s %8.2f allocs/event %llu failed\n", label, parsed / wall,
+           bytes / wall / 1e6, (double) (g_allocs - allocs) / parsed, (unsigned long long) failed);
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = BENCH_DEFAULT_SECONDS;
+    int audio_bytes = BENCH_DEFAULT_AUDIO_BYTES;
+    bench_event_t* events = NULL;
+    cJSON_Hooks hooks = { hal_malloc, hal_free };
+    char* delta = NULL;
+    int delta_len = 0;
+    int count = 0;
+    int i = 0;
+
+    if (argc > 1) seconds = atof(argv[1]);
+    if (argc > 2) audio_bytes = atoi(argv[2]);
+    if (seconds <= 0 || audio_bytes <= 0) {
+        printf("usage: %s [seconds=%d] [audio_delta_bytes=%d] [events_file]\n", argv[0], BENCH_DEFAULT_SECONDS,
+               BENCH_DEFAULT_AUDIO_BYTES);
+        return 1;
+    }
+    cJSON_InitHooks(&hooks);
+
+    events = (bench_event_t*) calloc(BENCH_MAX_EVENTS, sizeof(bench_event_t));
+    if (NULL == events) {
+        printf("init failed\n");
+        return 1;
+    }
+    if (argc > 3) {
+        count = __bench_load_file(events, argv[3]);
+        printf("%d events from %s\n", count, argv[3]);
+    } else {
+        delta = __bench_audio_delta(audio_bytes, &delta_len);
+        if (NULL == delta) {
+            printf("init failed\n");
+            goto err_out_label;
+        }
+        for (i = 0; i < (int) (sizeof(s_turn) / sizeof(s_turn[0])); i++) {
+            count = __bench_add(events, count, s_turn[i], (int) strlen(s_turn[i]));
+        }
+        // one turn: the audio deltas outnumber everything else
+        for (i = 0; i < 16; i++) {
+            count = __bench_add(events, count, delta, delta_len);
+        }
+        printf("built in turn: %d events, audio deltas of %d bytes pcm\n", count, audio_bytes);
+    }
+    if (count == 0) {
+        printf("no events\n");
+        goto err_out_label;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (__bench_parse_scan(events[i].data, events[i].len) < 0 || __bench_parse_cjson(events[i].data, events[i].len) < 0) {
+            printf("event %d does not parse: %.80s\n", i, events[i].data);
+        }
+    }
+    __bench_run("cJSON", __bench_parse_cjson, events, count, seconds);
+    __bench_run("scan", __bench_parse_scan, events, count, seconds);
+    printf("heap: %llu allocs, %llu frees\n", (unsigned long long) g_allocs, (unsigned long long) g_frees);
+
+err_out_label:
+    for (i = 0; i < count; i++) {
+        free(events[i].data);
+    }
+    free(events);
+    free(delta);
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Websocket masking check and benchmark. ws_mask.c is built once per kernel
+ * the host can run (SSE2 or NEON, and the 8 byte word loop with
+ * WS_MASK_FORCE_SCALAR, see CMakeLists.txt), each one under its own
+ * ws_mask_copy_<kernel> name. Every kernel is first checked against a byte
+ * loop: all lengths, unaligned source and destination, in place, every
+ * mask offset, and a payload unmasked piece by piece with the offset carried
+ * on as ws_read_payload does. Then the throughput of each kernel and of the
+ * byte loop is reported.
+ *
+ *   ws_mask_bench [seconds] [payload]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_SECONDS (1)
+#define BENCH_DEFAULT_PAYLOAD (640)     // 20 ms of 16 kHz 16 bit mono
+#define BENCH_CHECK_MAX_LEN   (300)
+#define BENCH_PIECE_ROUNDS    (20000)
+#define BENCH_BUF_SIZE        (64 * 1024)
+
+typedef void (*bench_mask_fn)(char* dst, const char* src, int len, const char* mask, uint64_t offset);
+
+typedef struct {
+    const char* name;
+    bench_mask_fn mask_copy;
+} bench_kernel_t;
+
+#define BENCH_DECLARE_KERNEL(k) void ws_mask_copy_##k(char* dst, const char* src, int len, const char* mask, uint64_t offset);
+#define BENCH_KERNEL(k) { #k, ws_mask_copy_##k }
+
+#if defined(WS_MASK_BENCH_SCALAR)
+BENCH_DECLARE_KERNEL(scalar)
+#endif
+#if defined(WS_MASK_BENCH_SSE2)
+BENCH_DECLARE_KERNEL(sse2)
+#endif
+#if defined(WS_MASK_BENCH_NEON)
+BENCH_DECLARE_KERNEL(neon)
+#endif
+
+static void __bench_mask_bytes(char* dst, const char* src, int len, const char* mask, uint64_t offset);
+
+static bench_kernel_t s_kernels[] = {
+    { "byte", __bench_mask_bytes },
+#if defined(WS_MASK_BENCH_SCALAR)
+    BENCH_KERNEL(scalar),
+#endif
+#if defined(WS_MASK_BENCH_SSE2)
+    BENCH_KERNEL(sse2),
+#endif
+#if defined(WS_MASK_BENCH_NEON)
+    BENCH_KERNEL(neon),
+#endif
+};
+
+#define BENCH_KERNEL_COUNT ((int) (sizeof(s_kernels) / sizeof(s_kernels[0])))
+
+static uint32_t g_seed = 0x9E3779B9;
+static int g_failed = 0;
+
+static uint32_t __bench_rand(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 17;
+    g_seed ^= g_seed << 5;
+    return g_seed;
+}
+
+static double __now_seconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// the reference, straight from RFC 6455 5.3
+static void __bench_mask_bytes(char* dst, const char* src, int len, const char* mask, uint64_t offset)
+{
+    int i = 0;
+    for (i = 0; i < len; i++) {
+        dst[i] = src[i] ^ mask[(offset + i) & 3];
+    }
+}
+
+static void __bench_report(const char* what, const bench_kernel_t* k, int len, int src_off, int dst_off, uint64_t offset)
+{
+    if (g_failed++ < 20) {
+        printf("MISMATCH %s, kernel %s, len %d, src +%d, dst +%d, mask offset %llu\n", what, k->name, len, src_off,
+               dst_off, (unsigned long long) offset);
+    }
+}
+
+static void __bench_check_kernel(const bench_kernel_t* k)
+{
+    static char src[BENCH_CHECK_MAX_LEN + 64];
+    static char ref[BENCH_CHECK_MAX_LEN + 64];
+    static char out[BENCH_CHECK_MAX_LEN + 64];
+    static char frame[BENCH_BUF_SIZE];
+    static char whole[BENCH_BUF_SIZE];
+    char mask[4];
+    int len = 0;
+    int src_off = 0;
+    int dst_off = 0;
+    int done = 0;
+    int piece = 0;
+    int round = 0;
+    int i = 0;
+    uint64_t offset = 0;
+
+    for (i = 0; i < 4; i++) {
+        mask[i] = (char) __bench_rand();
+    }
+    for (len = 0; len <= BENCH_CHECK_MAX_LEN; len++) {
+        for (src_off = 0; src_off < 16; src_off++) {
+            for (i = 0; i < len; i++) {
+                src[src_off + i] = (char) __bench_rand();
+            }
+            for (offset = 0; offset < 8; offset++) {
+                __bench_mask_bytes(ref, src + src_off, len, mask, offset);
+                // guard bytes around the output must survive
+                dst_off = (src_off * 7 + (int) offset) & 15;
+                memset(out, 0x5a, sizeof(out));
+                k->mask_copy(out + dst_off, src + src_off, len, mask, offset);
+                if (memcmp(out + dst_off, ref, len) != 0 || (dst_off > 0 && out[dst_off - 1] != 0x5a) ||
+                    out[dst_off + len] != 0x5a) {
+                    __bench_report("copy", k, len, src_off, dst_off, offset);
+                }
+                memcpy(out + src_off, src + src_off, len);
+                k->mask_copy(out + src_off, out + src_off, len, mask, offset);
+                if (memcmp(out + src_off, ref, len) != 0) {
+                    __bench_report("in place", k, len, src_off, src_off, offset);
+                }
+            }
+        }
+    }
+
+    // a frame read in random pieces, the key carried on between them
+    for (round = 0; round < BENCH_PIECE_ROUNDS; round++) {
+        len = (int) (__bench_rand() % 4096);
+        for (i = 0; i < len; i++) {
+            frame[i] = (char) __bench_rand();
+        }
+        __bench_mask_bytes(whole, frame, len, mask, 0);
+        for (done = 0; done < len; done += piece) {
+            piece = 1 + (int) (__bench_rand() % (__bench_rand() & 1 ? 7 : 700));
+            if (piece > len - done) {
+                piece = len - done;
+            }
+            offset = (uint64_t) done;
+            k->mask_copy(frame + done, frame + done, piece, mask, offset);
+        }
+        if (memcmp(frame, whole, len) != 0) {
+            __bench_report("pieces", k, len, 0, 0, 0);
+        }
+    }
+}
+
+// MB/s
+static double __bench_rate(const bench_kernel_t* k, char* dst, const char* src, int len, double seconds)
+{
+    const char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    double start = __now_seconds();
+    double wall = 0;
+    uint64_t rounds = 0;
+    int i = 0;
+
+    do {
+        for (i = 0; i < 256; i++) {
+            k->mask_copy(dst, src, len, mask, (uint64_t) i);
+        }
+        rounds += 256;
+        wall = __now_seconds() - start;
+    } while (wall < seconds);
+    return rounds * (double) len / wall / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = BENCH_DEFAULT_SECONDS;
+    int payload = BENCH_DEFAULT_PAYLOAD;
+    char* src = NULL;
+    char* dst = NULL;
+    int ret = 1;
+    int i = 0;
+
+    if (argc > 1) seconds = atof(argv[1]);
+    if (argc > 2) payload = atoi(argv[2]);
+    if (seconds <= 0 || payload <= 0 || payload > BENCH_BUF_SIZE) {
+        printf("usage: %s [seconds=%d] [payload=%d, at most %d]\n", argv[0], BENCH_DEFAULT_SECONDS,
+               BENCH_DEFAULT_PAYLOAD, BENCH_BUF_SIZE);
+        return 1;
+    }
+
+    for (i = 1; i < BENCH_KERNEL_COUNT; i++) {
+        __bench_check_kernel(&s_kernels[i]);
+    }
+    if (g_failed > 0) {
+        printf("%d mismatches against the byte loop\n", g_failed);
+        return 1;
+    }
+    printf("all kernels match the byte loop\n");
+
+    // one byte past an aligned start, as a payload behind a frame header
+    src = (char*) malloc(payload + 1);
+    dst = (char*) malloc(payload + 1);
+    if (NULL == src || NULL == dst) {
+        printf("init failed\n");
+        goto err_out_label;
+    }
+    for (i = 0; i < payload + 1; i++) {
+        src[i] = (char) __bench_rand();
+    }
+    printf("%d byte payload, MB/s\n", payload);
+    printf("%-8s %10s %10s\n", "kernel", "copy", "in place");
+    for (i = 0; i < BENCH_KERNEL_COUNT; i++) {
+        printf("%-8s %10.0f %10.0f\n", s_kernels[i].name,
+               __bench_rate(&s_kernels[i], dst + 1, src + 1, payload, seconds),
+               __bench_rate(&s_kernels[i], dst + 1, dst + 1, payload, seconds));
+    }
+    ret = 0;
+
+err_out_label:
+    free(src);
+    free(dst);
+    return ret;
+}
@@ -4,6 +4,8 @@ set(VOLC_CONV_AI_SRCS "${CMAKE_CURRENT_LIST_DIR}/../src/volc_conv_ai.c"
                 "${CMAKE_CURRENT_LIST_DIR}/../src/util/volc_base64.c"
                 "${CMAKE_CURRENT_LIST_DIR}/../src/util/volc_http.c"
                 "${CMAKE_CURRENT_LIST_DIR}/../src/util/volc_json.c"
+                "${CMAKE_CURRENT_LIST_DIR}/../src/util/volc_net.c"
+                "${CMAKE_CURRENT_LIST_DIR}/../src/util/volc_queue.c"
                 "${CMAKE_CURRENT_LIST_DIR}/../third_party/mbedtls_port/tls_certificate.c"
                 "${CMAKE_CURRENT_LIST_DIR}/../third_party/mbedtls_port/tls_client.c"
                 "${CMAKE_CURRENT_LIST_DIR}/../third_party/webclient/src/webclient.c"
@@ -16,7 +18,9 @@ set(VOLC_CONV_AI_INCS "${CMAKE_CURRENT_LIST_DIR}/../inc"
                 CACHE INTERNAL "ConversationalAI-Embedded-Kit-2.0 common include dir")
 
 set(VOLC_CONV_AI_LOW_LOAD_SRCS "${CMAKE_CURRENT_LIST_DIR}/../src/transports/low_load/src/volc_ws.c"
+                        "${CMAKE_CURRENT_LIST_DIR}/../src/transports/low_load/src/volc_ws_event.c"
                         "${CMAKE_CURRENT_LIST_DIR}/../src/transports/low_load/third_party/websocket/websocket.c"
+                        "${CMAKE_CURRENT_LIST_DIR}/../src/transports/low_load/third_party/websocket/ws_mask.c"
                         CACHE INTERNAL "ConversationalAI-Embedded-Kit-2.0 low load solution src file")
 set(VOLC_CONV_AI_LOW_LOAD_INCS "${CMAKE_CURRENT_LIST_DIR}/../src/transports/low_load/inc"
                         "${CMAKE_CURRENT_LIST_DIR}/../src/transports/low_load/third_party/websocket"
@@ -4,6 +4,7 @@ option(ENABLE_RTC_MODE "Enable Conv AI RTC mode" OFF)
 option(ENABLE_WS_MODE  "Enable Conv AI WS mode"  OFF)
 option(ENABLE_CJSON "Enable cJSON" ON)
 option(ENABLE_MBEDTLS "Enable Mbedtls" ON)
+option(ENABLE_WS_DEFLATE "Enable websocket permessage-deflate" ON)
 
 if(NOT DEFINED VOLC_CONV_AI_PLATFORM_SRCS)
     set(VOLC_CONV_AI_PLATFORM_SRCS
@@ -89,6 +90,11 @@ endif()
 
 if(ENABLE_WS_MODE)
     target_compile_definitions(volc_conv_ai_a PRIVATE ENABLE_WS_MODE)
+    if(ENABLE_WS_DEFLATE)
+        target_compile_definitions(volc_conv_ai_a PRIVATE ENABLE_WS_DEFLATE)
+        target_include_directories(volc_conv_ai_a PRIVATE ${CMAKE_CURRENT_LIST_DIR}/../third_party/prebuilt/zlib/inc)
+        target_link_libraries(volc_conv_ai_a PRIVATE zlib_static)
+    endif()
 endif()
 
 if(ENABLE_RTC_MODE)
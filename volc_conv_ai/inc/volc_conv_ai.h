@@ -99,6 +99,7 @@ typedef enum {
     VOLC_EV_UNKNOWN = 0,          // 未知事件
     VOLC_EV_CONNECTED,            // 成功连接
     VOLC_EV_DISCONNECTED,         // 断开连接
+    VOLC_EV_SESSION_READY,        // 会话就绪，可以开始发送音频（WS 模式；RTC 模式仅 volc_start_async）
 } volc_event_code_e;
 
 typedef struct {
@@ -125,11 +126,58 @@ typedef enum {
     VOLC_AGENT_TYPE_UNKNOW,
 } volc_agent_type_e;
 
+typedef struct {
+    uint32_t audio_frames_coalesced;    // 被合并发送的上行音频帧数
+    uint32_t audio_messages_saved;      // 合并后少发送的消息数
+    uint64_t audio_bytes_saved;         // 合并后少发送的字节数（json 与 websocket 帧头）
+    uint32_t send_queue_depth;          // 当前发送队列中待发送的音频帧数
+    uint32_t send_queue_max_depth;      // 发送队列历史最大深度
+    uint32_t send_queue_dropped_overflow;   // 队列满时丢弃的最旧音频帧数
+    uint32_t send_queue_dropped_expired;    // 超过发送期限而丢弃的音频帧数
+    uint32_t send_queue_dropped_nomem;      // 入队时内存不足而丢弃的音频帧数
+    uint32_t interrupted_messages_dropped;  // 打断后丢弃的已取消回复的下行消息数
+    uint64_t interrupted_bytes_dropped;     // 打断后丢弃的已取消回复的下行字节数
+    uint32_t assembler_capacity;        // 下行消息拼包缓冲区当前容量（字节）
+    uint32_t assembler_high_water;      // 下行消息拼包缓冲区历史最大占用（字节）
+    uint32_t assembler_oversize_dropped;    // 超过 assembler_max_size 而丢弃的下行消息数
+    uint32_t send_lock_count;           // 当前连接写帧时获取发送锁的次数
+    uint32_t send_lock_wait_max_ms;     // 当前连接写帧等待发送锁的最长时间（毫秒）
+    uint64_t send_lock_wait_total_ms;   // 当前连接写帧等待发送锁的累计时间（毫秒）
+    uint64_t deflate_in_bytes;          // 当前连接压缩前的上行消息字节数（permessage-deflate）
+    uint64_t deflate_out_bytes;         // 当前连接压缩后实际发送的上行消息字节数
+    uint64_t deflate_time_us;           // 当前连接压缩耗时（微秒）
+    uint64_t inflate_in_bytes;          // 当前连接收到的压缩下行消息字节数
+    uint64_t inflate_out_bytes;         // 当前连接解压后的下行消息字节数
+    uint64_t inflate_time_us;           // 当前连接解压耗时（微秒）
+    uint32_t reconnect_count;           // 断线后重连成功的次数
+    uint32_t reconnect_last_ms;         // 最近一次从断线到重连成功的耗时（毫秒）
+    uint32_t reconnect_max_ms;          // 断线到重连成功的最长耗时（毫秒）
+    uint64_t reconnect_total_ms;        // 断线到重连成功的累计耗时（毫秒）
+    uint32_t audio_replayed_frames;     // 重连后补发的上行音频帧数（replay_ms）
+    uint64_t audio_replayed_bytes;      // 重连后补发的上行音频字节数
+    uint32_t ping_sent;                 // 链路空闲时发出的心跳 ping 数
+    uint32_t pong_received;             // 收到的对应 pong 数
+    uint32_t rtt_last_us;               // 最近一次 ping/pong 往返时延（微秒）
+    uint32_t rtt_srtt_us;               // 平滑往返时延 SRTT（微秒，RFC 6298），0 表示尚无样本
+    uint32_t rtt_var_us;                // 往返时延抖动 RTTVAR（微秒）
+    uint32_t dead_peer_count;           // 超过 dead_peer_ms 未收到任何数据而判定断线的次数
+    uint32_t tls_handshakes;            // 进程内完成的 TLS 握手数（websocket 与 HTTP 共用）
+    uint32_t tls_resumed;               // 其中复用缓存会话的简化握手数，复用率 = tls_resumed / tls_handshakes
+    uint32_t tls_handshake_failed;      // 失败的 TLS 握手数
+    uint32_t tls_handshake_last_ms;     // 最近一次 TLS 握手耗时（毫秒）
+    uint32_t tls_handshake_max_ms;      // TLS 握手最长耗时（毫秒）
+    uint64_t tls_handshake_total_ms;    // TLS 握手累计耗时（毫秒）
+    uint32_t http_requests;             // 进程内发出的 HTTP 请求数（设备注册、获取 RTC 配置等）
+    uint32_t http_conn_reused;          // 复用长连接发出的请求数，即省去的 TCP + TLS 握手次数
+    uint32_t http_stale_retries;        // 长连接已被服务端关闭、改用新连接重发的次数
+} volc_stats_t;
+
 typedef void* volc_engine_t;
 
 typedef struct {
     void (*on_volc_event)(volc_engine_t handle, volc_event_t* event, void* user_data);
     void (*on_volc_conversation_status)(volc_engine_t handle, volc_conv_status_e status, void* user_data);
+    // data_ptr points into the SDK receive buffer and is only valid until the callback returns
     void (*on_volc_audio_data)(volc_engine_t handle, const void* data_ptr, size_t data_len, volc_audio_frame_info_t* info_ptr, void* user_data);
     void (*on_volc_video_data)(volc_engine_t handle, const void* data_ptr, size_t data_len, volc_video_frame_info_t* info_ptr, void* user_data);
     void (*on_volc_message_data)(volc_engine_t handle, const void* data_ptr, size_t data_len, volc_message_info_t* info_ptr, void* user_data);
@@ -145,6 +193,10 @@ __volc_rt_api__ void volc_destroy(volc_engine_t handle);
 
 __volc_rt_api__ int volc_start(volc_engine_t handle, volc_opt_t* opt);
 
+// WS 模式下非阻塞启动，建连在后台进行，会话就绪后通过 on_volc_event 回调 VOLC_EV_SESSION_READY
+// RTC 模式下与 volc_start 一样阻塞至入会完成，成功后同样回调 VOLC_EV_SESSION_READY
+__volc_rt_api__ int volc_start_async(volc_engine_t handle, volc_opt_t* opt);
+
 __volc_rt_api__ int volc_stop(volc_engine_t handle);
 
 __volc_rt_api__ int volc_update(volc_engine_t handle, const void* data_ptr, size_t data_len);
@@ -159,6 +211,8 @@ __volc_rt_api__ int volc_send_text_to_agent(volc_engine_t handle, const char* te
 
 __volc_rt_api__ int volc_interrupt(volc_engine_t handle);
 
+__volc_rt_api__ int volc_get_stats(volc_engine_t handle, volc_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,11 +20,24 @@ void hal_free(void* ptr);
 typedef void* hal_mutex_t;
 hal_mutex_t hal_mutex_create(void);
 void hal_mutex_lock(hal_mutex_t mutex);
+// 0: locked, -1: held elsewhere, never waits
+int hal_mutex_trylock(hal_mutex_t mutex);
 void hal_mutex_unlock(hal_mutex_t mutex);
 void hal_mutex_destroy(hal_mutex_t mutex);
 
+// auto reset event, one waiter
+typedef void* hal_event_t;
+hal_event_t hal_event_create(void);
+void hal_event_set(hal_event_t event);
+// 0: signaled, -1: timeout
+int hal_event_wait(hal_event_t event, int timeout_ms);
+void hal_event_destroy(hal_event_t event);
+
 uint64_t hal_get_time_ms(void);
 
+// monotonic, for measuring short durations
+uint64_t hal_get_time_us(void);
+
 int hal_get_uuid(char* uuid, size_t size);
 
 #define THREAD_NAME_MAX_LEN 16
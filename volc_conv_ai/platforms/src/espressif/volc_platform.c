@@ -12,6 +12,7 @@
 #include <sys/socket.h>
 #include <esp_netif.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 void* hal_malloc(size_t size) {
     return heap_caps_malloc(size,MALLOC_CAP_SPIRAM | MALLOC_CAP_DEFAULT);
@@ -51,6 +52,10 @@ void hal_mutex_lock(hal_mutex_t mutex) {
     pthread_mutex_lock((pthread_mutex_t *)mutex);
 }
 
+int hal_mutex_trylock(hal_mutex_t mutex) {
+    return 0 == pthread_mutex_trylock((pthread_mutex_t *)mutex) ? 0 : -1;
+}
+
 void hal_mutex_unlock(hal_mutex_t mutex) {
     pthread_mutex_unlock((pthread_mutex_t *)mutex);
 }
@@ -64,12 +69,37 @@ void hal_mutex_destroy(hal_mutex_t mutex) {
     hal_free(p_mutex);
 }
 
+hal_event_t hal_event_create(void) {
+    return (hal_event_t)xSemaphoreCreateBinary();
+}
+
+void hal_event_set(hal_event_t event) {
+    xSemaphoreGive((SemaphoreHandle_t)event);
+}
+
+int hal_event_wait(hal_event_t event, int timeout_ms) {
+    return pdTRUE == xSemaphoreTake((SemaphoreHandle_t)event, pdMS_TO_TICKS(timeout_ms)) ? 0 : -1;
+}
+
+void hal_event_destroy(hal_event_t event) {
+    if (NULL == event) {
+        return;
+    }
+    vSemaphoreDelete((SemaphoreHandle_t)event);
+}
+
 uint64_t hal_get_time_ms(void) {
     struct timespec now_time;
     clock_gettime(CLOCK_REALTIME, &now_time);
     return (uint64_t)now_time.tv_sec * 1000 + (uint64_t)now_time.tv_nsec / 1000000;
 }
 
+uint64_t hal_get_time_us(void) {
+    struct timespec now_time;
+    clock_gettime(CLOCK_MONOTONIC, &now_time);
+    return (uint64_t)now_time.tv_sec * 1000000 + (uint64_t)now_time.tv_nsec / 1000;
+}
+
 int hal_get_uuid(char* uuid, size_t size) {
     esp_netif_t *netif = NULL;
     
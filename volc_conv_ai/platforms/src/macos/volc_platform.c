@@ -51,6 +51,10 @@ void hal_mutex_lock(hal_mutex_t mutex) {
     pthread_mutex_lock((pthread_mutex_t *)mutex);
 }
 
+int hal_mutex_trylock(hal_mutex_t mutex) {
+    return 0 == pthread_mutex_trylock((pthread_mutex_t *)mutex) ? 0 : -1;
+}
+
 void hal_mutex_unlock(hal_mutex_t mutex) {
     pthread_mutex_unlock((pthread_mutex_t *)mutex);
 }
@@ -64,12 +68,80 @@ void hal_mutex_destroy(hal_mutex_t mutex) {
     hal_free(p_mutex);
 }
 
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int signaled;
+} hal_event_impl_t;
+
+hal_event_t hal_event_create(void) {
+    hal_event_impl_t* p_event = (hal_event_impl_t *)hal_calloc(1, sizeof(hal_event_impl_t));
+    if (NULL == p_event) {
+        return NULL;
+    }
+    if (0 != pthread_mutex_init(&p_event->mutex, NULL)) {
+        hal_free(p_event);
+        return NULL;
+    }
+    if (0 != pthread_cond_init(&p_event->cond, NULL)) {
+        pthread_mutex_destroy(&p_event->mutex);
+        hal_free(p_event);
+        return NULL;
+    }
+    return (hal_event_t)p_event;
+}
+
+void hal_event_set(hal_event_t event) {
+    hal_event_impl_t* p_event = (hal_event_impl_t *)event;
+    pthread_mutex_lock(&p_event->mutex);
+    p_event->signaled = 1;
+    pthread_cond_signal(&p_event->cond);
+    pthread_mutex_unlock(&p_event->mutex);
+}
+
+int hal_event_wait(hal_event_t event, int timeout_ms) {
+    hal_event_impl_t* p_event = (hal_event_impl_t *)event;
+    struct timespec deadline;
+    int ret = 0;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&p_event->mutex);
+    while (!p_event->signaled && ret == 0) {
+        ret = pthread_cond_timedwait(&p_event->cond, &p_event->mutex, &deadline);
+    }
+    ret = p_event->signaled ? 0 : -1;
+    p_event->signaled = 0;
+    pthread_mutex_unlock(&p_event->mutex);
+    return ret;
+}
+
+void hal_event_destroy(hal_event_t event) {
+    hal_event_impl_t* p_event = (hal_event_impl_t *)event;
+    if (NULL == p_event) {
+        return;
+    }
+    pthread_cond_destroy(&p_event->cond);
+    pthread_mutex_destroy(&p_event->mutex);
+    hal_free(p_event);
+}
+
 uint64_t hal_get_time_ms(void) {
     struct timespec now_time;
     clock_gettime(CLOCK_REALTIME, &now_time);
     return (uint64_t)now_time.tv_sec * 1000 + (uint64_t)now_time.tv_nsec / 1000000;
 }
 
+uint64_t hal_get_time_us(void) {
+    struct timespec now_time;
+    clock_gettime(CLOCK_MONOTONIC, &now_time);
+    return (uint64_t)now_time.tv_sec * 1000000 + (uint64_t)now_time.tv_nsec / 1000;
+}
+
 int hal_get_uuid(char* uuid, size_t size) {
     int ret = 0;
     struct ifaddrs* ifa = NULL;
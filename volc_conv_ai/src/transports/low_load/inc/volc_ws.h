@@ -23,12 +23,17 @@ void volc_ws_destroy(volc_ws_t ws);
 
 int volc_ws_start(volc_ws_t ws, const char* bot_id, volc_iot_info_t* iot_info, const char* params);
 
+// returns once the connection is started, VOLC_MSG_SESSION_READY follows on session.created
+int volc_ws_start_async(volc_ws_t ws, const char* bot_id, volc_iot_info_t* iot_info, const char* params);
+
 int volc_ws_send(volc_ws_t ws, const void* data, int size, volc_data_info_t* data_info);
 
 int volc_ws_stop(volc_ws_t ws);
 
 int volc_ws_interrupt(volc_ws_t ws);
 
+int volc_ws_get_stats(volc_ws_t ws, volc_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,78 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __CONV_AI_NODE_VOLC_WS_EVENT_H__
+#define __CONV_AI_NODE_VOLC_WS_EVENT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    VOLC_WS_EV_UNKNOWN = 0,
+    VOLC_WS_EV_SESSION_CREATED,
+    VOLC_WS_EV_SPEECH_STARTED,
+    VOLC_WS_EV_SPEECH_STOPPED,
+    VOLC_WS_EV_AUDIO_DELTA,
+    VOLC_WS_EV_AUDIO_DONE,
+    VOLC_WS_EV_TRANSCRIPT_DELTA,
+    VOLC_WS_EV_TRANSCRIPT_DONE,
+    VOLC_WS_EV_RESPONSE_DONE,
+} volc_ws_event_type_e;
+
+// a string value inside the message buffer, quotes excluded
+typedef struct {
+    const char* ptr;
+    int len;
+    bool escaped;   // contains '\' escapes, raw bytes are not the decoded value
+} volc_ws_span_t;
+
+typedef struct {
+    volc_ws_event_type_e type;
+    volc_ws_span_t type_str;
+    volc_ws_span_t delta;
+    volc_ws_span_t response_id;
+    volc_ws_span_t status;      // response.status
+} volc_ws_event_t;
+
+/**
+ * @brief scan a realtime server event in a single pass without allocating.
+ *        Only the top level "type", "delta", "response_id" and the nested
+ *        "response.status" are captured, every span points into data.
+ *
+ * @return 0: success.
+ *        -1: malformed json or no "type" field.
+ */
+int volc_ws_event_parse(const char* data, int len, volc_ws_event_t* ev);
+
+/**
+ * @brief scan the head of a possibly incomplete event up to the opening quote
+ *        of its top level "delta" string. "type" and "response_id" are
+ *        captured when they come before it.
+ *
+ * @return 1: found, *delta_offset is the index of the first char of the value.
+ *         0: need more data.
+ *        -1: malformed, no "type" before "delta", or no string "delta" at all.
+ */
+int volc_ws_event_scan_delta(const char* data, int len, volc_ws_event_t* ev, int* delta_offset);
+
+/**
+ * @brief scan the head of a possibly incomplete event for its top level
+ *        "type" and "response_id", stopping as soon as both are known. Meant
+ *        for the first fragment of a message, before it is buffered.
+ *
+ * @return 1: both found, ev->type is resolved.
+ *         0: not in this data, or stopped at "delta" before finding them.
+ *        -1: not a json object.
+ */
+int volc_ws_event_scan_head(const char* data, int len, volc_ws_event_t* ev);
+
+bool volc_ws_span_equals(const volc_ws_span_t* span, const char* str);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __CONV_AI_NODE_VOLC_WS_EVENT_H__ */
@@ -9,21 +9,131 @@
 #include "util/volc_log.h"
 #include "util/volc_json.h"
 #include "util/volc_base64.h"
+#include "util/volc_net.h"
+#include "util/volc_queue.h"
 #include "websocket.h"
+#include "volc_ws_event.h"
 
 #define WS_AIGC_URI  "wss://ai-gateway.vei.volces.com"
 #define WS_AIGC_PATH "/v1/realtime"
 
 const char* ws_interrupt_str = "{\"type\": \"response.cancel\"}";
 
+#define WS_ASSEMBLER_SIZE_DEFAULT       (8 * 1024)
+#define WS_ASSEMBLER_SIZE_MIN           (1024)
+#define WS_ASSEMBLER_MAX_SIZE_DEFAULT   (256 * 1024)
+#define WS_ASSEMBLER_SHRINK_MS_DEFAULT  (5000)
+
+typedef enum {
+    WS_DISCARD_NONE = 0,
+    WS_DISCARD_CANCELLED,   // belongs to a cancelled response
+    WS_DISCARD_OVERSIZE,    // does not fit in max_size
+} ws_discard_e;
+
 typedef struct {
     uint8_t opcode;
     uint8_t* buffer;
     int size;
     int capacity;
+    int base_size;          // preallocated, grown capacity falls back to it once idle
+    int max_size;           // 0: no limit
+    int shrink_ms;          // how long capacity above base_size is kept after last use
+    uint64_t grown_ms;      // last time a message needed more than base_size
     int in_progress;
+    ws_discard_e discard;   // rest of the message is counted, not buffered
 } ws_assembler_t;
 
+#define WS_CANCELLED_MAX    4
+#define WS_RESPONSE_ID_MAX  64
+
+typedef struct {
+    uint32_t hash;      // of the whole id
+    int len;
+    char id[WS_RESPONSE_ID_MAX];   // longer ids are truncated, hash and len cover the rest
+} ws_response_id_t;
+
+// response ids cancelled by volc_ws_interrupt, the oldest is overwritten when full
+typedef struct {
+    ws_response_id_t ids[WS_CANCELLED_MAX];
+    int count;
+    int next;
+} ws_cancelled_set_t;
+
+#define WS_PROGRESSIVE_CHUNK_DEFAULT 960   // 30ms of 16kHz 16bit mono
+#define WS_PROGRESSIVE_SCAN_LIMIT    512   // give up if "delta" is not found this far in
+
+typedef enum {
+    WS_PROGRESSIVE_IDLE = 0,    // current message not classified yet
+    WS_PROGRESSIVE_DECODING,    // audio delta, decoded as fragments land
+    WS_PROGRESSIVE_DISCARD,     // rest of the message is not needed
+    WS_PROGRESSIVE_BYPASS,      // handled as a whole once complete
+} ws_progressive_state_e;
+
+typedef struct {
+    bool enable;
+    int chunk_size;
+    ws_progressive_state_e state;
+    int read_offset;    // next base64 char in the assembler buffer
+    int pcm_offset;     // decoded pcm is kept in place at this offset, 4 byte aligned
+    int pcm_len;        // decoded but not yet delivered
+} ws_progressive_t;
+
+typedef struct {
+    int max_ms;                 // 0: no time budget
+    int max_bytes;              // 0: no size budget
+    uint8_t* buffer;
+    int size;
+    int capacity;
+    int frames;
+    int separate_bytes;         // what the buffered frames would have cost one message each
+    uint64_t first_ms;
+    uint64_t last_ms;
+} ws_coalescer_t;
+
+#define WS_REPLAY_MAX_BYTES_DEFAULT (64 * 1024)
+
+typedef struct {
+    uint64_t ts_ms;
+    int len;
+} ws_replay_record_t;
+
+/*
+ * The last max_ms of uplink audio, records of ws_replay_record_t + audio laid
+ * out back to back between head and tail. Only touched by the audio sender.
+ */
+typedef struct {
+    int max_ms;                 // 0: no replay
+    int max_bytes;
+    uint8_t* buffer;
+    int head;                   // oldest record
+    int tail;                   // end of the newest record
+    volatile bool pending;      // connection lost, replay before the next frame goes out
+    bool commit_pending;        // a commit came while disconnected
+} ws_replay_t;
+
+#define WS_SEND_FLAG_COMMIT      0x1
+#define WS_SEND_TASK_STACK       (4 * 1024)
+#define WS_SEND_TASK_PRIORITY    (4)
+#define WS_SEND_TASK_IDLE_MS     (100)
+
+typedef struct {
+    int depth;                  // 0: send on the caller thread
+    int deadline_ms;            // 0: queued audio never expires
+    volc_queue_t* queue;
+    hal_event_t event;
+    hal_tid_t tid;
+    volatile bool run;
+    volatile bool exit;
+    bool commit_pending;        // a dropped item carried a commit, set by the producer
+} ws_send_queue_t;
+
+#define WS_READY_TIMEOUT_MS_DEFAULT (10000)
+
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+// shared by every engine in the process, created on first use and kept
+static volc_ws_reactor_t* g_ws_reactor = NULL;
+#endif
+
 typedef struct ws_params {
     volc_audio_codec_type_e audio_codec_type;
 } ws_params_t;
@@ -32,30 +142,129 @@ typedef struct {
     bool b_pipeline_started;
     bool b_connected;
     bool b_interrupted;
-    char* p_data_buf;
+    volatile bool b_session_ready;
+    hal_event_t ready_event;    // set on session.created
+    int ready_timeout_ms;
+    int reactor_threads;        // 0: one task per connection
+    volc_ws_deflate_config_t deflate;
+    volc_ws_reconnect_config_t reconnect;
+    volc_ws_keepalive_config_t keepalive;
+    volc_sock_opt_t sock_opt;
     char* p_bot_id;
-    char* p_last_response_id;
     char headers[1024];
     char uri[256];
     char event_id[64];
     int event_id_index;
-    size_t data_buf_size;
     void* context;
     volatile volc_conv_status_e conv_status;
     volc_msg_cb message_callback;
     volc_data_cb data_callback;
     char hardware_id[32];
+    ws_cancelled_set_t cancelled;
     ws_params_t params;
     ws_assembler_t assembler;
+    ws_progressive_t progressive;
+    ws_coalescer_t coalescer;
+    ws_send_queue_t send_queue;
+    ws_replay_t replay;
+    volc_stats_t stats;
     volc_ws_client_t* client;
 } ws_impl_t;
 
+// ws->stats is bumped by the caller, the sender and the rx task, and read by volc_ws_get_stats at any time
+#define WS_STAT_ADD(ws, field, n) __atomic_add_fetch(&(ws)->stats.field, (n), __ATOMIC_RELAXED)
+#define WS_STAT_LOAD(ws, field) __atomic_load_n(&(ws)->stats.field, __ATOMIC_RELAXED)
+
+static void __ws_stat_max(uint32_t* field, uint32_t value) {
+    uint32_t cur = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (value > cur) {
+        // a failed exchange reloads cur
+        if (__atomic_compare_exchange_n(field, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
 static int __ws_init(ws_impl_t* ws, cJSON* p_config)
 {
+    int dns_ttl_ms = 0;
+    char* tls_profile = NULL;
     int ret = volc_json_read_int(p_config, "audio.codec", (int*)&ws->params.audio_codec_type);
     if (ret != 0) {
         ws->params.audio_codec_type = VOLC_AUDIO_CODEC_TYPE_PCM;
     }
+    volc_json_read_bool(p_config, "progressive_decode", &ws->progressive.enable);
+    if (volc_json_read_int(p_config, "progressive_chunk", &ws->progressive.chunk_size) != 0 ||
+        ws->progressive.chunk_size < 4) {
+        ws->progressive.chunk_size = WS_PROGRESSIVE_CHUNK_DEFAULT;
+    }
+    // keep every chunk start 4 byte aligned
+    ws->progressive.chunk_size &= ~3;
+    volc_json_read_int(p_config, "coalesce_ms", &ws->coalescer.max_ms);
+    volc_json_read_int(p_config, "coalesce_bytes", &ws->coalescer.max_bytes);
+    volc_json_read_int(p_config, "send_queue_depth", &ws->send_queue.depth);
+    volc_json_read_int(p_config, "send_deadline_ms", &ws->send_queue.deadline_ms);
+    if (volc_json_read_int(p_config, "assembler_size", &ws->assembler.base_size) != 0 ||
+        ws->assembler.base_size < WS_ASSEMBLER_SIZE_MIN) {
+        ws->assembler.base_size = WS_ASSEMBLER_SIZE_DEFAULT;
+    }
+    if (volc_json_read_int(p_config, "assembler_max_size", &ws->assembler.max_size) != 0) {
+        ws->assembler.max_size = WS_ASSEMBLER_MAX_SIZE_DEFAULT;
+    } else if (ws->assembler.max_size > 0 && ws->assembler.max_size < ws->assembler.base_size) {
+        ws->assembler.max_size = ws->assembler.base_size;
+    }
+    if (volc_json_read_int(p_config, "assembler_shrink_ms", &ws->assembler.shrink_ms) != 0) {
+        ws->assembler.shrink_ms = WS_ASSEMBLER_SHRINK_MS_DEFAULT;
+    }
+    ws->assembler.buffer = (uint8_t*)hal_malloc(ws->assembler.base_size);
+    if (NULL == ws->assembler.buffer) {
+        LOGE("Failed to alloc assembler buffer, size: %d", ws->assembler.base_size);
+        return -1;
+    }
+    ws->assembler.capacity = ws->assembler.base_size;
+    if (volc_json_read_int(p_config, "ready_timeout_ms", &ws->ready_timeout_ms) != 0 || ws->ready_timeout_ms <= 0) {
+        ws->ready_timeout_ms = WS_READY_TIMEOUT_MS_DEFAULT;
+    }
+    volc_json_read_int(p_config, "reactor_threads", &ws->reactor_threads);
+    volc_json_read_bool(p_config, "deflate", &ws->deflate.enable);
+    volc_json_read_int(p_config, "deflate_client_window_bits", &ws->deflate.client_window_bits);
+    volc_json_read_int(p_config, "deflate_server_window_bits", &ws->deflate.server_window_bits);
+    volc_json_read_int(p_config, "deflate_mem_level", &ws->deflate.mem_level);
+    volc_json_read_bool(p_config, "deflate_no_context_takeover", &ws->deflate.no_context_takeover);
+    volc_json_read_int(p_config, "deflate_min_size", &ws->deflate.min_size);
+    volc_json_read_int(p_config, "reconnect_base_ms", &ws->reconnect.base_ms);
+    volc_json_read_int(p_config, "reconnect_max_ms", &ws->reconnect.max_ms);
+    volc_json_read_int(p_config, "ping_idle_ms", &ws->keepalive.idle_ms);
+    volc_json_read_int(p_config, "ping_probe_ms", &ws->keepalive.probe_ms);
+    volc_json_read_int(p_config, "dead_peer_ms", &ws->keepalive.dead_ms);
+    volc_json_read_int(p_config, "ping_rtt_ms", &ws->keepalive.rtt_ms);
+    ws->sock_opt.no_delay = true;
+    volc_json_read_bool(p_config, "socket.tcp_nodelay", &ws->sock_opt.no_delay);
+    volc_json_read_int(p_config, "socket.send_buffer", &ws->sock_opt.send_buffer);
+    volc_json_read_int(p_config, "socket.recv_buffer", &ws->sock_opt.recv_buffer);
+    volc_json_read_int(p_config, "socket.user_timeout_ms", &ws->sock_opt.user_timeout_ms);
+    volc_json_read_int(p_config, "socket.keepalive_idle_s", &ws->sock_opt.keepalive_idle_s);
+    volc_json_read_int(p_config, "socket.keepalive_interval_s", &ws->sock_opt.keepalive_interval_s);
+    volc_json_read_int(p_config, "socket.keepalive_count", &ws->sock_opt.keepalive_count);
+    volc_json_read_int(p_config, "socket.tos", &ws->sock_opt.tos);
+    if (volc_json_read_int(p_config, "dns_ttl_ms", &dns_ttl_ms) == 0) {
+        volc_net_set_dns_ttl(dns_ttl_ms);
+    }
+#if defined(CONFIG_WEBSOCKET_TLS)
+    if (volc_json_read_string(p_config, "tls_profile", &tls_profile) == 0) {
+        mbedtls_client_set_profile(tls_profile);
+        HAL_SAFE_FREE(tls_profile);
+    }
+#endif
+    volc_json_read_int(p_config, "replay_ms", &ws->replay.max_ms);
+    if (volc_json_read_int(p_config, "replay_max_bytes", &ws->replay.max_bytes) != 0 || ws->replay.max_bytes <= 0) {
+        ws->replay.max_bytes = WS_REPLAY_MAX_BYTES_DEFAULT;
+    }
+    ws->ready_event = hal_event_create();
+    if (NULL == ws->ready_event) {
+        LOGE("Failed to create ready event");
+        return -1;
+    }
     return 0;
 }
 
@@ -92,29 +301,86 @@ static void __send_data_2_user(ws_impl_t* ws, const char* data, int data_len, vo
     }
 }
 
-static bool __ws_drop_for_interrupted(ws_impl_t* ws, const char* p_response_id) {
-    if (ws->b_interrupted && p_response_id) {
-        ws->b_interrupted = false;
-        if (ws->p_last_response_id) {
-            hal_free(ws->p_last_response_id);
-            ws->p_last_response_id = NULL;
+// FNV-1a
+static uint32_t __ws_hash_response_id(const volc_ws_span_t* id) {
+    uint32_t hash = 2166136261u;
+    int i = 0;
+    for (i = 0; i < id->len; i++) {
+        hash ^= (uint8_t)id->ptr[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool __ws_cancelled_contains(ws_cancelled_set_t* set, const volc_ws_span_t* id, uint32_t hash) {
+    ws_response_id_t* entry = NULL;
+    int i = 0;
+    for (i = 0; i < set->count; i++) {
+        entry = &set->ids[i];
+        if (entry->hash == hash && entry->len == id->len &&
+            memcmp(entry->id, id->ptr, id->len < WS_RESPONSE_ID_MAX ? id->len : WS_RESPONSE_ID_MAX) == 0) {
+            return true;
         }
-        ws->p_last_response_id = strdup(p_response_id);
     }
-    if (ws->p_last_response_id && p_response_id && strcmp(ws->p_last_response_id, p_response_id) == 0) {
+    return false;
+}
+
+static void __ws_cancelled_add(ws_cancelled_set_t* set, const volc_ws_span_t* id, uint32_t hash) {
+    ws_response_id_t* entry = &set->ids[set->next];
+    entry->hash = hash;
+    entry->len = id->len;
+    memcpy(entry->id, id->ptr, id->len < WS_RESPONSE_ID_MAX ? id->len : WS_RESPONSE_ID_MAX);
+    set->next = (set->next + 1) % WS_CANCELLED_MAX;
+    if (set->count < WS_CANCELLED_MAX) {
+        set->count++;
+    }
+}
+
+static bool __ws_drop_for_interrupted(ws_impl_t* ws, const volc_ws_span_t* response_id) {
+    uint32_t hash = 0;
+    if (NULL == response_id->ptr || (!ws->b_interrupted && 0 == ws->cancelled.count)) {
+        return false;
+    }
+    hash = __ws_hash_response_id(response_id);
+    if (ws->b_interrupted) {
+        // the first response seen after response.cancel is the cancelled one
+        ws->b_interrupted = false;
+        if (!__ws_cancelled_contains(&ws->cancelled, response_id, hash)) {
+            __ws_cancelled_add(&ws->cancelled, response_id, hash);
+        }
         return true;
     }
-    return false;
+    return __ws_cancelled_contains(&ws->cancelled, response_id, hash);
 }
 
-static void __ws_recv_data(ws_impl_t* ws, const char* data, int data_len)
+/*
+ * Checks the first fragment of a message against the cancelled responses, so
+ * that the rest of it can be skipped without buffering or parsing.
+ */
+static bool __ws_head_is_cancelled(ws_impl_t* ws, volc_ws_event_data_t* data) {
+    volc_ws_event_t ev;
+    if (!ws->b_interrupted && 0 == ws->cancelled.count) {
+        return false;
+    }
+    if (data->op_code != VOLC_WS_OPCODES_TEXT ||
+        volc_ws_event_scan_head(data->data_ptr, data->data_len, &ev) != 1) {
+        return false;
+    }
+    switch (ev.type) {
+        case VOLC_WS_EV_AUDIO_DELTA:
+        case VOLC_WS_EV_AUDIO_DONE:
+        case VOLC_WS_EV_TRANSCRIPT_DELTA:
+        case VOLC_WS_EV_TRANSCRIPT_DONE:
+            return __ws_drop_for_interrupted(ws, &ev.response_id);
+        default:
+            return false;
+    }
+}
+
+static void __ws_recv_data(ws_impl_t* ws, char* data, int data_len)
 {
-    cJSON* p_json = NULL;
-    char* p_type = NULL;
-    char* p_delta = NULL;
-    char* p_status = NULL;
-    void* p_data = NULL;
-    char* p_response_id = NULL;
+    volc_ws_event_t ev;
+    uint8_t* p_pcm = NULL;
     size_t len = 0;
     volc_data_info_t info = { 0 };
     volc_msg_t msg = { 0 };
@@ -123,80 +389,94 @@ static void __ws_recv_data(ws_impl_t* ws, const char* data, int data_len)
         return;
     }
 
-    p_json = cJSON_ParseWithLength(data, data_len);
-    if (!p_json) {
+    if (volc_ws_event_parse(data, data_len, &ev) != 0) {
         LOGE("Failed to parse json, data_len: %d, data: %s", data_len, data);
         return;
     }
     // LOGI("json: %s", data);
-    volc_json_read_string(p_json, "type", &p_type);
-    volc_json_read_string(p_json, "delta", &p_delta);
-    volc_json_read_string(p_json, "response.status", &p_status);
-    if (strcmp(p_type, "response.audio.delta") == 0 && p_delta) {
-        if (strlen(p_delta) == 0) {
-            LOGE("delta is empty, data: %s", data);
-            goto err_out_label;
-        }
-        if (NULL == ws || !ws->b_pipeline_started) {
-            LOGD("pipeline not started");
-            goto err_out_label;
-        }
-        volc_json_read_string(p_json, "response_id", &p_response_id);
-        if (__ws_drop_for_interrupted(ws, p_response_id)) {
-            goto err_out_label;
-        }
-        len = volc_base64_decoded_length((const uint8_t*)p_delta, strlen(p_delta));
-        p_data = hal_malloc(len + 1);
-        if (NULL == p_data) {
-            LOGE("Failed to alloc memory");
-            goto err_out_label;
-        }
-        volc_base64_decode((unsigned char *)p_data, len, &len, (const unsigned char *)p_delta, strlen(p_delta));
-        info.type = VOLC_DATA_TYPE_AUDIO;
-        info.info.audio.data_type = VOLC_AUDIO_DATA_TYPE_PCM;
-        // info.info.audio.sent_ts = volc_get_time(); // TODO
-        __send_data_2_user(ws, p_data, len, &info);
-        HAL_SAFE_FREE(p_data);
-    } else if (strcmp(p_type, "input_audio_buffer.speech_started") == 0) {
-        ws->conv_status = VOLC_CONV_STATUS_LISTENING;
-        msg.code = VOLC_MSG_CONV_STATUS;
-        msg.data.conv_status = VOLC_CONV_STATUS_LISTENING;
-        __send_message_2_user(ws, &msg);
-    } else if (strcmp(p_type, "input_audio_buffer.speech_stopped") == 0) {
-        ws->conv_status = VOLC_CONV_STATUS_THINKING;
-        msg.code = VOLC_MSG_CONV_STATUS;
-        msg.data.conv_status = VOLC_CONV_STATUS_THINKING;
-        __send_message_2_user(ws, &msg);
-    } else if (strcmp(p_type, "response.done") == 0 && p_status) {
-        msg.code = VOLC_MSG_CONV_STATUS;
-        if (strcmp(p_status, "completed") == 0) {
-            ws->conv_status = VOLC_CONV_STATUS_ANSWER_FINISH;
-            msg.data.conv_status = VOLC_CONV_STATUS_ANSWER_FINISH;
-        } else if (strcmp(p_status, "cancelled") == 0) {
-            ws->conv_status = VOLC_CONV_STATUS_INTERRUPTED;
-            msg.data.conv_status = VOLC_CONV_STATUS_INTERRUPTED;
-        }
-        LOGI("data: %s", data);
-        __send_message_2_user(ws, &msg);
-    } else {
-        if (strcmp(p_type, "session.created") == 0) {
+    switch (ev.type) {
+        case VOLC_WS_EV_AUDIO_DELTA:
+            if (NULL == ev.delta.ptr) {
+                break;
+            }
+            if (ev.delta.len == 0) {
+                LOGE("delta is empty, data: %s", data);
+                return;
+            }
+            if (NULL == ws || !ws->b_pipeline_started) {
+                LOGD("pipeline not started");
+                return;
+            }
+            if (__ws_drop_for_interrupted(ws, &ev.response_id)) {
+                WS_STAT_ADD(ws, interrupted_messages_dropped, 1);
+                WS_STAT_ADD(ws, interrupted_bytes_dropped, data_len);
+                return;
+            }
+            // decoded pcm is never longer than its base64 text, so it is written over the
+            // delta in the assembler buffer. The start is rounded down to a 4 byte boundary,
+            // which only overwrites the already parsed "delta":" key in front of it.
+            p_pcm = (uint8_t*)((uintptr_t)ev.delta.ptr & ~(uintptr_t)3);
+            if (p_pcm < (uint8_t*)data) {
+                p_pcm = (uint8_t*)data;
+            }
+            if (volc_base64_decode_inplace(p_pcm, &len, (const unsigned char *)ev.delta.ptr, ev.delta.len) != 0) {
+                LOGE("Failed to decode audio delta, len: %d", ev.delta.len);
+                return;
+            }
+            info.type = VOLC_DATA_TYPE_AUDIO;
+            info.info.audio.data_type = VOLC_AUDIO_DATA_TYPE_PCM;
+            // info.info.audio.sent_ts = volc_get_time(); // TODO
+            __send_data_2_user(ws, (const char*)p_pcm, len, &info);
+            return;
+        case VOLC_WS_EV_SPEECH_STARTED:
+            ws->conv_status = VOLC_CONV_STATUS_LISTENING;
+            msg.code = VOLC_MSG_CONV_STATUS;
+            msg.data.conv_status = VOLC_CONV_STATUS_LISTENING;
+            __send_message_2_user(ws, &msg);
+            return;
+        case VOLC_WS_EV_SPEECH_STOPPED:
+            ws->conv_status = VOLC_CONV_STATUS_THINKING;
+            msg.code = VOLC_MSG_CONV_STATUS;
+            msg.data.conv_status = VOLC_CONV_STATUS_THINKING;
+            __send_message_2_user(ws, &msg);
+            return;
+        case VOLC_WS_EV_RESPONSE_DONE:
+            if (NULL == ev.status.ptr) {
+                break;
+            }
+            msg.code = VOLC_MSG_CONV_STATUS;
+            if (volc_ws_span_equals(&ev.status, "completed")) {
+                ws->conv_status = VOLC_CONV_STATUS_ANSWER_FINISH;
+                msg.data.conv_status = VOLC_CONV_STATUS_ANSWER_FINISH;
+            } else if (volc_ws_span_equals(&ev.status, "cancelled")) {
+                ws->conv_status = VOLC_CONV_STATUS_INTERRUPTED;
+                msg.data.conv_status = VOLC_CONV_STATUS_INTERRUPTED;
+            }
+            LOGI("data: %s", data);
+            __send_message_2_user(ws, &msg);
+            return;
+        case VOLC_WS_EV_SESSION_CREATED:
             LOGI("%s", data);
-        } else if (strcmp(p_type, "response.audio_transcript.delta") == 0 || strcmp(p_type, "response.audio_transcript.done") == 0 || strcmp(p_type, "response.audio.done") == 0) {
-            volc_json_read_string(p_json, "response_id", &p_response_id);
-            if (__ws_drop_for_interrupted(ws, p_response_id)) {
-                goto err_out_label;
+            ws->b_session_ready = true;
+            hal_event_set(ws->ready_event);
+            msg.code = VOLC_MSG_SESSION_READY;
+            __send_message_2_user(ws, &msg);
+            break;
+        case VOLC_WS_EV_TRANSCRIPT_DELTA:
+        case VOLC_WS_EV_TRANSCRIPT_DONE:
+        case VOLC_WS_EV_AUDIO_DONE:
+            if (__ws_drop_for_interrupted(ws, &ev.response_id)) {
+                WS_STAT_ADD(ws, interrupted_messages_dropped, 1);
+                WS_STAT_ADD(ws, interrupted_bytes_dropped, data_len);
+                return;
             }
-        }
-        info.type = VOLC_DATA_TYPE_MESSAGE;
-        info.info.message.is_binary = false;
-        __send_data_2_user(ws, data, data_len, &info);
+            break;
+        default:
+            break;
     }
-err_out_label:
-    HAL_SAFE_FREE(p_type);
-    HAL_SAFE_FREE(p_delta);
-    HAL_SAFE_FREE(p_status);
-    HAL_SAFE_FREE(p_response_id);
-    cJSON_Delete(p_json);
+    info.type = VOLC_DATA_TYPE_MESSAGE;
+    info.info.message.is_binary = false;
+    __send_data_2_user(ws, data, data_len, &info);
 }
 
 static void __ws_assembler_free(ws_assembler_t* a) {
@@ -204,6 +484,73 @@ static void __ws_assembler_free(ws_assembler_t* a) {
     a->size = 0;
     a->capacity = 0;
     a->in_progress = 0;
+    a->discard = WS_DISCARD_NONE;
+}
+
+// the buffer is reused as is, nothing depends on stale bytes being cleared
+static void __ws_assembler_reset(ws_impl_t* ws) {
+    if (ws->assembler.size > ws->assembler.base_size) {
+        ws->assembler.grown_ms = hal_get_time_ms();
+    }
+    ws->assembler.size = 0;
+    ws->assembler.in_progress = 0;
+    ws->assembler.discard = WS_DISCARD_NONE;
+    ws->progressive.state = WS_PROGRESSIVE_IDLE;
+}
+
+/*
+ * Makes room for len more bytes plus a terminator.
+ * Returns 0 on success, -1 if the message would exceed max_size, -2 if out of memory.
+ */
+static int __ws_assembler_reserve(ws_assembler_t* a, int len) {
+    int need = a->size + len + 1;
+    int new_capacity = a->capacity > 0 ? a->capacity : a->base_size;
+    uint8_t* new_buffer = NULL;
+    if (need <= a->capacity) {
+        return 0;
+    }
+    if (a->max_size > 0 && need > a->max_size) {
+        return -1;
+    }
+    while (new_capacity < need) {
+        new_capacity *= 2;
+    }
+    if (a->max_size > 0 && new_capacity > a->max_size) {
+        new_capacity = a->max_size;
+    }
+    LOGD("assembler grows, capacity: %d -> %d", a->capacity, new_capacity);
+    new_buffer = (uint8_t*)hal_realloc(a->buffer, new_capacity);
+    if (NULL == new_buffer) {
+        return -2;
+    }
+    a->buffer = new_buffer;
+    a->capacity = new_capacity;
+    return 0;
+}
+
+// called between messages, gives back capacity above base_size after a quiet period
+static void __ws_assembler_shrink(ws_assembler_t* a) {
+    uint8_t* new_buffer = NULL;
+    if (a->capacity <= a->base_size || a->size > 0 || a->shrink_ms < 0) {
+        return;
+    }
+    if (hal_get_time_ms() - a->grown_ms < (uint64_t)a->shrink_ms) {
+        return;
+    }
+    new_buffer = (uint8_t*)hal_realloc(a->buffer, a->base_size);
+    if (NULL == new_buffer) {
+        return;
+    }
+    LOGD("assembler shrinks, capacity: %d -> %d", a->capacity, a->base_size);
+    a->buffer = new_buffer;
+    a->capacity = a->base_size;
+}
+
+// the buffered part is given up, the rest of the message is only counted
+static void __ws_assembler_discard(ws_impl_t* ws) {
+    WS_STAT_ADD(ws, interrupted_bytes_dropped, ws->assembler.size);
+    ws->assembler.size = 0;
+    ws->assembler.discard = WS_DISCARD_CANCELLED;
 }
 
 static int __ws_generate_event_id(ws_impl_t* ws) {
@@ -253,10 +600,182 @@ static char* __ws_generate_session_update(ws_impl_t* ws) {
     return json;
 }
 
+static void __ws_progressive_emit(ws_impl_t* ws, bool flush) {
+    ws_progressive_t* p = &ws->progressive;
+    uint8_t* pcm = ws->assembler.buffer + p->pcm_offset;
+    int emitted = 0;
+    volc_data_info_t info = { 0 };
+
+    info.type = VOLC_DATA_TYPE_AUDIO;
+    info.info.audio.data_type = VOLC_AUDIO_DATA_TYPE_PCM;
+    while (p->pcm_len - emitted >= p->chunk_size) {
+        __send_data_2_user(ws, (const char*)pcm + emitted, p->chunk_size, &info);
+        emitted += p->chunk_size;
+    }
+    if (flush && p->pcm_len > emitted) {
+        __send_data_2_user(ws, (const char*)pcm + emitted, p->pcm_len - emitted, &info);
+        emitted = p->pcm_len;
+    }
+    if (emitted > 0 && p->pcm_len > emitted) {
+        memmove(pcm, pcm + emitted, p->pcm_len - emitted);
+    }
+    p->pcm_len -= emitted;
+}
+
+static void __ws_progressive_decode(ws_impl_t* ws, bool complete) {
+    ws_progressive_t* p = &ws->progressive;
+    char* start = (char*)ws->assembler.buffer + p->read_offset;
+    char* quote = NULL;
+    char* c = NULL;
+    int span = ws->assembler.size - p->read_offset;
+    int escapes = 0;
+    size_t len = 0;
+
+    quote = memchr(start, '"', span);
+    if (quote) {
+        span = (int)(quote - start);
+    } else if (!complete) {
+        // only whole 4 char groups, '\' does not count towards a group and never
+        // ends one, its '/' may still be on the way
+        for (c = memchr(start, '\\', span); c; c = memchr(c + 1, '\\', span - (int)(c + 1 - start))) {
+            escapes++;
+        }
+        while (((span - escapes) & 3) || (span > 0 && start[span - 1] == '\\')) {
+            if (start[span - 1] == '\\') {
+                escapes--;
+            }
+            span--;
+        }
+    }
+    if (span > 0) {
+        // output trails the input by at least a quarter, see __ws_recv_data
+        if (volc_base64_decode_inplace(ws->assembler.buffer + p->pcm_offset + p->pcm_len, &len,
+                                       (const unsigned char*)start, span) != 0) {
+            LOGE("Failed to decode audio delta, offset: %d, len: %d", p->read_offset, span);
+            p->pcm_len = 0;
+            p->state = WS_PROGRESSIVE_DISCARD;
+            return;
+        }
+        p->pcm_len += (int)len;
+        p->read_offset += span;
+    }
+    if (quote || complete) {
+        __ws_progressive_emit(ws, true);
+        p->state = WS_PROGRESSIVE_DISCARD;
+        return;
+    }
+    __ws_progressive_emit(ws, false);
+}
+
+/*
+ * Only the pending pcm and the undecoded tail are still needed while decoding,
+ * move both to the front so a long delta streams through a bounded buffer.
+ * The text is placed after the pcm so that decoding in place stays behind it.
+ */
+static void __ws_progressive_compact(ws_impl_t* ws) {
+    ws_progressive_t* p = &ws->progressive;
+    ws_assembler_t* a = &ws->assembler;
+    int text_offset = (p->pcm_len + 3) & ~3;
+    if (text_offset >= p->read_offset) {
+        return;
+    }
+    if (p->pcm_len > 0 && p->pcm_offset > 0) {
+        memmove(a->buffer, a->buffer + p->pcm_offset, p->pcm_len);
+    }
+    memmove(a->buffer + text_offset, a->buffer + p->read_offset, a->size - p->read_offset);
+    a->size = text_offset + a->size - p->read_offset;
+    p->pcm_offset = 0;
+    p->read_offset = text_offset;
+}
+
+/*
+ * Called for every fragment of a message when progressive decode is on.
+ * Returns true if the message has been taken over and must not be handed to
+ * __ws_recv_data once complete.
+ */
+static bool __ws_progressive_feed(ws_impl_t* ws, bool complete) {
+    ws_progressive_t* p = &ws->progressive;
+    volc_ws_event_t ev;
+    int delta_offset = 0;
+    int ret = 0;
+
+    if (p->state == WS_PROGRESSIVE_IDLE) {
+        if (complete) {
+            // arrived in one piece, nothing to gain
+            return false;
+        }
+        ret = volc_ws_event_scan_delta((const char*)ws->assembler.buffer, ws->assembler.size, &ev, &delta_offset);
+        if (ret == 0 && ws->assembler.size < WS_PROGRESSIVE_SCAN_LIMIT) {
+            return false;
+        }
+        // response_id has to be known up front for the interrupt check
+        if (ret != 1 || ev.type != VOLC_WS_EV_AUDIO_DELTA || NULL == ev.response_id.ptr || !ws->b_pipeline_started) {
+            p->state = WS_PROGRESSIVE_BYPASS;
+            return false;
+        }
+        if (__ws_drop_for_interrupted(ws, &ev.response_id)) {
+            __ws_assembler_discard(ws);
+            return true;
+        }
+        p->state = WS_PROGRESSIVE_DECODING;
+        p->read_offset = delta_offset;
+        p->pcm_offset = delta_offset & ~3;
+        p->pcm_len = 0;
+        LOGD("progressive decode, delta at %d", delta_offset);
+    }
+
+    switch (p->state) {
+        case WS_PROGRESSIVE_DECODING:
+            __ws_progressive_decode(ws, complete);
+            return true;
+        case WS_PROGRESSIVE_DISCARD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * rx sink of the websocket client: the next part of a message is read right
+ * behind what the assembler holds, __ws_append_data then finds it in place.
+ * Parts that are going to be dropped still go to the client's rx buffer.
+ */
+static char* __ws_rx_sink(void* context, const volc_ws_event_data_t* frame, int* len) {
+    ws_impl_t* ws = (ws_impl_t*)context;
+    ws_assembler_t* a = &ws->assembler;
+    if (frame->op_code == VOLC_WS_OPCODES_TEXT || frame->op_code == VOLC_WS_OPCODES_BINARY) {
+        if (frame->payload_offset == 0) {
+            __ws_assembler_shrink(a);
+        } else if (a->discard != WS_DISCARD_NONE) {
+            return NULL;
+        }
+    } else if (frame->op_code != VOLC_WS_OPCODES_CONT || !a->in_progress || a->discard != WS_DISCARD_NONE) {
+        return NULL;
+    }
+    if (ws->progressive.state == WS_PROGRESSIVE_DECODING && a->size + *len + 1 > a->capacity) {
+        __ws_progressive_compact(ws);
+    }
+    if (__ws_assembler_reserve(a, *len) != 0) {
+        return NULL;
+    }
+    *len = a->capacity - a->size - 1;
+    return (char*)a->buffer + a->size;
+}
+
 static void __ws_append_data(ws_impl_t* ws, volc_ws_event_data_t* data) {
-    int new_capacity = 0;
-    uint8_t* new_buffer = NULL;
+    bool complete = false;
+    bool handled = false;
+    // read there by __ws_rx_sink, room is already reserved
+    bool in_place = ws->assembler.buffer && data->data_ptr == (char*)ws->assembler.buffer + ws->assembler.size;
+    int ret = 0;
     if (data->op_code == VOLC_WS_OPCODES_TEXT || data->op_code == VOLC_WS_OPCODES_BINARY) {
+        if (data->payload_offset == 0) {
+            // first fragment of a new message
+            if (!in_place) {
+                __ws_assembler_shrink(&ws->assembler);
+            }
+            ws->assembler.discard = __ws_head_is_cancelled(ws, data) ? WS_DISCARD_CANCELLED : WS_DISCARD_NONE;
+        }
         ws->assembler.in_progress = 1;
         ws->assembler.opcode = data->op_code;
     } else if (data->op_code == VOLC_WS_OPCODES_CONT) {
@@ -270,34 +789,65 @@ static void __ws_append_data(ws_impl_t* ws, volc_ws_event_data_t* data) {
     }
 
     if (ws->assembler.in_progress) {
-        new_capacity = ws->assembler.size + data->data_len + 1;
-        if (new_capacity > ws->assembler.capacity) {
-            LOGI("append data, new_capacity: %d", new_capacity);
-            new_capacity = new_capacity < 1024 ? 1024 : new_capacity * 2;
-            new_buffer = hal_realloc(ws->assembler.buffer, new_capacity);
-            if (new_buffer == NULL) {
+        complete = data->fin && (data->payload_len == data->payload_offset + data->data_len);
+        if (ws->assembler.discard == WS_DISCARD_NONE && !in_place) {
+            if (ws->progressive.state == WS_PROGRESSIVE_DECODING &&
+                ws->assembler.size + data->data_len + 1 > ws->assembler.capacity) {
+                __ws_progressive_compact(ws);
+            }
+            ret = __ws_assembler_reserve(&ws->assembler, data->data_len);
+            if (ret == -2) {
                 LOGE("Failed to alloc memory");
                 __ws_assembler_free(&ws->assembler);
+                ws->progressive.state = WS_PROGRESSIVE_IDLE;
                 return;
             }
-            ws->assembler.buffer = new_buffer;
-            ws->assembler.capacity = new_capacity;
+            if (ret == -1) {
+                LOGW("message exceeds assembler_max_size %d, dropped", ws->assembler.max_size);
+                ws->assembler.discard = WS_DISCARD_OVERSIZE;
+            }
+        }
+        if (ws->assembler.discard != WS_DISCARD_NONE) {
+            if (ws->assembler.discard == WS_DISCARD_CANCELLED) {
+                WS_STAT_ADD(ws, interrupted_bytes_dropped, data->data_len);
+            }
+            if (complete) {
+                if (ws->assembler.discard == WS_DISCARD_CANCELLED) {
+                    WS_STAT_ADD(ws, interrupted_messages_dropped, 1);
+                } else {
+                    WS_STAT_ADD(ws, assembler_oversize_dropped, 1);
+                }
+                __ws_assembler_reset(ws);
+            }
+            return;
+        }
+        if (!in_place) {
+            memcpy(ws->assembler.buffer + ws->assembler.size, data->data_ptr, data->data_len);
         }
-        memcpy(ws->assembler.buffer + ws->assembler.size, data->data_ptr, data->data_len);
         ws->assembler.size += data->data_len;
+        __ws_stat_max(&ws->stats.assembler_high_water, (uint32_t)ws->assembler.size);
 
-        if (data->fin && (data->payload_len == data->payload_offset + data->data_len)) {
+        if (ws->progressive.enable) {
+            handled = __ws_progressive_feed(ws, complete);
+        }
+        if (complete) {
             LOGD("append data, fin, len: %d", ws->assembler.size);
-            ws->assembler.buffer[ws->assembler.size] = 0;
-            __ws_recv_data(ws, (const char*)ws->assembler.buffer, ws->assembler.size);
-            memset(ws->assembler.buffer, 0, ws->assembler.capacity);
-            ws->assembler.size = 0;
-            ws->assembler.in_progress = 0;
+            if (ws->assembler.discard == WS_DISCARD_CANCELLED) {
+                WS_STAT_ADD(ws, interrupted_messages_dropped, 1);
+            } else if (!handled) {
+                ws->assembler.buffer[ws->assembler.size] = 0;
+                __ws_recv_data(ws, (char*)ws->assembler.buffer, ws->assembler.size);
+            }
+            __ws_assembler_reset(ws);
         }
     }
 }
 
 static void __ws_stop(ws_impl_t* ws);
+static void __ws_send_session_update(ws_impl_t* ws);
+static void __ws_coalesce_reset(ws_coalescer_t* c);
+static int __ws_send_queue_start(ws_impl_t* ws);
+static void __ws_send_queue_stop(ws_impl_t* ws);
 static void  __ws_event_handler(void* context, int32_t event_id, void* event_data) {
     ws_impl_t* ws = (ws_impl_t*)context;
     volc_msg_t msg = { 0 };
@@ -309,11 +859,19 @@ static void  __ws_event_handler(void* context, int32_t event_id, void* event_dat
     switch (event_id) {
         case VOLC_WS_EVENT_CONNECTED:
             ws->b_connected = true;
+            // straight from the socket task, the session is not ready before it
+            if (__ws_wait_for_session_update(ws)) {
+                __ws_send_session_update(ws);
+            }
             msg.code = VOLC_MSG_CONNECTED;
             __send_message_2_user(ws, &msg);
             break;
         case VOLC_WS_EVENT_DISCONNECTED:
             ws->b_connected = false;
+            ws->b_session_ready = false;
+            if (ws->replay.max_ms > 0) {
+                ws->replay.pending = true;
+            }
             msg.code = VOLC_MSG_DISCONNECTED;
             __send_message_2_user(ws, &msg);
             break;
@@ -339,7 +897,54 @@ static int __ws_send_message(ws_impl_t* ws, const void* data_ptr, size_t data_le
     return volc_ws_client_send_text(ws->client, (const char*)data_ptr, data_len, 1000);
 }
 
-static int __ws_start(ws_impl_t* ws, volc_iot_info_t* iot_info)
+static void __ws_send_session_update(ws_impl_t* ws) {
+    char* session_update = __ws_generate_session_update(ws);
+    if (NULL == session_update) {
+        LOGE("failed to generate session.update");
+        return;
+    }
+    if (__ws_send_message(ws, session_update, strlen(session_update)) <= 0) {
+        LOGE("failed to send session.update");
+    }
+    hal_free(session_update);
+}
+
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+static volc_ws_reactor_t* __ws_shared_reactor(int threads)
+{
+    volc_ws_reactor_t* reactor = __atomic_load_n(&g_ws_reactor, __ATOMIC_ACQUIRE);
+    volc_ws_reactor_t* expected = NULL;
+    if (reactor) {
+        return reactor;
+    }
+    reactor = volc_ws_reactor_create(threads);
+    if (NULL == reactor) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&g_ws_reactor, &expected, reactor, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // lost the race to another engine
+        volc_ws_reactor_destroy(reactor);
+        reactor = expected;
+    }
+    return reactor;
+}
+#endif
+
+static int __ws_client_start(ws_impl_t* ws)
+{
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+    volc_ws_reactor_t* reactor = NULL;
+    if (ws->reactor_threads > 0) {
+        if (NULL != (reactor = __ws_shared_reactor(ws->reactor_threads))) {
+            return volc_ws_client_start_on(ws->client, reactor);
+        }
+        LOGW("failed to create websocket reactor, fall back to a client task");
+    }
+#endif
+    return volc_ws_client_start(ws->client);
+}
+
+static int __ws_start(ws_impl_t* ws, volc_iot_info_t* iot_info, bool wait)
 {
     uint64_t current_time = hal_get_time_ms();
     bool b_wait_for_session_update = __ws_wait_for_session_update(ws);
@@ -376,26 +981,41 @@ static int __ws_start(ws_impl_t* ws, volc_iot_info_t* iot_info)
     ws_cfg.user_context = ws;
     ws_cfg.buffer_size = 1024 * 5;
     ws_cfg.ws_event_handler = __ws_event_handler;
+    ws_cfg.rx_sink = __ws_rx_sink;
+    ws_cfg.deflate = ws->deflate;
+    ws_cfg.reconnect = ws->reconnect;
+    ws_cfg.keepalive = ws->keepalive;
+    ws_cfg.sock_opt = ws->sock_opt;
+    ws->b_session_ready = false;
+    // drop a signal left over from a previous session
+    hal_event_wait(ws->ready_event, 0);
 	ws->client = volc_ws_client_init(&ws_cfg);
-	if(volc_ws_client_start(ws->client)) {
+	if(__ws_client_start(ws)) {
         LOGE("Failed to start websocket client");
 		return -1;
 	}
-    if (b_wait_for_session_update) {
-        // wait for session.update
-        while (!ws->b_connected) {
-            hal_thread_sleep(10);
-        }
-        char* session_update = __ws_generate_session_update(ws);
-        if (session_update) {
-            __ws_send_message(ws, session_update, strlen(session_update));
-            hal_free(session_update);
-        }
+    if (ws->send_queue.depth > 0 && __ws_send_queue_start(ws) != 0) {
+        LOGW("failed to start send queue, audio is sent synchronously");
     }
     ws->b_pipeline_started = true;
+    // session.update goes out from the connected event, audio is only accepted after session.created
+    if (wait && b_wait_for_session_update && !ws->b_session_ready &&
+        hal_event_wait(ws->ready_event, ws->ready_timeout_ms) != 0) {
+        LOGE("session not ready in %d ms", ws->ready_timeout_ms);
+        __ws_stop(ws);
+        return -1;
+    }
     return 0;
 }
 
+static void __ws_replay_free(ws_replay_t* r) {
+    HAL_SAFE_FREE(r->buffer);
+    r->head = 0;
+    r->tail = 0;
+    r->pending = false;
+    r->commit_pending = false;
+}
+
 static void __ws_stop(ws_impl_t* ws)
 {
     if (!ws) {
@@ -406,31 +1026,58 @@ static void __ws_stop(ws_impl_t* ws)
         LOGI("pipeline not started");
         return;
     }
+    __ws_send_queue_stop(ws);
     volc_ws_client_destroy(ws->client);
     ws->client = NULL;
+    __ws_coalesce_reset(&ws->coalescer);
+    __ws_replay_free(&ws->replay);
+    memset(&ws->cancelled, 0, sizeof(ws->cancelled));
     ws->b_pipeline_started = false;
 }
 
-static int __ws_input_audio_buffer_append(ws_impl_t* ws, const char* data_ptr, size_t data_len) {
+#define WS_AUDIO_APPEND_PREFIX "{\"type\":\"input_audio_buffer.append\",\"audio\":\""
+#define WS_AUDIO_APPEND_SUFFIX "\"}"
+
+typedef struct {
+    const uint8_t* data;
+    size_t data_len;
+} ws_audio_append_t;
+
+// {"type":"input_audio_buffer.append","audio":"<base64>"} written straight into the tx buffer
+static int __ws_write_audio_append(void* ctx, char* buf, int cap) {
+    ws_audio_append_t* append = (ws_audio_append_t*)ctx;
+    int prefix_len = sizeof(WS_AUDIO_APPEND_PREFIX) - 1;
+    int suffix_len = sizeof(WS_AUDIO_APPEND_SUFFIX) - 1;
+    int need = prefix_len + volc_base64_encoded_length(append->data_len) - 1 + suffix_len;
+    size_t olen = 0;
+    if (need > cap) {
+        return need;
+    }
+    memcpy(buf, WS_AUDIO_APPEND_PREFIX, prefix_len);
+    volc_base64_encode((unsigned char*)buf + prefix_len, cap - prefix_len, &olen, append->data, append->data_len);
+    if (olen == 0) {
+        return -1;
+    }
+    memcpy(buf + prefix_len + olen, WS_AUDIO_APPEND_SUFFIX, suffix_len);
+    return prefix_len + (int)olen + suffix_len;
+}
+
+static int __ws_input_audio_buffer_append(ws_impl_t* ws, const void* data_ptr, size_t data_len) {
     int ret = 0;
-    cJSON* root = NULL;
+    ws_audio_append_t append = { 0 };
     if (!ws || !data_ptr || data_len == 0) {
         LOGE("ws or data or data_len is NULL");
         return -1;
     }
 
-    root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "type", "input_audio_buffer.append");
-    cJSON_AddStringToObject(root, "audio", data_ptr);
-    char* json = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    ret = volc_ws_client_send_text(ws->client, json, strlen(json), 1000);
+    append.data = (const uint8_t*)data_ptr;
+    append.data_len = data_len;
+    ret = volc_ws_client_send_text_with_writer(ws->client, __ws_write_audio_append, &append, 1000);
     if (ret >= 0) {
         ret = 0;
     } else {
         LOGW("failed to send audio buffer");
     }
-    HAL_SAFE_FREE(json);
     return ret;
 }
 
@@ -481,45 +1128,380 @@ static int __ws_response_create(ws_impl_t* ws) {
     return ret;
 }
 
+// bytes on the wire for one append message carrying data_len bytes of audio
+static int __ws_audio_append_cost(int data_len) {
+    int payload = sizeof(WS_AUDIO_APPEND_PREFIX) - 1 + volc_base64_encoded_length(data_len) - 1 + sizeof(WS_AUDIO_APPEND_SUFFIX) - 1;
+    int header = 2 + 4; // masked client frame
+    if (payload >= 65536) {
+        header += 8;
+    } else if (payload > 125) {
+        header += 2;
+    }
+    return header + payload;
+}
+
+static bool __ws_coalesce_enabled(ws_impl_t* ws) {
+    return ws->coalescer.max_ms > 0 || ws->coalescer.max_bytes > 0;
+}
+
+static void __ws_coalesce_reset(ws_coalescer_t* c) {
+    c->size = 0;
+    c->frames = 0;
+    c->separate_bytes = 0;
+    c->first_ms = 0;
+    c->last_ms = 0;
+}
+
+static int __ws_coalesce_flush(ws_impl_t* ws) {
+    ws_coalescer_t* c = &ws->coalescer;
+    int ret = 0;
+    if (c->size == 0) {
+        return 0;
+    }
+    ret = __ws_input_audio_buffer_append(ws, c->buffer, c->size);
+    if (ret == 0 && c->frames > 1) {
+        WS_STAT_ADD(ws, audio_frames_coalesced, c->frames);
+        WS_STAT_ADD(ws, audio_messages_saved, c->frames - 1);
+        WS_STAT_ADD(ws, audio_bytes_saved, c->separate_bytes - __ws_audio_append_cost(c->size));
+    }
+    __ws_coalesce_reset(c);
+    return ret;
+}
+
+// 0: nothing held or no latency budget
+static uint64_t __ws_coalesce_deadline(ws_coalescer_t* c) {
+    if (c->size == 0 || c->max_ms <= 0) {
+        return 0;
+    }
+    return c->first_ms + c->max_ms;
+}
+
+static int __ws_coalesce_append(ws_impl_t* ws, const void* data_ptr, size_t data_len, bool* flush) {
+    ws_coalescer_t* c = &ws->coalescer;
+    uint64_t now = hal_get_time_ms();
+    int new_capacity = 0;
+    uint8_t* new_buffer = NULL;
+
+    if (c->size + (int)data_len > c->capacity) {
+        new_capacity = c->size + (int)data_len;
+        if (new_capacity < c->max_bytes) {
+            new_capacity = c->max_bytes;
+        }
+        new_buffer = hal_realloc(c->buffer, new_capacity);
+        if (NULL == new_buffer) {
+            LOGE("failed to alloc coalesce buffer, size: %d", new_capacity);
+            return -1;
+        }
+        c->buffer = new_buffer;
+        c->capacity = new_capacity;
+    }
+    memcpy(c->buffer + c->size, data_ptr, data_len);
+    c->size += (int)data_len;
+    c->separate_bytes += __ws_audio_append_cost((int)data_len);
+    if (c->frames++ == 0) {
+        c->first_ms = now;
+        c->last_ms = now;
+    }
+
+    if (c->max_bytes > 0 && c->size >= c->max_bytes) {
+        *flush = true;
+    }
+    // flush now if waiting for one more frame would overrun the latency budget
+    if (c->max_ms > 0 && now - c->first_ms + (now - c->last_ms) >= (uint64_t)c->max_ms) {
+        *flush = true;
+    }
+    c->last_ms = now;
+    return 0;
+}
+
+static int __ws_commit_audio(ws_impl_t* ws) {
+    int ret = 0;
+    if (__ws_coalesce_flush(ws) != 0) {
+        LOGE("failed to append audio buffer");
+    }
+    ret = __ws_input_audio_buffer_commit(ws);
+    if (ret != 0) {
+        LOGE("failed to commit audio buffer");
+        return -1;
+    }
+    return __ws_response_create(ws);
+}
+
+static int __ws_replay_next(ws_replay_t* r, int offset, ws_replay_record_t* record) {
+    memcpy(record, r->buffer + offset, sizeof(*record));
+    return offset + (int)sizeof(*record) + record->len;
+}
+
+static void __ws_replay_trim(ws_replay_t* r, uint64_t now) {
+    ws_replay_record_t record;
+    int next = 0;
+    while (r->head < r->tail) {
+        next = __ws_replay_next(r, r->head, &record);
+        if (now - record.ts_ms <= (uint64_t)r->max_ms) {
+            break;
+        }
+        r->head = next;
+    }
+    if (r->head == r->tail) {
+        r->head = 0;
+        r->tail = 0;
+    }
+}
+
+// keeps a copy of every audio frame for max_ms, older audio makes room for newer
+static void __ws_replay_record(ws_replay_t* r, const void* data_ptr, int data_len) {
+    ws_replay_record_t record = { hal_get_time_ms(), data_len };
+    int need = (int)sizeof(record) + data_len;
+    if (need > r->max_bytes) {
+        return;
+    }
+    if (NULL == r->buffer && NULL == (r->buffer = (uint8_t*)hal_malloc(r->max_bytes))) {
+        LOGE("failed to alloc replay buffer, size: %d", r->max_bytes);
+        return;
+    }
+    __ws_replay_trim(r, record.ts_ms);
+    while (r->tail - r->head + need > r->max_bytes) {
+        ws_replay_record_t oldest;
+        r->head = __ws_replay_next(r, r->head, &oldest);
+    }
+    if (r->tail + need > r->max_bytes) {
+        memmove(r->buffer, r->buffer + r->head, r->tail - r->head);
+        r->tail -= r->head;
+        r->head = 0;
+    }
+    memcpy(r->buffer + r->tail, &record, sizeof(record));
+    memcpy(r->buffer + r->tail + sizeof(record), data_ptr, data_len);
+    r->tail += need;
+}
+
+/*
+ * First send after a reconnect: whatever the coalescer held is also in the
+ * replay buffer, so it is dropped and the last max_ms go out frame by frame.
+ */
+static int __ws_replay_flush(ws_impl_t* ws) {
+    ws_replay_t* r = &ws->replay;
+    ws_replay_record_t record;
+    int offset = 0;
+    int next = 0;
+
+    __ws_coalesce_reset(&ws->coalescer);
+    __ws_replay_trim(r, hal_get_time_ms());
+    for (offset = r->head; offset < r->tail; offset = next) {
+        next = __ws_replay_next(r, offset, &record);
+        if (__ws_input_audio_buffer_append(ws, r->buffer + offset + sizeof(record), record.len) != 0) {
+            // lost again, the rest is replayed on the next reconnect
+            r->head = offset;
+            return -1;
+        }
+        WS_STAT_ADD(ws, audio_replayed_frames, 1);
+        WS_STAT_ADD(ws, audio_replayed_bytes, record.len);
+    }
+    LOGI("replayed %d bytes of audio after reconnect", r->tail - r->head);
+    r->pending = false;
+    if (r->commit_pending) {
+        r->commit_pending = false;
+        __ws_commit_audio(ws);
+    }
+    return 0;
+}
+
+static bool __ws_audio_ready(ws_impl_t* ws) {
+    return ws->b_connected && (ws->b_session_ready || !__ws_wait_for_session_update(ws));
+}
+
 static int __ws_send_audio(ws_impl_t* ws, const void* data_ptr, size_t data_len, bool commit) {
     int ret = 0;
-    size_t len = 0;
+    bool flush = commit;
+    uint64_t deadline = 0;
     if (!ws || !data_ptr || !data_len) {
         LOGE("ws or data or info is NULL");
         return -1;
     }
-    len = volc_base64_encoded_length(data_len);
-    if (ws->data_buf_size < len) {
-        HAL_SAFE_FREE(ws->p_data_buf);
-        ws->p_data_buf = (char*)hal_malloc(len);
-        if (!ws->p_data_buf) {
-            LOGE("failed to malloc data buf");
-            ws->data_buf_size = 0;
-            return -1;
+    if (ws->replay.max_ms > 0) {
+        __ws_replay_record(&ws->replay, data_ptr, (int)data_len);
+        if (!__ws_audio_ready(ws)) {
+            // kept until the connection is back and the session ready
+            ws->replay.pending = true;
+            ws->replay.commit_pending |= commit;
+            return 0;
+        }
+        if (ws->replay.pending) {
+            // this frame is the newest record, it goes out with the replay
+            ws->replay.commit_pending |= commit;
+            return __ws_replay_flush(ws) == 0 ? 0 : -1;
         }
-        ws->data_buf_size = len;
     }
-    volc_base64_encode((unsigned char*) ws->p_data_buf, len, &len, (const unsigned char*) data_ptr, data_len);
-    if (ret != 0) {
-        LOGE("failed to encode audio");
-        return -1;
+    if (__ws_coalesce_enabled(ws)) {
+        // the held audio ran out of budget while no frame came, it goes out on its own first
+        deadline = __ws_coalesce_deadline(&ws->coalescer);
+        if (deadline > 0 && hal_get_time_ms() >= deadline && __ws_coalesce_flush(ws) != 0) {
+            LOGE("failed to append audio buffer");
+            return -1;
+        }
+        if (__ws_coalesce_append(ws, data_ptr, data_len, &flush) != 0) {
+            // keep the audio flowing even without a coalesce buffer
+            ret = __ws_coalesce_flush(ws);
+            if (ret == 0) {
+                ret = __ws_input_audio_buffer_append(ws, data_ptr, data_len);
+            }
+        } else if (flush) {
+            ret = __ws_coalesce_flush(ws);
+        }
+    } else {
+        ret = __ws_input_audio_buffer_append(ws, data_ptr, data_len);
     }
-    ret = __ws_input_audio_buffer_append(ws, ws->p_data_buf, len);
     if (ret != 0) {
         LOGE("failed to append audio buffer");
         return -1;
     }
     if (commit) {
-        ret = __ws_input_audio_buffer_commit(ws);
-        if (ret != 0) {
-            LOGE("failed to commit audio buffer");
-            return -1;
-        }
-        ret = __ws_response_create(ws);
+        ret = __ws_commit_audio(ws);
     }
     return ret;
 }
 
+static void __ws_send_queue_drain(ws_impl_t* ws) {
+    ws_send_queue_t* sq = &ws->send_queue;
+    volc_queue_item_t* item = NULL;
+    bool commit = false;
+
+    while (NULL != (item = volc_queue_claim(sq->queue))) {
+        if (__atomic_exchange_n(&sq->commit_pending, false, __ATOMIC_ACQ_REL)) {
+            __ws_commit_audio(ws);
+        }
+        commit = (item->flags & WS_SEND_FLAG_COMMIT) != 0;
+        if (item->deadline_ms > 0 && hal_get_time_ms() > item->deadline_ms) {
+            WS_STAT_ADD(ws, send_queue_dropped_expired, 1);
+            if (commit) {
+                __ws_commit_audio(ws);
+            }
+        } else if (item->len > 0) {
+            __ws_send_audio(ws, item->data, item->len, commit);
+        } else if (commit) {
+            __ws_commit_audio(ws);
+        }
+        volc_queue_release(sq->queue, item);
+    }
+    if (__atomic_exchange_n(&sq->commit_pending, false, __ATOMIC_ACQ_REL)) {
+        __ws_commit_audio(ws);
+    }
+}
+
+#if defined(PLATFORM_MACOS)
+static void* __ws_send_task(void* arg)
+#else
+static void __ws_send_task(void* arg)
+#endif
+{
+    ws_impl_t* ws = (ws_impl_t*)arg;
+    ws_send_queue_t* sq = &ws->send_queue;
+    uint64_t deadline = 0;
+    uint64_t now = 0;
+    int wait_ms = WS_SEND_TASK_IDLE_MS;
+    while (sq->run) {
+        hal_event_wait(sq->event, wait_ms);
+        __ws_send_queue_drain(ws);
+        // no frame came to push the held audio out, send it when its budget is spent
+        wait_ms = WS_SEND_TASK_IDLE_MS;
+        if ((deadline = __ws_coalesce_deadline(&ws->coalescer)) > 0) {
+            now = hal_get_time_ms();
+            if (now >= deadline) {
+                __ws_coalesce_flush(ws);
+            } else if (deadline - now < (uint64_t)wait_ms) {
+                wait_ms = (int)(deadline - now);
+            }
+        }
+    }
+    sq->exit = true;
+    hal_thread_exit(NULL);
+#if defined(PLATFORM_MACOS)
+    return NULL;
+#endif
+}
+
+static int __ws_send_queue_start(ws_impl_t* ws) {
+    ws_send_queue_t* sq = &ws->send_queue;
+    hal_thread_param_t param = { 0 };
+
+    sq->queue = volc_queue_create(sq->depth, 0);
+    sq->event = hal_event_create();
+    if (NULL == sq->queue || NULL == sq->event) {
+        LOGE("failed to create send queue, depth: %d", sq->depth);
+        goto err_out_label;
+    }
+    sq->commit_pending = false;
+    sq->exit = false;
+    sq->run = true;
+    snprintf(param.name, sizeof(param.name), "%s", "ws_send");
+    param.stack_size = WS_SEND_TASK_STACK;
+    param.priority = WS_SEND_TASK_PRIORITY;
+    if (hal_thread_create(&sq->tid, &param, __ws_send_task, (void*)ws) != 0) {
+        LOGE("failed to create send task");
+        sq->run = false;
+        goto err_out_label;
+    }
+    return 0;
+
+err_out_label:
+    volc_queue_destroy(sq->queue);
+    sq->queue = NULL;
+    hal_event_destroy(sq->event);
+    sq->event = NULL;
+    return -1;
+}
+
+static void __ws_send_queue_stop(ws_impl_t* ws) {
+    ws_send_queue_t* sq = &ws->send_queue;
+    if (NULL == sq->queue) {
+        return;
+    }
+    sq->run = false;
+    hal_event_set(sq->event);
+    while (!sq->exit) {
+        hal_thread_sleep(10);
+    }
+    hal_thread_destroy(sq->tid);
+    sq->tid = NULL;
+    volc_queue_destroy(sq->queue);
+    sq->queue = NULL;
+    hal_event_destroy(sq->event);
+    sq->event = NULL;
+}
+
+// never blocks: the oldest frame is dropped when the queue is full
+static int __ws_queue_audio(ws_impl_t* ws, const void* data_ptr, size_t data_len, bool commit) {
+    ws_send_queue_t* sq = &ws->send_queue;
+    volc_queue_item_t* oldest = NULL;
+    uint64_t deadline_ms = sq->deadline_ms > 0 ? hal_get_time_ms() + sq->deadline_ms : 0;
+    uint32_t flags = commit ? WS_SEND_FLAG_COMMIT : 0;
+    int depth = 0;
+    int ret = volc_queue_push(sq->queue, data_ptr, data_len, flags, deadline_ms);
+
+    if (ret == -1 && NULL != (oldest = volc_queue_claim(sq->queue))) {
+        if (oldest->flags & WS_SEND_FLAG_COMMIT) {
+            __atomic_store_n(&sq->commit_pending, true, __ATOMIC_RELEASE);
+        }
+        volc_queue_release(sq->queue, oldest);
+        WS_STAT_ADD(ws, send_queue_dropped_overflow, 1);
+        ret = volc_queue_push(sq->queue, data_ptr, data_len, flags, deadline_ms);
+    }
+    if (ret == -1) {
+        // the sender still holds the only free cell
+        WS_STAT_ADD(ws, send_queue_dropped_overflow, 1);
+        if (commit) {
+            __atomic_store_n(&sq->commit_pending, true, __ATOMIC_RELEASE);
+        }
+    }
+    if (ret == -2) {
+        // only the flags were queued, a commit still goes out
+        WS_STAT_ADD(ws, send_queue_dropped_nomem, 1);
+    }
+    depth = volc_queue_depth(sq->queue);
+    __ws_stat_max(&ws->stats.send_queue_max_depth, (uint32_t)depth);
+    hal_event_set(sq->event);
+    return ret == 0 ? 0 : -1;
+}
+
 static void __ws_parse_params(const char* params, ws_params_t* out_params) {
     cJSON* p_json = NULL;
     if (!params || !out_params) {
@@ -550,6 +1532,8 @@ volc_ws_t volc_ws_create(void* context, cJSON* p_config, volc_msg_cb message_cal
     hal_get_uuid(ws->hardware_id, sizeof(ws->hardware_id));
 
     if (__ws_init(ws, p_config) != 0) {
+        __ws_assembler_free(&ws->assembler);
+        hal_event_destroy(ws->ready_event);
         HAL_SAFE_FREE(ws);
         LOGE("volc_ws_create: ws init failed");
         return NULL;
@@ -567,9 +1551,10 @@ void volc_ws_destroy(volc_ws_t ws) {
     }
 
     __ws_stop(ws_impl);
-    HAL_SAFE_FREE(ws_impl->p_data_buf);
+    HAL_SAFE_FREE(ws_impl->coalescer.buffer);
+    __ws_assembler_free(&ws_impl->assembler);
+    hal_event_destroy(ws_impl->ready_event);
     HAL_SAFE_FREE(ws_impl->p_bot_id);
-    HAL_SAFE_FREE(ws_impl->p_last_response_id);
     HAL_SAFE_FREE(ws_impl);
 }
 
@@ -579,9 +1564,22 @@ int volc_ws_start(volc_ws_t ws, const char* bot_id, volc_iot_info_t* iot_info, c
         LOGE("ws instance is NULL");
         return -1;
     }
+    HAL_SAFE_FREE(ws_impl->p_bot_id);
     ws_impl->p_bot_id = strdup(bot_id);
     __ws_parse_params(params, &ws_impl->params);
-    return __ws_start(ws_impl, iot_info);
+    return __ws_start(ws_impl, iot_info, true);
+}
+
+int volc_ws_start_async(volc_ws_t ws, const char* bot_id, volc_iot_info_t* iot_info, const char* params) {
+    ws_impl_t* ws_impl = (ws_impl_t*) ws;
+    if (!ws_impl) {
+        LOGE("ws instance is NULL");
+        return -1;
+    }
+    HAL_SAFE_FREE(ws_impl->p_bot_id);
+    ws_impl->p_bot_id = strdup(bot_id);
+    __ws_parse_params(params, &ws_impl->params);
+    return __ws_start(ws_impl, iot_info, false);
 }
 
 int volc_ws_send(volc_ws_t ws, const void* data, int size, volc_data_info_t* data_info) {
@@ -591,13 +1589,18 @@ int volc_ws_send(volc_ws_t ws, const void* data, int size, volc_data_info_t* dat
         return -1;
     }
 
-    if (!ws_impl->b_pipeline_started || !ws_impl->b_connected) {
+    // while reconnecting audio is still taken when it can be replayed
+    if (!ws_impl->b_pipeline_started ||
+        (!ws_impl->b_connected && (ws_impl->replay.max_ms <= 0 || data_info->type != VOLC_DATA_TYPE_AUDIO))) {
         LOGD("pipeline started[%d], connected[%d], cannot process data", (int) ws_impl->b_pipeline_started, (int) ws_impl->b_connected);
         return -1;
     }
 
     switch (data_info->type) {
         case VOLC_DATA_TYPE_AUDIO: {
+            if (ws_impl->send_queue.queue) {
+                return __ws_queue_audio(ws_impl, data, size, data_info->info.audio.commit);
+            }
             return __ws_send_audio(ws_impl, data, size, data_info->info.audio.commit);
         }
         case VOLC_DATA_TYPE_VIDEO: {
@@ -649,3 +1652,61 @@ int volc_ws_interrupt(volc_ws_t ws) {
     HAL_SAFE_FREE(msg);
     return ret;
 }
+
+int volc_ws_get_stats(volc_ws_t ws, volc_stats_t* stats) {
+    ws_impl_t* ws_impl = (ws_impl_t*) ws;
+    if (!ws_impl || !stats) {
+        LOGE("ws instance or stats is NULL");
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->audio_frames_coalesced = WS_STAT_LOAD(ws_impl, audio_frames_coalesced);
+    stats->audio_messages_saved = WS_STAT_LOAD(ws_impl, audio_messages_saved);
+    stats->audio_bytes_saved = WS_STAT_LOAD(ws_impl, audio_bytes_saved);
+    stats->send_queue_max_depth = WS_STAT_LOAD(ws_impl, send_queue_max_depth);
+    stats->send_queue_dropped_overflow = WS_STAT_LOAD(ws_impl, send_queue_dropped_overflow);
+    stats->send_queue_dropped_expired = WS_STAT_LOAD(ws_impl, send_queue_dropped_expired);
+    stats->send_queue_dropped_nomem = WS_STAT_LOAD(ws_impl, send_queue_dropped_nomem);
+    stats->interrupted_messages_dropped = WS_STAT_LOAD(ws_impl, interrupted_messages_dropped);
+    stats->interrupted_bytes_dropped = WS_STAT_LOAD(ws_impl, interrupted_bytes_dropped);
+    stats->assembler_high_water = WS_STAT_LOAD(ws_impl, assembler_high_water);
+    stats->assembler_oversize_dropped = WS_STAT_LOAD(ws_impl, assembler_oversize_dropped);
+    stats->audio_replayed_frames = WS_STAT_LOAD(ws_impl, audio_replayed_frames);
+    stats->audio_replayed_bytes = WS_STAT_LOAD(ws_impl, audio_replayed_bytes);
+    stats->assembler_capacity = ws_impl->assembler.capacity;
+    if (ws_impl->send_queue.queue) {
+        stats->send_queue_depth = volc_queue_depth(ws_impl->send_queue.queue);
+    }
+    if (ws_impl->client) {
+        stats->send_lock_count = ws_impl->client->stats.tx_lock_count;
+        stats->send_lock_wait_max_ms = ws_impl->client->stats.tx_wait_max_ms;
+        stats->send_lock_wait_total_ms = ws_impl->client->stats.tx_wait_total_ms;
+        stats->deflate_in_bytes = ws_impl->client->stats.deflate_in_bytes;
+        stats->deflate_out_bytes = ws_impl->client->stats.deflate_out_bytes;
+        stats->deflate_time_us = ws_impl->client->stats.deflate_time_us;
+        stats->inflate_in_bytes = ws_impl->client->stats.inflate_in_bytes;
+        stats->inflate_out_bytes = ws_impl->client->stats.inflate_out_bytes;
+        stats->inflate_time_us = ws_impl->client->stats.inflate_time_us;
+        stats->reconnect_count = ws_impl->client->stats.reconnect_count;
+        stats->reconnect_last_ms = ws_impl->client->stats.reconnect_last_ms;
+        stats->reconnect_max_ms = ws_impl->client->stats.reconnect_max_ms;
+        stats->reconnect_total_ms = ws_impl->client->stats.reconnect_total_ms;
+        stats->ping_sent = ws_impl->client->stats.ping_sent;
+        stats->pong_received = ws_impl->client->stats.pong_received;
+        stats->rtt_last_us = ws_impl->client->stats.rtt_last_us;
+        stats->rtt_srtt_us = ws_impl->client->stats.rtt_srtt_us;
+        stats->rtt_var_us = ws_impl->client->stats.rtt_var_us;
+        stats->dead_peer_count = ws_impl->client->stats.dead_peer_count;
+    }
+#if defined(CONFIG_WEBSOCKET_TLS)
+    mbedtls_client_stats_t tls_stats;
+    mbedtls_client_get_stats(&tls_stats);
+    stats->tls_handshakes = tls_stats.handshakes;
+    stats->tls_resumed = tls_stats.resumed;
+    stats->tls_handshake_failed = tls_stats.failed;
+    stats->tls_handshake_last_ms = tls_stats.last_ms;
+    stats->tls_handshake_max_ms = tls_stats.max_ms;
+    stats->tls_handshake_total_ms = tls_stats.total_ms;
+#endif
+    return 0;
+}
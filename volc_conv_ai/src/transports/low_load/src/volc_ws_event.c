@@ -0,0 +1,303 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "volc_ws_event.h"
+
+#include <string.h>
+
+typedef struct {
+    const char* p;
+    const char* end;
+} ws_scanner_t;
+
+static const struct {
+    const char* name;
+    int len;
+    volc_ws_event_type_e type;
+} s_event_types[] = {
+    { "response.audio.delta", sizeof("response.audio.delta") - 1, VOLC_WS_EV_AUDIO_DELTA },
+    { "response.audio_transcript.delta", sizeof("response.audio_transcript.delta") - 1, VOLC_WS_EV_TRANSCRIPT_DELTA },
+    { "response.audio_transcript.done", sizeof("response.audio_transcript.done") - 1, VOLC_WS_EV_TRANSCRIPT_DONE },
+    { "response.audio.done", sizeof("response.audio.done") - 1, VOLC_WS_EV_AUDIO_DONE },
+    { "response.done", sizeof("response.done") - 1, VOLC_WS_EV_RESPONSE_DONE },
+    { "input_audio_buffer.speech_started", sizeof("input_audio_buffer.speech_started") - 1, VOLC_WS_EV_SPEECH_STARTED },
+    { "input_audio_buffer.speech_stopped", sizeof("input_audio_buffer.speech_stopped") - 1, VOLC_WS_EV_SPEECH_STOPPED },
+    { "session.created", sizeof("session.created") - 1, VOLC_WS_EV_SESSION_CREATED },
+};
+
+static void __skip_whitespace(ws_scanner_t* s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\r' || *s->p == '\n')) {
+        s->p++;
+    }
+}
+
+static int __scan_string(ws_scanner_t* s, volc_ws_span_t* out) {
+    const char* start = NULL;
+    bool escaped = false;
+    if (s->p >= s->end || *s->p != '"') {
+        return -1;
+    }
+    start = ++s->p;
+    while (s->p < s->end) {
+        if (*s->p == '"') {
+            if (out) {
+                out->ptr = start;
+                out->len = (int)(s->p - start);
+                out->escaped = escaped;
+            }
+            s->p++;
+            return 0;
+        }
+        if (*s->p == '\\') {
+            escaped = true;
+            s->p++;
+        }
+        s->p++;
+    }
+    return -1;
+}
+
+static int __skip_value(ws_scanner_t* s) {
+    int depth = 0;
+    if (s->p >= s->end) {
+        return -1;
+    }
+    if (*s->p == '"') {
+        return __scan_string(s, NULL);
+    }
+    if (*s->p != '{' && *s->p != '[') {
+        // number, true, false or null
+        while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' &&
+               *s->p != ' ' && *s->p != '\t' && *s->p != '\r' && *s->p != '\n') {
+            s->p++;
+        }
+        return 0;
+    }
+    while (s->p < s->end) {
+        switch (*s->p) {
+            case '"':
+                if (__scan_string(s, NULL) != 0) {
+                    return -1;
+                }
+                continue;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) {
+                    s->p++;
+                    return 0;
+                }
+                break;
+            default:
+                break;
+        }
+        s->p++;
+    }
+    return -1;
+}
+
+static bool __key_equals(const volc_ws_span_t* key, const char* name, int name_len) {
+    return !key->escaped && key->len == name_len && memcmp(key->ptr, name, name_len) == 0;
+}
+
+static int __parse_object(ws_scanner_t* s, volc_ws_event_t* ev, int level) {
+    volc_ws_span_t key = { 0 };
+    volc_ws_span_t* capture = NULL;
+    __skip_whitespace(s);
+    if (s->p >= s->end || *s->p != '{') {
+        return -1;
+    }
+    s->p++;
+    __skip_whitespace(s);
+    if (s->p < s->end && *s->p == '}') {
+        s->p++;
+        return 0;
+    }
+    while (s->p < s->end) {
+        __skip_whitespace(s);
+        if (__scan_string(s, &key) != 0) {
+            return -1;
+        }
+        __skip_whitespace(s);
+        if (s->p >= s->end || *s->p != ':') {
+            return -1;
+        }
+        s->p++;
+        __skip_whitespace(s);
+        if (s->p >= s->end) {
+            return -1;
+        }
+
+        capture = NULL;
+        if (level == 0) {
+            if (__key_equals(&key, "type", 4)) {
+                capture = &ev->type_str;
+            } else if (__key_equals(&key, "delta", 5)) {
+                capture = &ev->delta;
+            } else if (__key_equals(&key, "response_id", 11)) {
+                capture = &ev->response_id;
+            } else if (__key_equals(&key, "response", 8) && *s->p == '{') {
+                if (__parse_object(s, ev, 1) != 0) {
+                    return -1;
+                }
+                goto next_member;
+            }
+        } else if (__key_equals(&key, "status", 6)) {
+            capture = &ev->status;
+        }
+
+        if (capture && *s->p == '"') {
+            if (__scan_string(s, capture) != 0) {
+                return -1;
+            }
+        } else if (__skip_value(s) != 0) {
+            return -1;
+        }
+
+next_member:
+        __skip_whitespace(s);
+        if (s->p >= s->end) {
+            return -1;
+        }
+        if (*s->p == '}') {
+            s->p++;
+            return 0;
+        }
+        if (*s->p != ',') {
+            return -1;
+        }
+        s->p++;
+    }
+    return -1;
+}
+
+static void __resolve_type(volc_ws_event_t* ev) {
+    int i = 0;
+    for (i = 0; i < (int)(sizeof(s_event_types) / sizeof(s_event_types[0])); i++) {
+        if (__key_equals(&ev->type_str, s_event_types[i].name, s_event_types[i].len)) {
+            ev->type = s_event_types[i].type;
+            break;
+        }
+    }
+}
+
+int volc_ws_event_parse(const char* data, int len, volc_ws_event_t* ev) {
+    ws_scanner_t s;
+    if (NULL == data || len <= 0 || NULL == ev) {
+        return -1;
+    }
+    memset(ev, 0, sizeof(*ev));
+    s.p = data;
+    s.end = data + len;
+    if (__parse_object(&s, ev, 0) != 0 || NULL == ev->type_str.ptr) {
+        return -1;
+    }
+    __resolve_type(ev);
+    return 0;
+}
+
+/*
+ * Walks the top level members of a possibly incomplete event. With a
+ * delta_offset it stops at the "delta" value, without one as soon as "type"
+ * and "response_id" are both known.
+ */
+static int __scan_head(const char* data, int len, volc_ws_event_t* ev, int* delta_offset) {
+    ws_scanner_t s;
+    volc_ws_span_t key = { 0 };
+    volc_ws_span_t* capture = NULL;
+    if (NULL == data || len <= 0 || NULL == ev) {
+        return -1;
+    }
+    memset(ev, 0, sizeof(*ev));
+    s.p = data;
+    s.end = data + len;
+    __skip_whitespace(&s);
+    if (s.p >= s.end) {
+        return 0;
+    }
+    if (*s.p != '{') {
+        return -1;
+    }
+    s.p++;
+    while (s.p < s.end) {
+        __skip_whitespace(&s);
+        if (__scan_string(&s, &key) != 0) {
+            break;
+        }
+        __skip_whitespace(&s);
+        if (s.p >= s.end || *s.p != ':') {
+            break;
+        }
+        s.p++;
+        __skip_whitespace(&s);
+        if (s.p >= s.end) {
+            break;
+        }
+
+        if (__key_equals(&key, "delta", 5)) {
+            if (NULL == delta_offset) {
+                // the rest is payload, nothing more to learn from the head
+                break;
+            }
+            if (*s.p != '"' || NULL == ev->type_str.ptr) {
+                return -1;
+            }
+            *delta_offset = (int)(s.p + 1 - data);
+            __resolve_type(ev);
+            return 1;
+        }
+        capture = NULL;
+        if (__key_equals(&key, "type", 4)) {
+            capture = &ev->type_str;
+        } else if (__key_equals(&key, "response_id", 11)) {
+            capture = &ev->response_id;
+        }
+        if (capture && *s.p == '"') {
+            if (__scan_string(&s, capture) != 0) {
+                break;
+            }
+            if (NULL == delta_offset && ev->type_str.ptr && ev->response_id.ptr) {
+                __resolve_type(ev);
+                return 1;
+            }
+        } else if (__skip_value(&s) != 0) {
+            break;
+        }
+
+        __skip_whitespace(&s);
+        if (s.p >= s.end) {
+            break;
+        }
+        if (*s.p != ',') {
+            // end of object without a delta, or malformed
+            return NULL == delta_offset ? 0 : -1;
+        }
+        s.p++;
+    }
+    if (NULL == delta_offset) {
+        return 0;
+    }
+    // ran out of data, anything else is malformed
+    return s.p >= s.end ? 0 : -1;
+}
+
+int volc_ws_event_scan_delta(const char* data, int len, volc_ws_event_t* ev, int* delta_offset) {
+    if (NULL == delta_offset) {
+        return -1;
+    }
+    return __scan_head(data, len, ev, delta_offset);
+}
+
+int volc_ws_event_scan_head(const char* data, int len, volc_ws_event_t* ev) {
+    return __scan_head(data, len, ev, NULL);
+}
+
+bool volc_ws_span_equals(const volc_ws_span_t* span, const char* str) {
+    if (NULL == span || NULL == span->ptr || NULL == str) {
+        return false;
+    }
+    return __key_equals(span, str, (int)strlen(str));
+}
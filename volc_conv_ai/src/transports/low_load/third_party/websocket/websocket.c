@@ -26,18 +26,33 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <sys/select.h>
+#include <sys/poll.h>
+// epoll wherever the kernel has it, whatever the PLATFORM_ hal, poll() elsewhere
+#if defined(CONFIG_WEBSOCKET_REACTOR) && defined(__linux__)
+#define WEBSOCKET_REACTOR_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include "volc_platform.h"
 #include "util/volc_list.h"
 #include "util/volc_log.h"
 #include "util/volc_base64.h"
+#include "util/volc_net.h"
+#include "ws_mask.h"
 #include "mbedtls/sha1.h"
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+#include "zlib.h"
+#endif
 
 #define WEBSOCKET_SSL_DEFAULT_PORT 443
 #define WEBSOCKET_TCP_DEFAULT_PORT 80
 #define WEBSOCKET_BUFFER_SIZE_BYTE (4 * 1024)
 #define WS_BUFFER_SIZE             (1 * 1600)
 #define MAX_WEBSOCKET_HEADER_SIZE  16
+#define WS_CONTROL_PAYLOAD_MAX     125
+#define WS_CTRL_PONG               0x1
+#define WS_CTRL_PING               0x2
+#define WS_CTRL_CLOSE              0x4
 
 #define WS_SIZE64 127
 #define WS_MASK   0x80
@@ -46,10 +61,15 @@
 #define WEBSOCKET_TASK_PRIORITY        (4)
 #define WEBSOCKET_TASK_STACK           (4 * 1024)
 #define WEBSOCKET_NETWORK_TIMEOUT_MS   (10 * 1000)
-#define WEBSOCKET_PINGPONG_TIMEOUT_SEC (540)
-#define WEBSOCKET_PING_INTERVAL_SEC    (10)
+#define WEBSOCKET_PING_IDLE_MS         (10 * 1000)  // silence before the first ping
+#define WEBSOCKET_PING_PROBE_MS        (2 * 1000)   // between pings while waiting for a pong
+#define WEBSOCKET_PING_RTT_MS          (15 * 1000)  // between RTT pings while traffic flows
+#define WEBSOCKET_DEAD_PEER_PROBES     (3)
 #define WEBSOCKET_RECONNECT_TIMEOUT_MS (5 * 1000)
+#define WEBSOCKET_RECONNECT_BASE_MS    (250)
+#define WEBSOCKET_RECONNECT_STABLE_MS  (30 * 1000)  // a connection up this long resets the backoff
 #define WEBSOCKET_RX_RETRY_COUNT       (10)
+#define WEBSOCKET_RX_BUDGET_BYTES      (64 * 1024)  // read per wakeup before the next client's turn
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -64,7 +84,7 @@ static void volc_ws_client_dispatch_event(volc_ws_client_t* client, int32_t even
     event_data.op_code = opcode;
     event_data.payload_len = client->payload_len;
     event_data.payload_offset = client->payload_offset;
-    LOGD("volc_ws_client_dispatch_event, fin: %d, opcode: %d, payload_len: %d, payload_offset: %d, data_len: %d", event_data.fin, event_data.op_code,
+    LOGD("volc_ws_client_dispatch_event, fin: %d, opcode: %d, payload_len: %" PRId64 ", payload_offset: %" PRId64 ", data_len: %d", event_data.fin, event_data.op_code,
          event_data.payload_len, event_data.payload_offset, event_data.data_len);
 
     if (client->ws_event_handler)
@@ -73,12 +93,6 @@ static void volc_ws_client_dispatch_event(volc_ws_client_t* client, int32_t even
 
 struct timeval* utils_ms_to_timeval(int timeout_ms, struct timeval* tv);
 
-#define CO_BIT(pos) (1U << (pos))
-const static int PING_SENT_BIT = CO_BIT(1);
-// const static int TEXT_SENT_BIT = CO_BIT(2);
-const static int CLOSE_SENT_BIT = CO_BIT(3);
-int status_bits = PING_SENT_BIT;
-
 static char* trimwhitespace(const char* str);
 static char* get_http_header(const char* buffer, const char* key);
 static int ws_tcp_close(volc_ws_client_t* client);
@@ -86,19 +100,21 @@ static int ws_tcp_poll_read(volc_ws_client_t* client, int timeout_ms);
 static int ws_tcp_poll_write(volc_ws_client_t* client, int timeout_ms);
 static int ws_tcp_read(volc_ws_client_t* client, char* buffer, int len, int timeout_ms);
 static int ws_tcp_write(volc_ws_client_t* client, const char* buffer, int len, int timeout_ms);
-static int ws_read_payload(volc_ws_client_t* client, char* buffer, int len, int timeout_ms);
-static int ws_read_header(volc_ws_client_t* client, char* buffer, int len, int timeout_ms);
-static int ws_write(volc_ws_client_t* client, int opcode, int mask_flag, const char* b, int len, int timeout_ms);
-static int ws_read(volc_ws_client_t* client, char* buffer, int len, int timeout_ms);
+static int ws_tcp_write_nowait(volc_ws_client_t* client, const char* buffer, int len);
+static int ws_read_payload(volc_ws_client_t* client, char* buffer, int len);
+static int ws_read_header(volc_ws_client_t* client);
 static int ws_poll_connection_closed(int* sockfd, int timeout_ms);
 static int ws_client_recv(volc_ws_client_t* client);
 static int set_socket_non_blocking(int fd, bool non_blocking);
-static int hostname_to_fd(const char* host, size_t hostlen, int port, struct sockaddr_storage* address, int* fd);
-static int _tcp_connect(int* sockfd, const char* host, int hostlen, int port, int timeout_ms);
+static int _tcp_connect(int* sockfd, const char* host, int port, const volc_sock_opt_t* opt, int timeout_ms);
 static int ws_tcp_connect(volc_ws_client_t* client, const char* host, int port, int timeout_ms);
 static int ws_disconnect(volc_ws_client_t* client);
 static int ws_connect(volc_ws_client_t* client, const char* host, int port, int timeout_ms);
 static int volc_ws_client_destory_config(volc_ws_client_t* client);
+static void ws_tx_lock(volc_ws_client_t* client);
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+static void ws_reactor_wake(struct volc_ws_reactor_loop* loop);
+#endif
 
 static char* trimwhitespace(const char* str)
 {
@@ -149,23 +165,24 @@ static int _tcp_close(volc_ws_client_t* client)
     return ret;
 }
 
+/*
+ * Socket waits use poll(): a reactor serves hundreds of sockets and FD_SET()
+ * on a descriptor past FD_SETSIZE writes beyond the fd_set.
+ */
 static int _tcp_poll_read(int* sockfd, int timeout_ms)
 {
     int ret = -1;
-    struct timeval timeout;
-    fd_set readset;
-    fd_set errset;
-    FD_ZERO(&readset);
-    FD_ZERO(&errset);
-    FD_SET(*sockfd, &readset);
-    FD_SET(*sockfd, &errset);
-
-    ret = select((*sockfd) + 1, &readset, NULL, &errset, utils_ms_to_timeval(timeout_ms, &timeout));
-    if (ret > 0 && FD_ISSET(*sockfd, &errset)) {
+    struct pollfd pfd = {0};
+    pfd.fd = *sockfd;
+    pfd.events = POLLIN;
+
+    ret = poll(&pfd, 1, timeout_ms);
+    // a hang-up still reads, recv() returns 0 for it
+    if (ret > 0 && (pfd.revents & (POLLERR | POLLNVAL))) {
         int sock_errno = 0;
         uint32_t optlen = sizeof(sock_errno);
         getsockopt(*sockfd, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen);
-        LOGE("poll_read select error %d, errno = %s, fd = %d", sock_errno, strerror(sock_errno), *sockfd);
+        LOGE("poll_read error %d, errno = %s, fd = %d", sock_errno, strerror(sock_errno), *sockfd);
         ret = -1;
     }
     return ret;
@@ -174,42 +191,33 @@ static int _tcp_poll_read(int* sockfd, int timeout_ms)
 static int _tcp_poll_write(int* sockfd, int timeout_ms)
 {
     int ret = -1;
-    struct timeval timeout;
-    fd_set writeset;
-    fd_set errset;
-    FD_ZERO(&writeset);
-    FD_ZERO(&errset);
-    FD_SET(*sockfd, &writeset);
-    FD_SET(*sockfd, &errset);
-
-    ret = select((*sockfd) + 1, NULL, &writeset, &errset, utils_ms_to_timeval(timeout_ms, &timeout));
-    if (ret > 0 && FD_ISSET(*sockfd, &errset)) {
+    struct pollfd pfd = {0};
+    pfd.fd = *sockfd;
+    pfd.events = POLLOUT;
+
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
         int sock_errno = 0;
         uint32_t optlen = sizeof(sock_errno);
         getsockopt(*sockfd, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen);
-        LOGE("poll_write select error %d, errno = %s, fd = %d\r\n", sock_errno, strerror(sock_errno), *sockfd);
+        LOGE("poll_write error %d, errno = %s, fd = %d\r\n", sock_errno, strerror(sock_errno), *sockfd);
         ret = -1;
     }
     return ret;
 }
 
-static int _tcp_read(int* sockfd, char* buffer, int len, int timeout_ms)
+// never waits, 0 when nothing has arrived
+static int _tcp_read(int* sockfd, char* buffer, int len)
 {
-    int poll;
-
-    if ((poll = _tcp_poll_read(sockfd, timeout_ms)) <= 0) {
-        return poll;
-    }
-
-    int ret = recv(*sockfd, (unsigned char*) buffer, len, 0);
+    int ret = recv(*sockfd, (unsigned char*) buffer, len, MSG_DONTWAIT);
     if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
         LOGE("tcp_read error, errno=%s", strerror(errno));
     }
     if (ret == 0) {
-        if (poll > 0) {
-            // no error
-            LOGE("%s select > 0, ret = 0 \r\n", __func__);
-        }
+        LOGE("%s, connection closed by peer\r\n", __func__);
         ret = -1;
     }
     return ret;
@@ -230,128 +238,149 @@ static int _tcp_write(int* sockfd, const char* buffer, int len, int timeout_ms)
     return ret;
 }
 
-static int ws_read_payload(volc_ws_client_t* client, char* buffer, int len, int timeout_ms)
+// never waits, 0 when the send buffer is full
+static int _tcp_write_nowait(int* sockfd, const char* buffer, int len)
+{
+    int ret = send(*sockfd, (const unsigned char*) buffer, len, MSG_DONTWAIT);
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        LOGE("tcp_write error, errno=%s", strerror(errno));
+    }
+    return ret;
+}
+
+/*
+ * Read the next part of the current frame, at most len bytes and only what
+ * has arrived. Payloads longer than the buffer are streamed over several calls.
+ *
+ * @return bytes read, 0: nothing yet, < 0: error.
+ */
+static int ws_read_payload(volc_ws_client_t* client, char* buffer, int len)
 {
     int bytes_to_read;
     int rlen = 0;
     transport_ws_t* ws = client->ws_transport;
-    if (ws->frame_state.bytes_remaining > len) {
-        LOGE("Actual data to receive (%d) are longer than ws buffer (%d)\r\n", ws->frame_state.bytes_remaining, len);
-        bytes_to_read = len;
-
-    } else {
-        bytes_to_read = ws->frame_state.bytes_remaining;
-    }
+    bytes_to_read = (int) MIN(ws->frame_state.bytes_remaining, (uint64_t) len);
 
-    if (bytes_to_read != 0 && (rlen = ws_tcp_read(client, buffer, bytes_to_read, timeout_ms)) <= 0) {
-        LOGE("Error read payload data\r\n");
+    if (bytes_to_read != 0 && (rlen = ws_tcp_read(client, buffer, bytes_to_read, 0)) <= 0) {
+        if (rlen < 0) {
+            LOGE("Error read payload data\r\n");
+        }
         return rlen;
     }
+    if (ws->frame_state.masked) {
+        // the key continues from where the previous read of this frame stopped
+        ws_mask_copy(buffer, buffer, rlen, ws->frame_state.mask_key,
+                     ws->frame_state.payload_len - ws->frame_state.bytes_remaining);
+    }
     ws->frame_state.bytes_remaining -= rlen;
-
-    // if (ws->frame_state.mask_key) {
-        for (int i = 0; i < bytes_to_read; i++) {
-            buffer[i] = (buffer[i] ^ ws->frame_state.mask_key[i % 4]);
-        }
-    // }
     return rlen;
 }
 
-static int _tcp_read_completely(volc_ws_client_t* client, char* buffer, int len, int timeout_ms) {
-    int rlen = 0;
-    while (rlen < len) {
-        int ret = ws_tcp_read(client, buffer + rlen, len - rlen, timeout_ms);
-        if (ret < 0) {
-            return ret;
-        }
-        rlen += ret;
+// frame header length, known piece by piece as its first bytes come in
+static int ws_header_need(const volc_ws_frame_state_t* fs)
+{
+    int need = 2;
+    int len7 = 0;
+    if (fs->header_len < need) {
+        return need;
     }
-    return rlen;
+    len7 = fs->header[1] & 0x7F;
+    if (len7 == WS_SIZE16) {
+        need += 2;
+    } else if (len7 == WS_SIZE64) {
+        need += 8;
+    }
+    if (fs->header[1] & WS_MASK) {
+        need += 4;
+    }
+    return need;
 }
 
-/* Read and parse the WS header, determine length of payload */
-static int ws_read_header(volc_ws_client_t* client, char* buffer, int len, int timeout_ms)
+/*
+ * Read and parse the WS header, determine length of payload. Reads only what
+ * has arrived, a header split across reads is continued by the next call.
+ *
+ * @return 1: header complete, 0: more bytes needed, < 0: error.
+ */
+static int ws_read_header(volc_ws_client_t* client)
 {
-    int payload_len;
-    transport_ws_t* ws = client->ws_transport;
-    char ws_header[MAX_WEBSOCKET_HEADER_SIZE];
-    char *data_ptr = ws_header, mask;
+    uint64_t payload_len;
+    volc_ws_frame_state_t* fs = &client->ws_transport->frame_state;
+    char *data_ptr = fs->header, mask;
+    int need = 0;
     int rlen;
-    int poll_read;
-    ws->frame_state.header_received = false;
-    if ((poll_read = ws_tcp_poll_read(client, timeout_ms)) <= 0) {
-        LOGE("error poll read data\r\n");
-        return poll_read;
+
+    while (fs->header_len < (need = ws_header_need(fs))) {
+        if ((rlen = ws_tcp_read(client, fs->header + fs->header_len, need - fs->header_len, 0)) <= 0) {
+            if (rlen < 0) {
+                LOGE("header, Error read data\r\n");
+            }
+            return rlen;
+        }
+        fs->header_len += rlen;
     }
+    // the next frame starts over
+    fs->header_len = 0;
 
-    int header = 2;
-    int mask_len = 4;
-    if ((rlen = _tcp_read_completely(client, data_ptr, header, timeout_ms)) <= 0) {
-        LOGE("first header, Error read data\r\n");
-        return rlen;
+    fs->fin = (*data_ptr & 0x80) != 0;
+    fs->opcode = (*data_ptr & 0x0F);
+    if (fs->opcode == VOLC_WS_OPCODES_TEXT || fs->opcode == VOLC_WS_OPCODES_BINARY) {
+        fs->compressed = (*data_ptr & 0x40) != 0;
     }
-    ws->frame_state.header_received = true;
-    ws->frame_state.fin = (*data_ptr & 0x80) != 0;
-    ws->frame_state.opcode = (*data_ptr & 0x0F);
     data_ptr++;
     mask = ((*data_ptr >> 7) & 0x01);
     payload_len = (*data_ptr & 0x7F);
     data_ptr++;
-    LOGD("%s, Opcode: %d, mask: %d, fin: %d, payload len: %d", __func__, ws->frame_state.opcode, mask, (int) ws->frame_state.fin, payload_len);
+    LOGD("%s, Opcode: %d, mask: %d, fin: %d, payload len: %d", __func__, fs->opcode, mask, (int) fs->fin, (int) payload_len);
     if (payload_len == WS_SIZE16) {
-        if ((rlen = _tcp_read_completely(client, data_ptr, header, timeout_ms)) <= 0) {
-            LOGE("126 read: Error read data\r\n");
-            return rlen;
-        }
         payload_len = (uint8_t) data_ptr[0] << 8 | (uint8_t) data_ptr[1];
+        data_ptr += 2;
     } else if (payload_len == WS_SIZE64) {
-        header = 8;
-        if ((rlen = _tcp_read_completely(client, data_ptr, header, timeout_ms)) <= 0) {
-            LOGE("127 read: Error read data\r\n");
-            return rlen;
+        payload_len = 0;
+        for (int i = 0; i < 8; i++) {
+            payload_len = (payload_len << 8) | (uint8_t) data_ptr[i];
         }
-
-        if (data_ptr[0] != 0 || data_ptr[1] != 0 || data_ptr[2] != 0 || data_ptr[3] != 0) {
-            // really too big!
-            payload_len = 0xFFFFFFFF;
-            LOGW("127, payload_len:%d", payload_len);
-        } else {
-            payload_len = (uint8_t) data_ptr[4] << 24 | (uint8_t) data_ptr[5] << 16 | (uint8_t) data_ptr[6] << 8 | (uint8_t) data_ptr[7];
-            LOGW("127, payload_len:%d, data_ptr[4]:%d, data_ptr[5]:%d, data_ptr[6]:%d, data_ptr[7]:%d", payload_len, data_ptr[4], data_ptr[5],
-                 data_ptr[6], data_ptr[7]);
+        data_ptr += 8;
+        // RFC 6455 5.2: the most significant bit must be 0
+        if (payload_len >> 63) {
+            LOGE("127, invalid payload_len: 0x%" PRIx64, payload_len);
+            return -1;
         }
     }
-    LOGD("ws_read_header, payload_len:%d", payload_len);
+    LOGD("ws_read_header, payload_len:%" PRIu64, payload_len);
+    // control frames are never fragmented and fit in 125 bytes, the pong echoes them from rx_buffer
+    if ((fs->opcode & 0x08) && (payload_len > WS_CONTROL_PAYLOAD_MAX || !fs->fin)) {
+        LOGE("invalid control frame, opcode: %d, payload_len: %" PRIu64, fs->opcode, payload_len);
+        return -1;
+    }
     if (mask) {
-        LOGD("mask: %d, payload_len: %d", mask, payload_len);
-        // Read and store mask
-        if (payload_len != 0 && (rlen = _tcp_read_completely(client, buffer, mask_len, timeout_ms)) <= 0) {
-            LOGE("mask error read data\r\n");
-            return rlen;
-        }
-        memcpy(ws->frame_state.mask_key, buffer, mask_len);
+        LOGD("mask: %d, payload_len: %" PRIu64, mask, payload_len);
+        // the mask key is present even when the payload is empty
+        memcpy(fs->mask_key, data_ptr, sizeof(fs->mask_key));
     } else {
-        memset(ws->frame_state.mask_key, 0, mask_len);
+        memset(fs->mask_key, 0, sizeof(fs->mask_key));
     }
+    fs->masked = mask && payload_len != 0;
 
-    ws->frame_state.payload_len = payload_len;
-    ws->frame_state.bytes_remaining = payload_len;
+    fs->payload_len = payload_len;
+    fs->bytes_remaining = payload_len;
+    fs->header_received = true;
 
-    return payload_len;
+    return 1;
 }
 
-static int ws_write(volc_ws_client_t* client, int opcode, int mask_flag, const char* b, int len, int timeout_ms)
+/*
+ * Build the frame header for a payload of len bytes into ws_header, a random
+ * mask key included when mask_flag is set.
+ *
+ * @return the header length, at most MAX_WEBSOCKET_HEADER_SIZE.
+ */
+static int ws_build_header(char* ws_header, int opcode, int mask_flag, int len)
 {
-    char* buffer = (char*) b;
-    char ws_header[MAX_WEBSOCKET_HEADER_SIZE];
-    char* mask;
-    int header_len = 0, i;
-    int poll_write;
-
-    if ((poll_write = ws_tcp_poll_write(client, timeout_ms)) <= 0) {
-        LOGE("Error ws_tcp_poll_write\r\n");
-        return poll_write;
-    }
+    int header_len = 0;
 
     ws_header[header_len++] = opcode;
     if (len <= 125) {
@@ -374,66 +403,472 @@ static int ws_write(volc_ws_client_t* client, int opcode, int mask_flag, const c
     }
 
     if (mask_flag) {
-        mask = &ws_header[header_len];
         hal_fill_random((uint8_t *)ws_header + header_len, 4);
         header_len += 4;
+    }
+    return header_len;
+}
 
-        for (i = 0; i < len; ++i) {
-            buffer[i] = (buffer[i] ^ mask[i % 4]);
-        }
+/*
+ * payload must be preceded by MAX_WEBSOCKET_HEADER_SIZE bytes of headroom, the
+ * header is built right in front of it so the frame goes out in one write.
+ * src is copied into payload while being masked, NULL when payload already
+ * holds the data, it is then masked in place and not restored.
+ */
+static int ws_write_with_headroom(volc_ws_client_t* client, int opcode, int mask_flag, char* payload, const char* src, int len, int timeout_ms)
+{
+    char ws_header[MAX_WEBSOCKET_HEADER_SIZE];
+    char* frame = NULL;
+    int header_len = 0;
+    int poll_write;
+    int ret = 0;
+
+    if ((poll_write = ws_tcp_poll_write(client, timeout_ms)) <= 0) {
+        LOGE("Error ws_tcp_poll_write\r\n");
+        return poll_write;
+    }
+
+    header_len = ws_build_header(ws_header, opcode, mask_flag, len);
+    if (NULL == src) {
+        src = payload;
+    }
+    if (mask_flag) {
+        ws_mask_copy(payload, src, len, &ws_header[header_len - 4], 0);
+    } else if (src != payload) {
+        memcpy(payload, src, len);
     }
-    LOGD("%s, ws header len:%d\r\n", __func__, header_len);
-    int err = ws_tcp_write(client, ws_header, header_len, timeout_ms);
-    if (err != header_len) {
-        LOGE("Error write header :%d err:%d errno:%d\r\n", header_len, err, errno);
+
+    frame = payload - header_len;
+    memcpy(frame, ws_header, header_len);
+    LOGD("%s, frame len:%d\r\n", __func__, header_len + len);
+    ret = ws_tcp_write(client, frame, header_len + len, timeout_ms);
+    if (ret != header_len + len) {
+        LOGE("Error write frame :%d err:%d errno:%d\r\n", header_len + len, ret, errno);
         return -1;
     }
+    return len;
+}
 
-    if (len == 0) {
-        return 0;
+/*
+ * Control frames (ping, pong, close) are only marked due by the reader, a
+ * pong carries the payload of the newest ping. ws_control_flush() sends them.
+ */
+static void ws_control_due(volc_ws_client_t* client, int ctrl, const char* data, int len)
+{
+    if (WS_CTRL_PONG == ctrl) {
+        if (len < 0 || len > WS_CONTROL_PAYLOAD_MAX) {
+            LOGE("Control frame payload too long: %d\r\n", len);
+            return;
+        }
+        if (len > 0) {
+            memcpy(client->pong_payload, data, len);
+        }
+        client->pong_len = len;
     }
+    __atomic_store_n(&client->ctrl_due, client->ctrl_due | ctrl, __ATOMIC_RELEASE);
+}
+
+// the next due frame into ctrl_frame, pongs first, the close frame last. Reader only, mutex held.
+static bool ws_control_next(volc_ws_client_t* client)
+{
+    int due = client->ctrl_due;
+    int ctrl = 0;
+    int opcode = 0;
+    const char* data = NULL;
+    int len = 0;
+    int header_len = 0;
 
-    LOGD("%s, payload buffer len:%d\r\n", __func__, len);
-    int ret = ws_tcp_write(client, buffer, len, timeout_ms);
+    if (due & WS_CTRL_PONG) {
+        ctrl = WS_CTRL_PONG;
+        opcode = VOLC_WS_OPCODES_PONG;
+        data = client->pong_payload;
+        len = client->pong_len;
+    } else if (due & WS_CTRL_PING) {
+        ctrl = WS_CTRL_PING;
+        opcode = VOLC_WS_OPCODES_PING;
+        data = (const char*) &client->ping_seq;
+        len = sizeof(client->ping_seq);
+        client->ping_sent_us = hal_get_time_us();
+    } else if (due & WS_CTRL_CLOSE) {
+        ctrl = WS_CTRL_CLOSE;
+        opcode = VOLC_WS_OPCODES_CLOSE;
+    } else {
+        return false;
+    }
+    __atomic_store_n(&client->ctrl_due, due & ~ctrl, __ATOMIC_RELEASE);
+    header_len = ws_build_header(client->ctrl_frame, opcode | VOLC_WS_OPCODES_FIN, WS_MASK, len);
+    ws_mask_copy(client->ctrl_frame + header_len, data, len, &client->ctrl_frame[header_len - 4], 0);
+    client->ctrl_len = header_len + len;
+    client->ctrl_off = 0;
+    LOGD("%s, frame len:%d\r\n", __func__, client->ctrl_len);
+    return true;
+}
 
-    if (mask_flag) {
-        mask = &ws_header[header_len - 4];
-        for (i = 0; i < len; ++i) {
-            buffer[i] = (buffer[i] ^ mask[i % 4]);
+/*
+ * Write what is left of ctrl_frame, any writer does it first under mutex so
+ * frames never interleave. wait: up to the network timeout, else only what
+ * the socket takes now. A TLS retry passes the same bytes, ctrl_off only
+ * moves once they are written.
+ *
+ * @return 0, < 0 on error, the rest of the frame is dropped then.
+ */
+static int ws_control_finish(volc_ws_client_t* client, bool wait)
+{
+    const char* frame = NULL;
+    int left = 0;
+    int ret = 0;
+
+    while (client->ctrl_off < client->ctrl_len) {
+        frame = client->ctrl_frame + client->ctrl_off;
+        left = client->ctrl_len - client->ctrl_off;
+        ret = wait ? ws_tcp_write(client, frame, left, WEBSOCKET_NETWORK_TIMEOUT_MS) : ws_tcp_write_nowait(client, frame, left);
+        if (ret < 0 || (0 == ret && wait)) {
+            LOGE("Error write control frame, left:%d err:%d errno:%d\r\n", left, ret, errno);
+            client->ctrl_off = 0;
+            client->ctrl_len = 0;
+            return -1;
         }
+        if (0 == ret) {
+            break;
+        }
+        client->ctrl_off += ret;
+    }
+    return 0;
+}
+
+/*
+ * Send the due control frames from the reader. On a reactor loop this never
+ * waits: a sender holding the socket wakes the loop when done, a full send
+ * buffer has the loop watch for POLLOUT. The own task of a client waits like
+ * any writer.
+ */
+static int ws_control_flush(volc_ws_client_t* client)
+{
+    bool wait = true;
+    int ret = 0;
+
+    if (0 == client->ctrl_due && !client->ctrl_stalled) {
+        return 0;
+    }
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+    wait = NULL == client->loop;
+#endif
+    if (wait) {
+        ws_tx_lock(client);
+    } else if (hal_mutex_trylock(client->mutex) != 0) {
+        return 0;
     }
+    ret = ws_control_finish(client, wait);
+    while (0 == ret && client->ctrl_off >= client->ctrl_len && ws_control_next(client)) {
+        ret = ws_control_finish(client, wait);
+    }
+    __atomic_store_n(&client->ctrl_stalled, client->ctrl_off < client->ctrl_len, __ATOMIC_RELEASE);
+    hal_mutex_unlock(client->mutex);
     return ret;
-    ;
 }
 
-static int ws_read(volc_ws_client_t* client, char* buffer, int len, int timeout_ms)
+// a sender leaving the socket: the loop may have given up on the lock meanwhile
+static void ws_control_kick(volc_ws_client_t* client)
 {
-    int rlen = 0;
-    transport_ws_t* ws = client->ws_transport;
-    if (ws->frame_state.bytes_remaining <= 0) {
-        if ((rlen = ws_read_header(client, buffer, len, timeout_ms)) < 0) {
-            LOGE("Error reading header %d, %s\r\n", rlen, buffer);
-            ws->frame_state.bytes_remaining = 0;
-            return rlen;
-        }
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+    struct volc_ws_reactor_loop* loop = client->loop;
+    if (loop && (__atomic_load_n(&client->ctrl_due, __ATOMIC_ACQUIRE) || __atomic_load_n(&client->ctrl_stalled, __ATOMIC_ACQUIRE))) {
+        ws_reactor_wake(loop);
+    }
+#endif
+}
 
-        if (rlen == 0) {
-            ws->frame_state.bytes_remaining = 0;
-            return 0;
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+#define WS_OPCODES_RSV1         0x40
+
+struct ws_deflate {
+    z_stream tx;                // guarded by the tx lock
+    z_stream rx;                // only used by the client task
+    bool tx_ready;
+    bool rx_ready;
+    bool tx_reset;              // client_no_context_takeover
+    int min_size;
+    char* tx_buffer;            // MAX_WEBSOCKET_HEADER_SIZE bytes of header headroom + tx_capacity
+    int tx_capacity;
+    char* rx_buffer;            // inflated output, buffer_size bytes
+    int64_t rx_offset;          // inflated bytes of the current frame handed out so far
+};
+
+static voidpf ws_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    (void) opaque;
+    return hal_calloc(items, size);
+}
+
+static void ws_zfree(voidpf opaque, voidpf address)
+{
+    (void) opaque;
+    hal_free(address);
+}
+
+// copy a header value out without touching buffer, get_http_header() cuts it at the line end
+static char* ws_copy_http_header(const char* buffer, const char* key, char* out, int size)
+{
+    const char* found = strcasestr(buffer, key);
+    const char* found_end = NULL;
+    int len = 0;
+    if (NULL == found || NULL == (found_end = strstr(found, "\r\n"))) {
+        return NULL;
+    }
+    found += strlen(key);
+    len = MIN((int) (found_end - found), size - 1);
+    memcpy(out, found, len);
+    out[len] = '\0';
+    return trimwhitespace(out);
+}
+
+static int ws_clamp_bits(int bits, int min, int max)
+{
+    if (bits <= 0 || bits > max) {
+        return max;
+    }
+    return bits < min ? min : bits;
+}
+
+// the Sec-WebSocket-Extensions line of the upgrade request
+static int ws_deflate_offer(volc_ws_client_t* client, char* buf, int size)
+{
+    const volc_ws_deflate_config_t* cfg = &client->deflate_config;
+    int client_bits = ws_clamp_bits(cfg->client_window_bits, 9, 15);
+    int server_bits = ws_clamp_bits(cfg->server_window_bits, 8, 15);
+    char client_param[32] = "; client_max_window_bits";
+    char server_param[32] = "";
+
+    if (client_bits < 15) {
+        snprintf(client_param, sizeof(client_param), "; client_max_window_bits=%d", client_bits);
+    }
+    if (server_bits < 15) {
+        snprintf(server_param, sizeof(server_param), "; server_max_window_bits=%d", server_bits);
+    }
+    return snprintf(buf, size, "Sec-WebSocket-Extensions: permessage-deflate%s%s%s\r\n", client_param, server_param,
+                    cfg->no_context_takeover ? "; client_no_context_takeover; server_no_context_takeover" : "");
+}
+
+static void ws_deflate_free(volc_ws_client_t* client)
+{
+    struct ws_deflate* d = client->deflate;
+    if (NULL == d) {
+        return;
+    }
+    if (d->tx_ready) {
+        deflateEnd(&d->tx);
+    }
+    if (d->rx_ready) {
+        inflateEnd(&d->rx);
+    }
+    HAL_SAFE_FREE(d->tx_buffer);
+    HAL_SAFE_FREE(d->rx_buffer);
+    HAL_SAFE_FREE(client->deflate);
+}
+
+/*
+ * Set up the streams from the server's answer, extensions is the value of its
+ * Sec-WebSocket-Extensions header, NULL or another extension when declined.
+ */
+static int ws_deflate_accept(volc_ws_client_t* client, char* extensions)
+{
+    const volc_ws_deflate_config_t* cfg = &client->deflate_config;
+    struct ws_deflate* d = NULL;
+    int client_bits = ws_clamp_bits(cfg->client_window_bits, 9, 15);
+    int server_bits = 15;
+    int mem_level = (cfg->mem_level >= 1 && cfg->mem_level <= 9) ? cfg->mem_level : 8;
+    bool tx_reset = cfg->no_context_takeover;
+    char* save = NULL;
+    char* param = NULL;
+
+    ws_deflate_free(client);
+    if (NULL == extensions) {
+        return 0;
+    }
+    // only one extension was offered, anything after a ',' is not ours
+    extensions[strcspn(extensions, ",")] = '\0';
+    param = strtok_r(extensions, ";", &save);
+    if (NULL == param || strcmp(trimwhitespace(param), "permessage-deflate") != 0) {
+        return 0;
+    }
+    while (NULL != (param = strtok_r(NULL, ";", &save))) {
+        param = trimwhitespace(param);
+        if (strncmp(param, "server_max_window_bits=", 23) == 0) {
+            server_bits = atoi(param + 23);
+        } else if (strncmp(param, "client_max_window_bits=", 23) == 0) {
+            client_bits = MIN(client_bits, atoi(param + 23));
+        } else if (strcmp(param, "client_no_context_takeover") == 0) {
+            tx_reset = true;
+        } else if (strcmp(param, "server_no_context_takeover") != 0) {
+            LOGE("unknown permessage-deflate parameter: %s", param);
+            return -1;
         }
     }
+    if (server_bits < 8 || server_bits > 15 || client_bits < 8) {
+        LOGE("invalid permessage-deflate window bits: server %d client %d", server_bits, client_bits);
+        return -1;
+    }
+    // zlib has no raw deflate with a 256 byte window, 9 still fits a peer limit of 8
+    client_bits = client_bits < 9 ? 9 : client_bits;
 
-    if (ws->frame_state.payload_len) {
-        if ((rlen = ws_read_payload(client, buffer, len, timeout_ms)) <= 0) {
-            LOGE("Error reading payload data\r\n");
-            ws->frame_state.bytes_remaining = 0;
-            return rlen;
+    if (NULL == (d = (struct ws_deflate*) hal_calloc(1, sizeof(struct ws_deflate)))) {
+        return -1;
+    }
+    client->deflate = d;
+    d->tx_reset = tx_reset;
+    d->min_size = cfg->min_size;
+    d->tx_capacity = client->buffer_size;
+    d->tx_buffer = (char*) hal_malloc(MAX_WEBSOCKET_HEADER_SIZE + d->tx_capacity);
+    d->rx_buffer = (char*) hal_malloc(client->buffer_size);
+    if (NULL == d->tx_buffer || NULL == d->rx_buffer) {
+        goto _deflate_accept_fail;
+    }
+    d->tx.zalloc = ws_zalloc;
+    d->tx.zfree = ws_zfree;
+    if (deflateInit2(&d->tx, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -client_bits, mem_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        goto _deflate_accept_fail;
+    }
+    d->tx_ready = true;
+    d->rx.zalloc = ws_zalloc;
+    d->rx.zfree = ws_zfree;
+    if (inflateInit2(&d->rx, -server_bits) != Z_OK) {
+        goto _deflate_accept_fail;
+    }
+    d->rx_ready = true;
+    LOGI("permessage-deflate on, client window %d, server window %d, context takeover %d", client_bits, server_bits, !tx_reset);
+    return 0;
+
+_deflate_accept_fail:
+    LOGE("permessage-deflate init fail");
+    ws_deflate_free(client);
+    return -1;
+}
+
+static bool ws_deflate_wanted(volc_ws_client_t* client, int opcode, int len)
+{
+    opcode &= 0x0F;
+    return client->deflate && (opcode == VOLC_WS_OPCODES_TEXT || opcode == VOLC_WS_OPCODES_BINARY) &&
+           len > 0 && len >= client->deflate->min_size;
+}
+
+/*
+ * Compress a whole message into one frame (RFC 7692 7.2.1: sync flush, the
+ * trailing 00 00 ff ff removed). Called with the tx lock held.
+ *
+ * @return len on success.
+ */
+static int ws_deflate_send(volc_ws_client_t* client, int opcode, const char* data, int len, int timeout_ms)
+{
+    struct ws_deflate* d = client->deflate;
+    uint64_t start = hal_get_time_us();
+    char* new_buffer = NULL;
+    int out = 0;
+    int ret = 0;
+
+    d->tx.next_in = (Bytef*) data;
+    d->tx.avail_in = len;
+    for (;;) {
+        if (d->tx_capacity - out < 64) {
+            new_buffer = (char*) hal_realloc(d->tx_buffer, MAX_WEBSOCKET_HEADER_SIZE + d->tx_capacity * 2);
+            if (NULL == new_buffer) {
+                LOGE("realloc deflate buffer to %d fail\r\n", d->tx_capacity * 2);
+                deflateReset(&d->tx);
+                return -1;
+            }
+            d->tx_buffer = new_buffer;
+            d->tx_capacity *= 2;
+        }
+        d->tx.next_out = (Bytef*) (d->tx_buffer + MAX_WEBSOCKET_HEADER_SIZE + out);
+        d->tx.avail_out = d->tx_capacity - out;
+        ret = deflate(&d->tx, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            LOGE("deflate error %d\r\n", ret);
+            return -1;
+        }
+        out = d->tx_capacity - d->tx.avail_out;
+        // the flush is complete once deflate leaves output space unused
+        if (d->tx.avail_in == 0 && d->tx.avail_out > 0) {
+            break;
         }
-        LOGD("%s, payload len:%d\r\n", __func__, rlen);
     }
+    if (d->tx_reset) {
+        deflateReset(&d->tx);
+    }
+    out -= 4;
+    client->stats.deflate_in_bytes += len;
+    client->stats.deflate_out_bytes += out;
+    client->stats.deflate_time_us += hal_get_time_us() - start;
 
-    return rlen;
+    ret = ws_write_with_headroom(client, opcode | VOLC_WS_OPCODES_FIN | WS_OPCODES_RSV1, WS_MASK,
+                                 d->tx_buffer + MAX_WEBSOCKET_HEADER_SIZE, NULL, out, timeout_ms);
+    return ret < 0 ? ret : len;
+}
+
+static void ws_dispatch_inflated(volc_ws_client_t* client, int len, bool last)
+{
+    struct ws_deflate* d = client->deflate;
+    volc_ws_event_data_t event_data;
+    event_data.data_ptr = d->rx_buffer;
+    event_data.data_len = len;
+    event_data.fin = client->last_fin;
+    event_data.op_code = client->last_opcode;
+    event_data.payload_len = last ? d->rx_offset + len : -1;
+    event_data.payload_offset = d->rx_offset;
+    d->rx_offset += len;
+
+    if (client->ws_event_handler)
+        (client->ws_event_handler)(client->user_context, VOLC_WS_EVENT_DATA, (void*) &event_data);
+}
+
+static int ws_inflate_run(volc_ws_client_t* client, const char* data, int len, bool last)
+{
+    struct ws_deflate* d = client->deflate;
+    int produced = 0;
+    int ret = 0;
+
+    d->rx.next_in = (Bytef*) data;
+    d->rx.avail_in = len;
+    do {
+        d->rx.next_out = (Bytef*) d->rx_buffer;
+        d->rx.avail_out = client->buffer_size;
+        ret = inflate(&d->rx, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+            LOGE("inflate error %d %s\r\n", ret, d->rx.msg ? d->rx.msg : "");
+            return -1;
+        }
+        produced = client->buffer_size - d->rx.avail_out;
+        client->stats.inflate_out_bytes += produced;
+        if (produced > 0 || (last && d->rx.avail_out > 0)) {
+            ws_dispatch_inflated(client, produced, last && d->rx.avail_out > 0);
+        }
+    } while (d->rx.avail_out == 0);
+    return 0;
+}
+
+/*
+ * Inflate a received chunk of a compressed message and hand the output out in
+ * buffer_size pieces. The message end comes with an extra, possibly empty,
+ * piece whose payload_len is final.
+ */
+static int ws_inflate_dispatch(volc_ws_client_t* client, const char* data, int len, bool frame_end)
+{
+    static const char tail[4] = {0x00, 0x00, (char) 0xff, (char) 0xff};
+    uint64_t start = hal_get_time_us();
+    int ret = 0;
+
+    if (NULL == client->deflate) {
+        LOGE("compressed frame without permessage-deflate\r\n");
+        return -1;
+    }
+    client->stats.inflate_in_bytes += len;
+    ret = ws_inflate_run(client, data, len, false);
+    if (ret == 0 && frame_end && client->last_fin) {
+        ret = ws_inflate_run(client, tail, sizeof(tail), true);
+    }
+    client->stats.inflate_time_us += hal_get_time_us() - start;
+    return ret;
 }
+#endif
 
 struct timeval* utils_ms_to_timeval(int timeout_ms, struct timeval* tv)
 {
@@ -473,140 +908,34 @@ static int set_socket_non_blocking(int fd, bool non_blocking)
     return 0;
 }
 
-static int hostname_to_fd(const char* host, size_t hostlen, int port, struct sockaddr_storage* address, int* fd)
+/*
+ * Resolution goes through the shared dns cache and the addresses are raced
+ * (volc_net_connect), a reconnect to the same host skips the lookup.
+ */
+static int _tcp_connect(int* sockfd, const char* host, int port, const volc_sock_opt_t* opt, int timeout_ms)
 {
-    struct addrinfo* address_info;
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    LOGD("host:%s: strlen %lu\r\n", host, (unsigned long) hostlen);
-    int res = getaddrinfo(host, NULL, &hints, &address_info);
-    if (res != 0 || address_info == NULL) {
-        LOGE("couldn't get hostname for :%s: "
-             "getaddrinfo() returns %d, addrinfo=%p",
-             host, res, address_info);
-        return -1;
-    }
-    *fd = socket(address_info->ai_family, address_info->ai_socktype, address_info->ai_protocol);
-    if (*fd < 0) {
-        LOGE("Failed to create socket (family %d socktype %d protocol %d)", address_info->ai_family, address_info->ai_socktype,
-             address_info->ai_protocol);
-        freeaddrinfo(address_info);
-        return -1;
-    }
-
-    if (address_info->ai_family == AF_INET) {
-        struct sockaddr_in* p = (struct sockaddr_in*) address_info->ai_addr;
-        p->sin_port = htons(port);
-        // LOGE("[sock=%d] Resolved IPv4 address: %s\r\n", *fd, ipaddr_ntoa((const ip_addr_t*)&p->sin_addr.s_addr));
-        memcpy(address, p, sizeof(struct sockaddr));
-    }
-#if LWIP_IPV6
-    else if (address_info->ai_family == AF_INET6) {
-        struct sockaddr_in6* p = (struct sockaddr_in6*) address_info->ai_addr;
-        p->sin6_port = htons(port);
-        p->sin6_family = AF_INET6;
-        LOGE("[sock=%d] Resolved IPv6 address: %s", *fd, ip6addr_ntoa((const ip6_addr_t*) &p->sin6_addr));
-        memcpy(address, p, sizeof(struct sockaddr_in6));
-    }
-#endif
-    else {
-        LOGE("Unsupported protocol family %d", address_info->ai_family);
-        close(*fd);
-        freeaddrinfo(address_info);
+    int fd = volc_net_connect(host, port, opt, timeout_ms);
+    if (fd < 0) {
+        LOGE("%s to %s:%d failed", __func__, host, port);
         return -1;
     }
 
-    freeaddrinfo(address_info);
-    return 0;
-}
-
-static int _tcp_connect(int* sockfd, const char* host, int hostlen, int port, int timeout_ms)
-{
-    struct sockaddr_storage address;
-    int fd;
-    int ret = hostname_to_fd(host, hostlen, port, &address, &fd);
-    if (ret != 0) {
-        LOGE("%s error fd\r\n", __func__);
-        return ret;
-    }
-
     if (timeout_ms) {
         struct timeval tv;
         ms_to_timeval(timeout_ms, &tv);
         if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
             LOGE("Fail to setsockopt SO_RCVTIMEO");
+            close(fd);
             return -1;
         }
         if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0) {
             LOGE("Fail to setsockopt SO_SNDTIMEO");
+            close(fd);
             return -1;
         }
     }
-
-    // Set to non block before connecting to better control connection timeout
-    ret = set_socket_non_blocking(fd, true);
-    if (ret != 0) {
-        LOGE("%s error nb", __func__);
-        goto err;
-    }
-
-    if (connect(fd, (struct sockaddr*) &address, sizeof(struct sockaddr)) < 0) {
-        if (errno == EINPROGRESS) {
-            fd_set fdset;
-            struct timeval tv = {.tv_usec = 0, .tv_sec = 10}; // Default connection timeout is 10 s
-
-            if (timeout_ms > 0) {
-                ms_to_timeval(timeout_ms, &tv);
-            }
-            FD_ZERO(&fdset);
-            FD_SET(fd, &fdset);
-
-            int res = select(fd + 1, NULL, &fdset, NULL, &tv);
-            if (res < 0) {
-                LOGE("[sock=%d] select() error: %s\r\n", fd, strerror(errno));
-                ret = -1;
-                goto err;
-            } else if (res == 0) {
-                LOGE("[sock=%d] select() timeout\r\n", fd);
-                ret = -1;
-                goto err;
-            } else {
-                int sockerr;
-                socklen_t len = (socklen_t) sizeof(int);
-                LOGD("[sock=%d] select() occur", fd);
-                if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (void*) (&sockerr), &len) < 0) {
-                    LOGE("[sock=%d] getsockopt() error: %s\r\n", fd, strerror(errno));
-                    ret = -1;
-                    goto err;
-                } else if (sockerr) {
-                    LOGE("[sock=%d] delayed connect error: %s\r\n", fd, strerror(sockerr));
-                    ret = -1;
-                    goto err;
-                } else if (!sockerr) {
-                    LOGD("[sock=%d] no blocking connected", fd);
-                }
-            }
-        } else {
-            LOGE("[sock=%d] connect() error: %s\r\n", fd, strerror(errno));
-            ret = -1;
-            goto err;
-        }
-    }
-    // reset back to blocking mode (unless non_block configured)
-    ret = set_socket_non_blocking(fd, false);
-    if (ret != 0) {
-        LOGE("%s error nb\r\n", __func__);
-        goto err;
-    }
     *sockfd = fd;
     return 0;
-
-err:
-    close(fd);
-    return ret;
 }
 
 static int _ssl_init(volc_ws_client_t* client) {
@@ -621,12 +950,6 @@ static int _ssl_init(volc_ws_client_t* client) {
         LOGE("malloc ssl failed");
         goto _websocket_init_fail;
     }
-    client->ssl->buffer_len = WEBSOCKET_BUFFER_SIZE_BYTE;
-    client->ssl->buffer = hal_malloc(client->ssl->buffer_len);
-    if (NULL == client->ssl->buffer) {
-        LOGE("malloc ssl buffer fail");
-        goto _websocket_init_fail;
-    }
     if ((tls_ret = mbedtls_client_init(client->ssl, (void*) pers, strlen(pers))) < 0) {
         LOGE("initialize https client failed return: -0x%x.", -tls_ret);
         goto _websocket_init_fail;
@@ -660,14 +983,19 @@ static int ws_tcp_connect(volc_ws_client_t* client, const char* host, int port,
             LOGE("mbedtls_client_connect failed return: -0x%x.\r\n", -tls_ret);
             return -1;
         }
-        if ((tls_ret = mbedtls_client_connect(client->ssl)) < 0) {
-            LOGE("mbedtls_client_connect failed return: -0x%x.\r\n", -tls_ret);
+        if (_tcp_connect(&client->ssl->server_fd.fd, host, port, &client->sock_opt, timeout_ms) != 0) {
+            LOGE("tcp connect failed\r\n");
+            return -1;
+        }
+        if ((tls_ret = mbedtls_client_handshake(client->ssl)) < 0) {
+            LOGE("mbedtls_client_handshake failed return: -0x%x.\r\n", -tls_ret);
             return -1;
         }
+        mbedtls_client_set_read_nonblock(client->ssl, true);
         client->sockfd = client->ssl->server_fd.fd;
     } else
 #endif
-        err = _tcp_connect(&client->sockfd, host, strlen(host), port, timeout_ms);
+        err = _tcp_connect(&client->sockfd, host, port, &client->sock_opt, timeout_ms);
     if (err != 0) {
         LOGE("%s failed\r\n", __func__);
         return -1;
@@ -676,28 +1004,41 @@ static int ws_tcp_connect(volc_ws_client_t* client, const char* host, int port,
     return 0;
 }
 
-static int _ssl_write(volc_ws_client_t* client, const char* buffer, int len) {
-    size_t written = 0;
-	size_t write_len = len;
-	while (written < len) {
-		if (write_len > MBEDTLS_SSL_OUT_CONTENT_LEN) {
-			write_len = MBEDTLS_SSL_OUT_CONTENT_LEN;
-		}
-		if (len > MBEDTLS_SSL_OUT_CONTENT_LEN) {
-			LOGE("Fragmenting data of excessive size :%d, offset: %d, size %d\r\n", len, written, write_len);
-		}
-		ssize_t ret = mbedtls_ssl_write(&client->ssl->ssl, (unsigned char*) buffer + written, write_len);
-		if (ret < 0) {
-			if (ret != MBEDTLS_ERR_SSL_WANT_READ  && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != 0) {
-				LOGE("write error :-0x%04X:\r\n", -ret);
-				return ret;
-			}
-		}
-		else
-			LOGD("mbedtls_ssl_write, ret:%d\r\n", ret);
-		written += ret;
-		write_len = len - written;
-	}
+/*
+ * mbedtls never waits for the socket under ssl_mutex, the reader would wait
+ * with it: on WANT_WRITE the lock is dropped and the socket polled. The retry
+ * passes the same bytes, mbedtls already holds their record.
+ *
+ * @return bytes written, fewer than len once timeout_ms is over, < 0: error.
+ */
+static int _ssl_write(volc_ws_client_t* client, const char* buffer, int len, int timeout_ms)
+{
+    uint64_t deadline = hal_get_time_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+    uint64_t now = 0;
+    int written = 0;
+    int write_len = 0;
+    int ret = 0;
+
+    while (written < len) {
+        write_len = MIN(len - written, MBEDTLS_SSL_OUT_CONTENT_LEN);
+        hal_mutex_lock(client->ssl_mutex);
+        ret = mbedtls_client_write_nonblock(client->ssl, (const unsigned char*) buffer + written, write_len);
+        hal_mutex_unlock(client->ssl_mutex);
+        if (ret > 0) {
+            LOGD("mbedtls_ssl_write, ret:%d\r\n", ret);
+            written += ret;
+            continue;
+        }
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            LOGE("write error :-0x%04X:\r\n", -ret);
+            return ret;
+        }
+        now = hal_get_time_ms();
+        if (now >= deadline || _tcp_poll_write(&client->sockfd, (int) (deadline - now)) <= 0) {
+            LOGE("ssl write timeout, %d of %d bytes written\r\n", written, len);
+            break;
+        }
+    }
     return written;
 }
 
@@ -706,29 +1047,92 @@ static int ws_tcp_write(volc_ws_client_t* client, const char* buffer, int len, i
     int err = 0;
 #if defined(CONFIG_WEBSOCKET_TLS)
     if (client->is_tls == 1)
-        // err = mbedtls_client_write(client->ssl, (const unsigned char*)buffer, len);
-        err = _ssl_write(client, buffer, len);
+        err = _ssl_write(client, buffer, len, timeout_ms);
     else
 #endif
         err = _tcp_write(&client->sockfd, buffer, len, timeout_ms);
     return err;
 }
 
-static int ws_tcp_read(volc_ws_client_t* client, char* buffer, int len, int timeout_ms)
+// one try, 0 when the socket takes nothing now
+static int ws_tcp_write_nowait(volc_ws_client_t* client, const char* buffer, int len)
 {
     int err = 0;
 #if defined(CONFIG_WEBSOCKET_TLS)
-    if (client->is_tls == 1)
-        err = mbedtls_client_read(client->ssl, (unsigned char*)buffer, len);
-    else
+    if (client->is_tls == 1) {
+        hal_mutex_lock(client->ssl_mutex);
+        err = mbedtls_client_write_nonblock(client->ssl, (const unsigned char*) buffer, len);
+        hal_mutex_unlock(client->ssl_mutex);
+        if (err == MBEDTLS_ERR_SSL_WANT_READ || err == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return 0;
+        }
+        return err;
+    }
 #endif
-        err = _tcp_read(&client->sockfd, buffer, len, timeout_ms);
-    return err;
+    return _tcp_write_nowait(&client->sockfd, buffer, len);
+}
+
+// one read of what has arrived, 0 when that is nothing or only part of a TLS record
+static int ws_tcp_read_once(volc_ws_client_t* client, char* buffer, int len)
+{
+    int err = 0;
+#if defined(CONFIG_WEBSOCKET_TLS)
+    if (client->is_tls == 1) {
+        // the read never waits for the socket, so ssl_mutex only covers decrypting what is there
+        hal_mutex_lock(client->ssl_mutex);
+        err = mbedtls_client_read(client->ssl, (unsigned char*)buffer, len);
+        client->tls_pending = mbedtls_ssl_get_bytes_avail(&client->ssl->ssl) > 0;
+        hal_mutex_unlock(client->ssl_mutex);
+        if (err == MBEDTLS_ERR_SSL_WANT_READ || err == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return 0;
+        }
+        // 0 is the transport closing without close_notify
+        return err == 0 ? -1 : err;
+    }
+#endif
+    return _tcp_read(&client->sockfd, buffer, len);
+}
+
+/*
+ * Wait outside every lock for the socket, up to timeout_ms in total.
+ *
+ * @return bytes read, 0: nothing before timeout_ms, < 0: error or closed.
+ */
+static int ws_tcp_read(volc_ws_client_t* client, char* buffer, int len, int timeout_ms)
+{
+    uint64_t deadline = hal_get_time_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+    uint64_t now = 0;
+    int err = 0;
+
+    for (;;) {
+        if ((err = ws_tcp_read_once(client, buffer, len)) != 0) {
+            return err;
+        }
+        now = hal_get_time_ms();
+        if (now >= deadline) {
+            return 0;
+        }
+        if ((err = _tcp_poll_read(&client->sockfd, (int) (deadline - now))) <= 0) {
+            return err;
+        }
+    }
+}
+
+/*
+ * Plaintext mbedtls has decrypted but not handed out yet, the socket shows
+ * none of it. Recorded by the last read, only the reader asks.
+ */
+static bool ws_tcp_pending(volc_ws_client_t* client)
+{
+    return client->tls_pending;
 }
 
 static int ws_tcp_poll_read(volc_ws_client_t* client, int timeout_ms)
 {
     int err = 0;
+    if (ws_tcp_pending(client)) {
+        return 1;
+    }
     err = _tcp_poll_read(&client->sockfd, timeout_ms);
     return err;
 }
@@ -743,10 +1147,15 @@ static int ws_tcp_poll_write(volc_ws_client_t* client, int timeout_ms)
 static int ws_tcp_close(volc_ws_client_t* client)
 {
     int err = 0;
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    ws_deflate_free(client);
+#endif
 #if defined(CONFIG_WEBSOCKET_TLS)
     if (client->is_tls == 1) {
         err = mbedtls_client_close(client->ssl);
         client->ssl = NULL;
+        client->sockfd = -1;
+        client->tls_pending = false;
     } else
 #endif
         err = _tcp_close(client);
@@ -758,17 +1167,52 @@ static int ws_tcp_close(volc_ws_client_t* client)
     return 0;
 }
 
+/*
+ * Delay before the next connect: none for the first retry, then base_ms
+ * doubling up to max_ms, with "equal jitter" so clients that dropped together
+ * do not come back in lockstep.
+ */
+static int ws_reconnect_delay(volc_ws_client_t* client)
+{
+    int base_ms = client->reconnect.base_ms > 0 ? client->reconnect.base_ms : WEBSOCKET_RECONNECT_BASE_MS;
+    int max_ms = client->reconnect.max_ms > 0 ? client->reconnect.max_ms : WEBSOCKET_RECONNECT_TIMEOUT_MS;
+    int delay_ms = base_ms;
+    uint32_t jitter = 0;
+
+    if (client->reconnect_attempts == 0) {
+        return 0;
+    }
+    for (int i = 1; i < client->reconnect_attempts && delay_ms < max_ms; i++) {
+        delay_ms *= 2;
+    }
+    delay_ms = MIN(delay_ms, max_ms);
+    hal_fill_random((uint8_t*) &jitter, sizeof(jitter));
+    return delay_ms / 2 + (int) (jitter % (uint32_t) (delay_ms / 2 + 1));
+}
+
 static int ws_disconnect(volc_ws_client_t* client)
 {
+    uint64_t now = hal_get_time_ms();
     if (client == NULL) {
         LOGE("client aleady null\r\n");
         return -1;
     }
+    hal_mutex_lock(client->mutex);
     ws_tcp_close(client);
+    if (client->state == VOLC_WS_STATE_CONNECTED) {
+        client->lost_ms = now;
+        if (now - client->connected_ms >= WEBSOCKET_RECONNECT_STABLE_MS) {
+            client->reconnect_attempts = 0;
+        }
+    }
     if (client->auto_reconnect) {
-        client->reconnect_tick_ms = hal_get_time_ms();
+        client->reconnect_tick_ms = now;
+        client->reconnect_delay_ms = ws_reconnect_delay(client);
+        client->reconnect_attempts++;
+        LOGI("reconnect in %d ms, attempt %d", client->reconnect_delay_ms, client->reconnect_attempts);
     }
     client->state = VOLC_WS_STATE_WAIT_TIMEOUT;
+    hal_mutex_unlock(client->mutex);
     volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_DISCONNECTED, NULL, 0, -1);
     return 0;
 }
@@ -821,6 +1265,18 @@ static int ws_connect(volc_ws_client_t* client, const char* host, int port, int
             return -1;
         }
     }
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    if (client->deflate_config.enable) {
+        int r = ws_deflate_offer(client, ws->buffer + len, WS_BUFFER_SIZE - len);
+        len += r;
+        if (r <= 0 || len >= WS_BUFFER_SIZE) {
+            LOGE("Error in request generation"
+                 "(snprintf of extensions returned %d, desired request len: %d, buffer size: %d\r\n",
+                 r, len, WS_BUFFER_SIZE);
+            return -1;
+        }
+    }
+#endif
     if (ws->headers) {
         int r = snprintf(ws->buffer + len, WS_BUFFER_SIZE - len, "%s", ws->headers);
         len += r;
@@ -855,6 +1311,10 @@ static int ws_connect(volc_ws_client_t* client, const char* host, int port, int
         LOGD("Read header chunk %d, current header size: %d, header: %s\r\n", len, header_len, ws->buffer);
     } while (NULL == strstr(ws->buffer, "\r\n\r\n") && header_len < WS_BUFFER_SIZE);
 
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    char extensions_buf[128];
+    char* extensions = ws_copy_http_header(ws->buffer, "Sec-WebSocket-Extensions:", extensions_buf, sizeof(extensions_buf));
+#endif
     char* server_key = get_http_header(ws->buffer, "Sec-WebSocket-Accept:");
     if (server_key == NULL) {
         LOGE("Sec-WebSocket-Accept not found\r\n");
@@ -888,33 +1348,34 @@ static int ws_connect(volc_ws_client_t* client, const char* host, int port, int
         LOGE("Invalid websocket key\r\n");
         return -1;
     }
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    if (client->deflate_config.enable && ws_deflate_accept(client, extensions) != 0) {
+        return -1;
+    }
+#endif
     return 0;
 }
 
 int ws_poll_connection_closed(int* sockfd, int timeout_ms)
 {
-    struct timeval timeout;
-    fd_set readset;
-    fd_set errset;
-    FD_ZERO(&readset);
-    FD_ZERO(&errset);
-    FD_SET(*sockfd, &readset);
-    FD_SET(*sockfd, &errset);
+    struct pollfd pfd = {0};
+    pfd.fd = *sockfd;
+    pfd.events = POLLIN;
 
-    int ret = select(*sockfd + 1, &readset, NULL, &errset, utils_ms_to_timeval(timeout_ms, &timeout));
+    int ret = poll(&pfd, 1, timeout_ms);
     if (ret > 0) {
-        if (FD_ISSET(*sockfd, &readset)) {
+        if (pfd.revents & (POLLIN | POLLHUP)) {
             uint8_t buffer;
             if (recv(*sockfd, &buffer, 1, MSG_PEEK) <= 0) {
                 // socket is readable, but reads zero bytes -- connection cleanly closed by FIN flag
                 return 0;
             }
             LOGW("ws_poll_connection_closed: unexpected data readable on socket=%d", *sockfd);
-        } else if (FD_ISSET(*sockfd, &errset)) {
+        } else if (pfd.revents & POLLERR) {
             int sock_errno = 0;
             uint32_t optlen = sizeof(sock_errno);
             getsockopt(*sockfd, SOL_SOCKET, SO_ERROR, &sock_errno, &optlen);
-            LOGD("ws_poll_connection_closed select error %d, errno = %s, fd = %d", sock_errno, strerror(sock_errno), *sockfd);
+            LOGD("ws_poll_connection_closed poll error %d, errno = %s, fd = %d", sock_errno, strerror(sock_errno), *sockfd);
             if (sock_errno == ENOTCONN || sock_errno == ECONNRESET || sock_errno == ECONNABORTED) {
                 return 0;
             }
@@ -925,46 +1386,203 @@ int ws_poll_connection_closed(int* sockfd, int timeout_ms)
     return ret;
 }
 
-static int ws_client_recv(volc_ws_client_t* client)
+/*
+ * RTT from our own ping to its pong, smoothed like the TCP retransmit timer
+ * (RFC 6298): srtt += (r - srtt) / 8, rttvar += (|srtt - r| - rttvar) / 4.
+ */
+static void ws_keepalive_pong(volc_ws_client_t* client, const char* data, int len)
 {
-    int rlen;
-    client->payload_offset = 0;
-    transport_ws_t* ws = client->ws_transport;
-    do {
-        LOGD("----------begin receive--------------\r\n");
-        memset(client->rx_buffer, 0, client->buffer_size);
-        rlen = ws_read(client, client->rx_buffer, client->buffer_size, WEBSOCKET_NETWORK_TIMEOUT_MS);
-        if (rlen < 0) {
-            LOGE("Error read data\r\n");
-            return -1;
-        }
+    uint32_t seq = 0;
+    uint32_t rtt = 0;
+    uint32_t delta = 0;
+
+    if (!client->ping_outstanding || len != (int) sizeof(seq)) {
+        // unsolicited, or already answered
+        return;
+    }
+    memcpy(&seq, data, sizeof(seq));
+    if (seq != client->ping_seq) {
+        // the answer to a ping a newer one has replaced
+        return;
+    }
+    client->ping_outstanding = false;
+    client->wait_for_pong_resp = false;
+    rtt = (uint32_t) (hal_get_time_us() - client->ping_sent_us);
+    client->stats.pong_received++;
+    client->stats.rtt_last_us = rtt;
+    if (client->stats.rtt_srtt_us == 0) {
+        client->stats.rtt_srtt_us = rtt;
+        client->stats.rtt_var_us = rtt / 2;
+    } else {
+        delta = rtt > client->stats.rtt_srtt_us ? rtt - client->stats.rtt_srtt_us : client->stats.rtt_srtt_us - rtt;
+        client->stats.rtt_var_us = client->stats.rtt_var_us - client->stats.rtt_var_us / 4 + delta / 4;
+        client->stats.rtt_srtt_us = client->stats.rtt_srtt_us - client->stats.rtt_srtt_us / 8 + rtt / 8;
+    }
+    LOGD("pong, rtt %u us, srtt %u us, rttvar %u us", rtt, client->stats.rtt_srtt_us, client->stats.rtt_var_us);
+}
+
+// when ws_keepalive() has something to do next
+static uint64_t ws_keepalive_deadline(volc_ws_client_t* client)
+{
+    uint64_t dead = client->last_rx_ms + client->keepalive.dead_ms;
+    uint64_t ping = client->wait_for_pong_resp ? client->ping_tick_ms + client->keepalive.probe_ms
+                                               : client->last_rx_ms + client->keepalive.idle_ms;
+    if (!client->wait_for_pong_resp && client->keepalive.rtt_ms > 0) {
+        ping = MIN(ping, client->ping_tick_ms + client->keepalive.rtt_ms);
+    }
+    return MIN(ping, dead);
+}
 
-        client->payload_len = ws->frame_state.payload_len;
-        client->last_fin = ws->frame_state.fin;
-        client->last_opcode = (volc_ws_opcode_e) ws->frame_state.opcode;
+/*
+ * Only silence counts: any received frame proves the peer alive, so probes
+ * go out on an idle link only. While traffic flows, a ping every rtt_ms
+ * keeps the RTT estimate current. Each ping carries a sequence number, the
+ * pong echoing it gives an RTT sample whatever arrived in between.
+ *
+ * @return -1 when the peer stayed silent for dead_ms.
+ */
+static int ws_keepalive(volc_ws_client_t* client)
+{
+    uint64_t now = hal_get_time_ms();
 
-        if (rlen == 0 && client->last_opcode == VOLC_WS_OPCODES_NONE) {
-            LOGE("ws read timeouts\r\n");
+    if (now - client->last_rx_ms >= (uint64_t) client->keepalive.dead_ms) {
+        LOGW("nothing received for %" PRIu64 " ms, peer is gone", now - client->last_rx_ms);
+        client->stats.dead_peer_count++;
+        return -1;
+    }
+    if (now - client->last_rx_ms < (uint64_t) client->keepalive.idle_ms) {
+        // alive, the RTT sample of an outstanding ping is still wanted
+        client->wait_for_pong_resp = false;
+        if (client->keepalive.rtt_ms <= 0 || now - client->ping_tick_ms < (uint64_t) client->keepalive.rtt_ms) {
             return 0;
         }
-        volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_DATA, client->rx_buffer, rlen, client->last_opcode);
-        client->payload_offset += rlen;
-    } while (client->payload_offset < client->payload_len);
+    } else if (client->wait_for_pong_resp && now - client->ping_tick_ms < (uint64_t) client->keepalive.probe_ms) {
+        return 0;
+    } else {
+        client->wait_for_pong_resp = true;
+    }
+    if (!client->close_sent) {
+        client->ping_seq++;
+        client->ping_tick_ms = now;
+        client->ping_outstanding = true;
+        client->stats.ping_sent++;
+        // ping_sent_us is taken when the frame is built
+        ws_control_due(client, WS_CTRL_PING, NULL, 0);
+    }
+    return 0;
+}
 
+// a frame has been read to its end
+static void ws_client_frame_done(volc_ws_client_t* client)
+{
     if (client->last_opcode == VOLC_WS_OPCODES_PING) {
-        const char* data = (client->payload_len == 0) ? NULL : client->rx_buffer;
-        LOGD("Received ping, Sending PONG with payload len=%d\r\n", client->payload_len);
-        ws_write(client, VOLC_WS_OPCODES_PONG | VOLC_WS_OPCODES_FIN, WS_MASK, data, client->payload_len, WEBSOCKET_NETWORK_TIMEOUT_MS);
+        LOGD("Received ping, Sending PONG with payload len=%d\r\n", (int) client->payload_len);
+        ws_control_due(client, WS_CTRL_PONG, client->rx_buffer, (int) client->payload_len);
     } else if (client->last_opcode == VOLC_WS_OPCODES_PONG) {
-        client->wait_for_pong_resp = false;
+        ws_keepalive_pong(client, client->rx_buffer, (int) client->payload_len);
     } else if (client->last_opcode == VOLC_WS_OPCODES_CLOSE) {
         LOGI("Received close frame\r\n");
         client->state = VOLC_WS_STATE_CLOSING;
     } else if (client->last_opcode == VOLC_WS_OPCODES_TEXT) {
         LOGD("Received text frame: \r\n");
     }
+}
+
+/*
+ * Receive what has arrived without waiting for more. The frame state keeps
+ * a partial header and the rest of the payload, the next call continues the
+ * frame where this one stopped. Data frames are handed out as they arrive,
+ * in parts of at most buffer_size bytes, read into the rx sink's memory when
+ * it takes them. Returns after WEBSOCKET_RX_BUDGET_BYTES, so one busy peer
+ * does not hold up the other clients of a loop.
+ *
+ * @return 0: nothing more for now, -1: error.
+ */
+static int ws_client_recv(volc_ws_client_t* client)
+{
+    int rlen;
+    int len;
+    int budget = WEBSOCKET_RX_BUDGET_BYTES;
+    char* buffer = NULL;
+    volc_ws_event_data_t frame;
+    transport_ws_t* ws = client->ws_transport;
 
+    LOGD("----------begin receive--------------\r\n");
+    while (budget > 0 && VOLC_WS_STATE_CONNECTED == client->state) {
+        if (!ws->frame_state.header_received) {
+            if ((rlen = ws_read_header(client)) < 0) {
+                LOGE("Error read data\r\n");
+                goto _recv_fail;
+            }
+            if (rlen == 0) {
+                return 0;
+            }
+            client->last_rx_ms = hal_get_time_ms();
+            client->payload_len = (int64_t) ws->frame_state.payload_len;
+            client->payload_offset = 0;
+            client->last_fin = ws->frame_state.fin;
+            client->last_opcode = (volc_ws_opcode_e) ws->frame_state.opcode;
+        }
+
+        do {
+            buffer = client->rx_buffer;
+            len = (int) MIN(ws->frame_state.bytes_remaining, (uint64_t) client->buffer_size);
+            if (client->last_opcode & 0x08) {
+                // a control payload may come in parts, it is collected whole for the pong
+                buffer = client->rx_buffer + client->payload_offset;
+            } else if (client->rx_sink && len > 0 && client->last_opcode <= VOLC_WS_OPCODES_BINARY && !ws->frame_state.compressed) {
+                memset(&frame, 0, sizeof(frame));
+                frame.fin = client->last_fin;
+                frame.op_code = client->last_opcode;
+                frame.payload_len = client->payload_len;
+                frame.payload_offset = client->payload_offset;
+                int room = len;
+                char* sink = client->rx_sink(client->user_context, &frame, &room);
+                if (NULL != sink && room > 0) {
+                    buffer = sink;
+                    len = MIN(len, room);
+                }
+            }
+            rlen = 0;
+            if (len > 0 && (rlen = ws_read_payload(client, buffer, len)) < 0) {
+                LOGE("Error reading payload data\r\n");
+                goto _recv_fail;
+            }
+            if (len > 0 && rlen == 0) {
+                // the rest of the frame comes with a later call
+                return 0;
+            }
+            budget -= rlen;
+            client->last_rx_ms = hal_get_time_ms();
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+            if (ws->frame_state.compressed && client->last_opcode <= VOLC_WS_OPCODES_BINARY) {
+                if (client->payload_offset == 0 && client->deflate) {
+                    client->deflate->rx_offset = 0;
+                }
+                if (ws_inflate_dispatch(client, buffer, rlen, client->payload_offset + rlen >= client->payload_len) < 0) {
+                    goto _recv_fail;
+                }
+                client->payload_offset += rlen;
+                continue;
+            }
+#endif
+            volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_DATA, buffer, rlen, client->last_opcode);
+            client->payload_offset += rlen;
+        } while (client->payload_offset < client->payload_len && budget > 0);
+
+        if (client->payload_offset < client->payload_len) {
+            return 0;
+        }
+        ws->frame_state.header_received = false;
+        ws_client_frame_done(client);
+    }
     return 0;
+
+_recv_fail:
+    ws->frame_state.bytes_remaining = 0;
+    ws->frame_state.header_received = false;
+    ws->frame_state.header_len = 0;
+    return -1;
 }
 
 static int volc_ws_client_destory_config(volc_ws_client_t* client)
@@ -992,6 +1610,19 @@ bool volc_ws_client_is_connected(volc_ws_client_t* client)
     return client->state == VOLC_WS_STATE_CONNECTED;
 }
 
+static void ws_tx_lock(volc_ws_client_t* client)
+{
+    uint64_t start = hal_get_time_ms();
+    uint32_t waited = 0;
+    hal_mutex_lock(client->mutex);
+    waited = (uint32_t) (hal_get_time_ms() - start);
+    client->stats.tx_lock_count++;
+    client->stats.tx_wait_total_ms += waited;
+    if (waited > client->stats.tx_wait_max_ms) {
+        client->stats.tx_wait_max_ms = waited;
+    }
+}
+
 static int volc_ws_client_send_with_opcode(volc_ws_client_t* client, volc_ws_opcode_e opcode, const uint8_t* data, int len, int timeout)
 {
     int need_write = len;
@@ -1008,7 +1639,22 @@ static int volc_ws_client_send_with_opcode(volc_ws_client_t* client, volc_ws_opc
         return -1;
     }
 
-    hal_mutex_lock(client->mutex);
+    ws_tx_lock(client);
+    // the reader may have closed the socket while we waited
+    if (!volc_ws_client_is_connected(client)) {
+        LOGE("Websocket client is not connected\r\n");
+        goto unlock_and_return;
+    }
+    // a control frame the loop could not finish goes out before ours
+    if (ws_control_finish(client, true) < 0) {
+        goto unlock_and_return;
+    }
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    if (ws_deflate_wanted(client, opcode, len)) {
+        ret = ws_deflate_send(client, opcode, (const char*) data, len, timeout);
+        goto unlock_and_return;
+    }
+#endif
 
     uint32_t current_opcode = opcode;
     while (widx < len || current_opcode) {
@@ -1017,9 +1663,7 @@ static int volc_ws_client_send_with_opcode(volc_ws_client_t* client, volc_ws_opc
         } else {
             current_opcode |= VOLC_WS_OPCODES_FIN;
         }
-        memcpy(client->tx_buffer, data + widx, need_write);
-
-        wlen = ws_write(client, current_opcode, WS_MASK, (char*) client->tx_buffer, need_write, timeout);
+        wlen = ws_write_with_headroom(client, current_opcode, WS_MASK, client->tx_buffer + MAX_WEBSOCKET_HEADER_SIZE, (const char*) data + widx, need_write, timeout);
         if (wlen < 0 || (wlen == 0 && need_write != 0)) {
             ret = wlen;
             LOGE("Network error: ws_write() returned %d, errno=%d\r\n", ret, errno);
@@ -1038,6 +1682,7 @@ unlock_and_return:
         hal_mutex_unlock(client->mutex);
     else
         LOGE("mutex already deinit\r\n");
+    ws_control_kick(client);
     return ret;
 }
 
@@ -1046,6 +1691,68 @@ int volc_ws_client_send_text(volc_ws_client_t* client, const char* data, int len
     return volc_ws_client_send_with_opcode(client, VOLC_WS_OPCODES_TEXT, (const uint8_t*) data, len, timeout);
 }
 
+int volc_ws_client_send_text_with_writer(volc_ws_client_t* client, volc_ws_payload_writer_t writer, void* ctx, int timeout)
+{
+    char* payload = NULL;
+    char* new_buffer = NULL;
+    int len = 0;
+    int ret = -1;
+    if (client == NULL || writer == NULL) {
+        LOGE("Invalid arguments\r\n");
+        return -1;
+    }
+
+    if (!volc_ws_client_is_connected(client)) {
+        LOGE("Websocket client is not connected\r\n");
+        return -1;
+    }
+
+    ws_tx_lock(client);
+    if (!volc_ws_client_is_connected(client)) {
+        LOGE("Websocket client is not connected\r\n");
+        goto unlock_and_return;
+    }
+    if (ws_control_finish(client, true) < 0) {
+        goto unlock_and_return;
+    }
+
+    len = writer(ctx, client->tx_buffer + MAX_WEBSOCKET_HEADER_SIZE, client->tx_capacity);
+    if (len > client->tx_capacity) {
+        new_buffer = (char*) hal_realloc(client->tx_buffer, MAX_WEBSOCKET_HEADER_SIZE + len);
+        if (NULL == new_buffer) {
+            LOGE("realloc tx_buffer to %d fail\r\n", len);
+            goto unlock_and_return;
+        }
+        client->tx_buffer = new_buffer;
+        client->tx_capacity = len;
+        len = writer(ctx, client->tx_buffer + MAX_WEBSOCKET_HEADER_SIZE, client->tx_capacity);
+    }
+    if (len <= 0 || len > client->tx_capacity) {
+        LOGE("payload writer returned %d\r\n", len);
+        goto unlock_and_return;
+    }
+
+    payload = client->tx_buffer + MAX_WEBSOCKET_HEADER_SIZE;
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    if (ws_deflate_wanted(client, VOLC_WS_OPCODES_TEXT, len)) {
+        ret = ws_deflate_send(client, VOLC_WS_OPCODES_TEXT, payload, len, timeout);
+        goto unlock_and_return;
+    }
+#endif
+    ret = ws_write_with_headroom(client, VOLC_WS_OPCODES_TEXT | VOLC_WS_OPCODES_FIN, WS_MASK, payload, NULL, len, timeout);
+    if (ret < 0) {
+        LOGE("Network error: ws_write_with_headroom() returned %d, errno=%d\r\n", ret, errno);
+    }
+
+unlock_and_return:
+    if (client->mutex)
+        hal_mutex_unlock(client->mutex);
+    else
+        LOGE("mutex already deinit\r\n");
+    ws_control_kick(client);
+    return ret;
+}
+
 int volc_ws_client_send_binary(volc_ws_client_t* client, const char* data, int len, int timeout)
 {
     return volc_ws_client_send_with_opcode(client, VOLC_WS_OPCODES_BINARY, (const uint8_t*) data, len, timeout);
@@ -1057,8 +1764,7 @@ int volc_ws_client_send_close(volc_ws_client_t* client, const char* data, int le
         LOGE("Error send close frame\r\n");
         return -1;
     }
-    status_bits = 0;
-    status_bits |= CLOSE_SENT_BIT;
+    client->close_sent = true;
     return 0;
 }
 
@@ -1192,6 +1898,12 @@ volc_ws_client_t* volc_ws_client_init(const volc_ws_config_t* input)
         }
         client->is_tls = 1;
         LOGD("websocket set port:%d", client->port);
+        // keeps the shared tls context alive across reconnects
+        client->tls_shared = mbedtls_client_retain();
+        if (NULL == client->tls_shared) {
+            LOGE("tls context unavailable");
+            goto _websocket_init_fail;
+        }
 #else
         LOGE("websocket not open tls");
         goto _websocket_init_fail;
@@ -1202,12 +1914,19 @@ volc_ws_client_t* volc_ws_client_init(const volc_ws_config_t* input)
 
     // set event callback
     client->ws_event_handler = input->ws_event_handler;
+    client->rx_sink = input->rx_sink;
+    client->reconnect = input->reconnect;
+    client->sock_opt = input->sock_opt;
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    client->deflate_config = input->deflate;
+#endif
 
     // set autoreconnect
     client->auto_reconnect = true;
 
     // init lock
     client->mutex = hal_mutex_create();
+    client->ssl_mutex = hal_mutex_create();
 
     // set ws_transport
     client->ws_transport = (transport_ws_t*) hal_malloc(sizeof(transport_ws_t));
@@ -1248,6 +1967,17 @@ volc_ws_client_t* volc_ws_client_init(const volc_ws_config_t* input)
     client->reconnect_tick_ms = hal_get_time_ms();
     client->ping_tick_ms = hal_get_time_ms();
     client->wait_for_pong_resp = false;
+    client->keepalive = input->keepalive;
+    if (client->keepalive.idle_ms <= 0)
+        client->keepalive.idle_ms = WEBSOCKET_PING_IDLE_MS;
+    if (client->keepalive.probe_ms <= 0)
+        client->keepalive.probe_ms = WEBSOCKET_PING_PROBE_MS;
+    if (client->keepalive.dead_ms <= 0)
+        client->keepalive.dead_ms = client->keepalive.idle_ms + WEBSOCKET_DEAD_PEER_PROBES * client->keepalive.probe_ms;
+    else if (client->keepalive.dead_ms < client->keepalive.idle_ms + client->keepalive.probe_ms)
+        client->keepalive.dead_ms = client->keepalive.idle_ms + client->keepalive.probe_ms;
+    if (client->keepalive.rtt_ms == 0)
+        client->keepalive.rtt_ms = WEBSOCKET_PING_RTT_MS;
 
     // rx retry
     if (input->rx_retry <= 0)
@@ -1266,13 +1996,17 @@ volc_ws_client_t* volc_ws_client_init(const volc_ws_config_t* input)
         goto _websocket_init_fail;
     }
 
-    if (NULL == (client->tx_buffer = (char*) hal_malloc(buffer_size))) {
+    client->tx_capacity = buffer_size;
+    if (NULL == (client->tx_buffer = (char*) hal_malloc(MAX_WEBSOCKET_HEADER_SIZE + buffer_size))) {
         LOGE("alloc tx_buffer fail\r\n");
         goto _websocket_init_fail;
     }
 
     // sockfd
     client->sockfd = -1;
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+    client->loop_fd = -1;
+#endif
 
     return client;
 
@@ -1316,10 +2050,21 @@ static void free_client(volc_ws_client_t* client)
 
     hal_mutex_destroy(client->mutex);
     client->mutex = NULL;
+    hal_mutex_destroy(client->ssl_mutex);
+    client->ssl_mutex = NULL;
     client->ws_event_handler = NULL;
 
     HAL_SAFE_FREE(client->tx_buffer);
     HAL_SAFE_FREE(client->rx_buffer);
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    ws_deflate_free(client);
+#endif
+#if defined(CONFIG_WEBSOCKET_TLS)
+    if (client->tls_shared) {
+        mbedtls_client_release(client->tls_shared);
+        client->tls_shared = NULL;
+    }
+#endif
 
     if (client->ws_transport) {
         HAL_SAFE_FREE(client->ws_transport->buffer);
@@ -1332,6 +2077,116 @@ static void free_client(volc_ws_client_t* client)
     HAL_SAFE_FREE(client);
 }
 
+/*
+ * One pass of the client state machine. readable: the socket was polled
+ * readable, only then a frame is received in the connected state.
+ */
+static void ws_client_step(volc_ws_client_t* client, bool readable)
+{
+    switch ((int) client->state) {
+        case VOLC_WS_STATE_INIT:
+            LOGI("websocket connecting to %s://%s:%d", client->scheme, client->host, client->port);
+            if (ws_connect(client, client->host, client->port, WEBSOCKET_NETWORK_TIMEOUT_MS) < 0) {
+                LOGE("Error websocket connect");
+                ws_disconnect(client);
+                break;
+            }
+            LOGI("websocket connected to %s://%s:%d", client->scheme, client->host, client->port);
+            client->connected_ms = hal_get_time_ms();
+            if (client->lost_ms) {
+                uint32_t elapsed = (uint32_t) (client->connected_ms - client->lost_ms);
+                client->stats.reconnect_count++;
+                client->stats.reconnect_last_ms = elapsed;
+                client->stats.reconnect_total_ms += elapsed;
+                if (elapsed > client->stats.reconnect_max_ms) {
+                    client->stats.reconnect_max_ms = elapsed;
+                }
+                client->lost_ms = 0;
+                LOGI("reconnected in %u ms after %d attempts", elapsed, client->reconnect_attempts);
+            }
+            // nothing of a frame cut off by the lost connection carries over
+            memset(&client->ws_transport->frame_state, 0, sizeof(volc_ws_frame_state_t));
+            client->state = VOLC_WS_STATE_CONNECTED;
+            client->wait_for_pong_resp = false;
+            client->ping_outstanding = false;
+            client->close_sent = false;
+            client->ctrl_due = 0;
+            client->ctrl_stalled = false;
+            client->ctrl_len = 0;
+            client->ctrl_off = 0;
+            client->ping_tick_ms = client->connected_ms;
+            client->last_rx_ms = client->connected_ms;
+            volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_CONNECTED, NULL, 0, -1);
+            break;
+        case VOLC_WS_STATE_CONNECTED:
+            LOGD("%s, close sent:%d %llu %llu\r\n", __func__, (int) client->close_sent, hal_get_time_ms(), client->last_rx_ms);
+            // rx state belongs to this task, senders keep going while a frame trickles in
+            if (readable && ws_client_recv(client) == -1) {
+                LOGE("Error receive data");
+                ws_disconnect(client);
+                break;
+            }
+            // a busy link still sends its RTT pings
+            if (VOLC_WS_STATE_CONNECTED == client->state && ws_keepalive(client) < 0) {
+                ws_disconnect(client);
+                break;
+            }
+            ws_control_flush(client);
+            break;
+
+        case VOLC_WS_STATE_WAIT_TIMEOUT:
+            if (!client->auto_reconnect) {
+                client->run = false;
+                break;
+            }
+            if (hal_get_time_ms() - client->reconnect_tick_ms >= (uint64_t) client->reconnect_delay_ms) {
+                client->state = VOLC_WS_STATE_INIT;
+                client->reconnect_tick_ms = hal_get_time_ms();
+                LOGE("Reconnecting...");
+            }
+            break;
+        case VOLC_WS_STATE_CLOSING:
+            LOGE("Closing initiated by the server, sending close frame");
+            ws_control_due(client, WS_CTRL_CLOSE, NULL, 0);
+            client->close_sent = true;
+            ws_control_flush(client);
+            break;
+        default:
+            LOGE("Client run iteration in a default state: %d", client->state);
+            break;
+    }
+}
+
+// after the close frame went out, the client loop ends either way
+static void ws_client_wait_closed(volc_ws_client_t* client, int timeout_ms)
+{
+    LOGW(" Waiting for TCP connection to be closed by the server");
+    int ret = ws_poll_connection_closed(&(client->sockfd), timeout_ms);
+    if (ret == 0) {
+        // still waiting
+        return;
+    }
+    if (ret < 0) {
+        LOGE("Connection terminated while waiting for clean TCP close");
+    }
+    client->run = false;
+    client->state = VOLC_WS_STATE_UNKNOW;
+    volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_CLOSED, NULL, 0, -1);
+}
+
+static void ws_client_release(volc_ws_client_t* client)
+{
+    LOGW("close connection...");
+    hal_mutex_lock(client->mutex);
+    ws_tcp_close(client);
+    hal_mutex_unlock(client->mutex);
+    client->state = VOLC_WS_STATE_UNKNOW;
+
+    if (volc_ws_client_destory_config(client)) {
+        LOGE("client config already hal_free");
+    }
+}
+
 #if defined(PLATFORM_MACOS)
 void* volc_ws_client_task(void* thread_param)
 #else
@@ -1344,110 +2199,28 @@ void volc_ws_client_task(void* thread_param)
     client->state = VOLC_WS_STATE_INIT;
     int read_select = 0;
     while (client->run) {
-        switch ((int) client->state) {
-            case VOLC_WS_STATE_INIT:
-                LOGI("websocket connecting to %s://%s:%d", client->scheme, client->host, client->port);
-                if (ws_connect(client, client->host, client->port, WEBSOCKET_NETWORK_TIMEOUT_MS) < 0) {
-                    LOGE("Error websocket connect");
-                    ws_disconnect(client);
-                    break;
-                }
-                LOGI("websocket connected to %s://%s:%d", client->scheme, client->host, client->port);
-                client->state = VOLC_WS_STATE_CONNECTED;
-                client->wait_for_pong_resp = false;
-                volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_CONNECTED, NULL, 0, -1);
-                break;
-            case VOLC_WS_STATE_CONNECTED:
-                LOGD("%s, status:%02x %llu %llu\r\n", __func__, status_bits, hal_get_time_ms(), client->ping_tick_ms);
-                if (hal_get_time_ms() - client->ping_tick_ms > WEBSOCKET_PING_INTERVAL_SEC * 1000) {
-                    client->ping_tick_ms = hal_get_time_ms();
-
-                    if (status_bits & PING_SENT_BIT) {
-                        hal_mutex_lock(client->mutex);
-                        ws_write(client, VOLC_WS_OPCODES_PING | VOLC_WS_OPCODES_FIN, WS_MASK, NULL, 0, WEBSOCKET_NETWORK_TIMEOUT_MS);
-                        hal_mutex_unlock(client->mutex);
-                    }
-                    if (!client->wait_for_pong_resp) {
-                        client->pingpong_tick_ms = hal_get_time_ms();
-                        client->wait_for_pong_resp = true;
-                    }
-                }
-                if (hal_get_time_ms() - client->pingpong_tick_ms > WEBSOCKET_PINGPONG_TIMEOUT_SEC * 1000) {
-                    if (client->wait_for_pong_resp) {
-                        LOGW("Error, no PONG received for more than %" PRIu64 " seconds after PING\r\n", client->pingpong_tick_ms);
-                        break;
-                    }
-                }
-
-                if (read_select == 0) {
-                    LOGD("Read poll timeout: skipping read()...");
-                    break;
-                }
-                // client->ping_tick_ms = hal_get_time_ms();
-                hal_mutex_lock(client->mutex);
-                if (ws_client_recv(client) == -1) {
-                    LOGE("Error receive data");
-                    ws_disconnect(client);
-                    hal_mutex_unlock(client->mutex);
-                    break;
-                }
-                hal_mutex_unlock(client->mutex);
-                break;
-
-            case VOLC_WS_STATE_WAIT_TIMEOUT:
-                if (!client->auto_reconnect) {
-                    client->run = false;
-                    break;
-                }
-                if (hal_get_time_ms() - client->reconnect_tick_ms > WEBSOCKET_RECONNECT_TIMEOUT_MS) {
-                    client->state = VOLC_WS_STATE_INIT;
-                    client->reconnect_tick_ms = hal_get_time_ms();
-                    LOGE("Reconnecting...");
-                }
-                break;
-            case VOLC_WS_STATE_CLOSING:
-                LOGE("Closing initiated by the server, sending close frame");
-                ws_write(client, VOLC_WS_OPCODES_CLOSE | VOLC_WS_OPCODES_FIN, WS_MASK, NULL, 0, WEBSOCKET_NETWORK_TIMEOUT_MS);
-                break;
-            default:
-                LOGE("Client run iteration in a default state: %d", client->state);
-                break;
-        }
+        ws_client_step(client, read_select > 0);
 
         if (VOLC_WS_STATE_CONNECTED == client->state) {
-            read_select = ws_tcp_poll_read(client, 1000); // Poll every 1000ms
+            uint64_t now = hal_get_time_ms();
+            uint64_t deadline = ws_keepalive_deadline(client);
+            // at most 1000ms, less when a ping or the dead peer check is due sooner
+            read_select = ws_tcp_poll_read(client, deadline > now ? (int) MIN(deadline - now, 1000) : 0);
             if (read_select < 0) {
                 LOGE("Network error: ws_tcp_poll_read() returned %d, errno=%d", read_select, errno);
                 ws_disconnect(client);
             }
         } else if (VOLC_WS_STATE_WAIT_TIMEOUT == client->state) {
-            if (client->auto_reconnect)
-                hal_thread_sleep(WEBSOCKET_RECONNECT_TIMEOUT_MS);
+            uint64_t waited = hal_get_time_ms() - client->reconnect_tick_ms;
+            // in slices, a stop does not have to wait out a long backoff
+            if (client->auto_reconnect && waited < (uint64_t) client->reconnect_delay_ms)
+                hal_thread_sleep((int) MIN((uint64_t) client->reconnect_delay_ms - waited, 1000));
         } else if (VOLC_WS_STATE_CLOSING == client->state) {
-            LOGW(" Waiting for TCP connection to be closed by the server");
-            int ret = ws_poll_connection_closed(&(client->sockfd), 1000);
-            if (ret == 0) {
-                // still waiting
-                break;
-            }
-            if (ret < 0) {
-                LOGE("Connection terminated while waiting for clean TCP close");
-            }
-            client->run = false;
-            client->state = VOLC_WS_STATE_UNKNOW;
-            volc_ws_client_dispatch_event(client, VOLC_WS_EVENT_CLOSED, NULL, 0, -1);
+            ws_client_wait_closed(client, 1000);
             break;
         }
     }
-    LOGW("close connection...");
-    hal_mutex_lock(client->mutex);
-    ws_tcp_close(client);
-    hal_mutex_unlock(client->mutex);
-    client->state = VOLC_WS_STATE_UNKNOW;
-
-    if (volc_ws_client_destory_config(client)) {
-        LOGE("client config already hal_free");
-    }
+    ws_client_release(client);
     if (client->tid) {
         hal_thread_destroy(client->tid);
     }
@@ -1460,6 +2233,569 @@ void volc_ws_client_task(void* thread_param)
 #endif
 }
 
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+#define WEBSOCKET_REACTOR_MAX_THREADS   (16)
+#define WEBSOCKET_REACTOR_MAX_WAIT_MS   (1000)
+#define WEBSOCKET_REACTOR_CLOSE_WAIT_MS (1000)
+#define WEBSOCKET_REACTOR_MAX_EVENTS    (64)
+// connects in flight per loop, a stalled server holds up one worker only
+#define WEBSOCKET_REACTOR_CONNECT_WORKERS (4)
+
+typedef struct volc_ws_reactor_loop {
+    hal_tid_t tid;
+    hal_mutex_t mutex;
+    volc_ws_client_t** pending;     // handed over by volc_ws_client_start_on(), guarded by mutex
+    int pending_count;
+    int pending_capacity;
+    // DNS, TCP, TLS and the upgrade block, they run on workers of their own
+    hal_tid_t connect_tids[WEBSOCKET_REACTOR_CONNECT_WORKERS];
+    int connect_workers;
+    int connect_running;
+    hal_event_t connect_event;
+    volc_ws_client_t** connecting;  // waiting for a connect worker, guarded by mutex
+    int connect_count;
+    int connect_capacity;
+    volc_ws_client_t** clients;     // only touched by the loop thread
+    int client_count;
+    int client_capacity;
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    int epfd;
+#else
+    struct pollfd* pfds;            // [0] is the wake pipe, [i + 1] is clients[i]
+#endif
+    int wake[2];
+    int load;
+    volatile bool run;
+    volatile bool exit;
+} volc_ws_reactor_loop_t;
+
+struct volc_ws_reactor {
+    volc_ws_reactor_loop_t* loops;
+    int count;
+};
+
+static int ws_reactor_reserve(volc_ws_client_t*** array, int* capacity, int need)
+{
+    volc_ws_client_t** grown = NULL;
+    int new_capacity = *capacity > 0 ? *capacity : 8;
+    if (need <= *capacity) {
+        return 0;
+    }
+    while (new_capacity < need) {
+        new_capacity *= 2;
+    }
+    grown = (volc_ws_client_t**) hal_realloc(*array, new_capacity * sizeof(volc_ws_client_t*));
+    if (NULL == grown) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static void ws_reactor_wake(volc_ws_reactor_loop_t* loop)
+{
+    char c = 0;
+    if (write(loop->wake[1], &c, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOGW("reactor wake failed, errno=%d", errno);
+    }
+}
+
+// move clients started since the last iteration into the loop
+static void ws_reactor_adopt(volc_ws_reactor_loop_t* loop)
+{
+    int i = 0;
+    hal_mutex_lock(loop->mutex);
+    if (loop->pending_count > 0 && 0 == ws_reactor_reserve(&loop->clients, &loop->client_capacity, loop->client_count + loop->pending_count)) {
+#if !defined(WEBSOCKET_REACTOR_EPOLL)
+        struct pollfd* pfds = (struct pollfd*) hal_realloc(loop->pfds, (loop->client_capacity + 1) * sizeof(struct pollfd));
+        if (NULL == pfds) {
+            hal_mutex_unlock(loop->mutex);
+            return;
+        }
+        loop->pfds = pfds;
+#endif
+        for (i = 0; i < loop->pending_count; i++) {
+            loop->clients[loop->client_count++] = loop->pending[i];
+        }
+        loop->pending_count = 0;
+    }
+    hal_mutex_unlock(loop->mutex);
+}
+
+static void ws_reactor_deadline(uint64_t* deadline, uint64_t at)
+{
+    if (at < *deadline) {
+        *deadline = at;
+    }
+}
+
+// the loop leaves the client alone until a connect worker is done with it
+static void ws_reactor_connect(volc_ws_reactor_loop_t* loop, volc_ws_client_t* client)
+{
+    hal_mutex_lock(loop->mutex);
+    if (ws_reactor_reserve(&loop->connecting, &loop->connect_capacity, loop->connect_count + 1) != 0) {
+        hal_mutex_unlock(loop->mutex);
+        LOGE("reactor connect list alloc fail");
+        return;
+    }
+    __atomic_store_n(&client->loop_connecting, true, __ATOMIC_RELAXED);
+    loop->connecting[loop->connect_count++] = client;
+    hal_mutex_unlock(loop->mutex);
+    hal_event_set(loop->connect_event);
+}
+
+#if defined(PLATFORM_MACOS)
+static void* ws_reactor_connect_task(void* thread_param)
+#else
+static void ws_reactor_connect_task(void* thread_param)
+#endif
+{
+    volc_ws_reactor_loop_t* loop = (volc_ws_reactor_loop_t*) thread_param;
+    volc_ws_client_t* client = NULL;
+
+    while (loop->run) {
+        client = NULL;
+        hal_mutex_lock(loop->mutex);
+        if (loop->connect_count > 0) {
+            client = loop->connecting[0];
+            loop->connect_count--;
+            memmove(loop->connecting, loop->connecting + 1, loop->connect_count * sizeof(volc_ws_client_t*));
+        }
+        hal_mutex_unlock(loop->mutex);
+        if (NULL == client) {
+            hal_event_wait(loop->connect_event, WEBSOCKET_REACTOR_MAX_WAIT_MS);
+            continue;
+        }
+        if (loop->connect_count > 0) {
+            // one set may wake a single worker, pass the rest on
+            hal_event_set(loop->connect_event);
+        }
+        // a stopped client goes back untouched, the loop releases it
+        if (client->run && VOLC_WS_STATE_INIT == client->state) {
+            ws_client_step(client, false);
+        }
+        __atomic_store_n(&client->loop_connecting, false, __ATOMIC_RELEASE);
+        ws_reactor_wake(loop);
+    }
+    hal_mutex_lock(loop->mutex);
+    while (loop->connect_count > 0) {
+        client = loop->connecting[--loop->connect_count];
+        __atomic_store_n(&client->loop_connecting, false, __ATOMIC_RELEASE);
+    }
+    hal_mutex_unlock(loop->mutex);
+    __atomic_sub_fetch(&loop->connect_running, 1, __ATOMIC_RELEASE);
+    hal_thread_exit(NULL);
+#if defined(PLATFORM_MACOS)
+    return NULL;
+#else
+    return;
+#endif
+}
+
+/*
+ * Run one step of the client if it is due and record when it is due next.
+ * Connects go to the connect worker, reads take what has arrived and the
+ * close handshake waits for the server, none of them blocks the loop.
+ *
+ * @return false once the client is finished with.
+ */
+static bool ws_reactor_service(volc_ws_client_t* client, uint64_t* deadline)
+{
+    bool readable = client->loop_readable;
+    uint64_t now = 0;
+
+    if (__atomic_load_n(&client->loop_connecting, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    client->loop_readable = false;
+    if (!client->run) {
+        return false;
+    }
+    if (VOLC_WS_STATE_INIT == client->state) {
+        ws_reactor_connect(client->loop, client);
+        return true;
+    }
+    if (VOLC_WS_STATE_CLOSING != client->state) {
+        ws_client_step(client, readable);
+        readable = false;
+        if (!client->run) {
+            return false;
+        }
+    }
+    now = hal_get_time_ms();
+    switch ((int) client->state) {
+        case VOLC_WS_STATE_INIT:
+            ws_reactor_deadline(deadline, now);
+            break;
+        case VOLC_WS_STATE_CONNECTED:
+            ws_reactor_deadline(deadline, ws_keepalive_deadline(client));
+            break;
+        case VOLC_WS_STATE_WAIT_TIMEOUT:
+            ws_reactor_deadline(deadline, client->reconnect_tick_ms + client->reconnect_delay_ms);
+            break;
+        case VOLC_WS_STATE_CLOSING:
+            if (VOLC_WS_STATE_CLOSING != client->loop_state) {
+                // sends the close frame
+                ws_client_step(client, false);
+                client->loop_state_ms = now;
+            } else if (readable || now - client->loop_state_ms >= WEBSOCKET_REACTOR_CLOSE_WAIT_MS) {
+                ws_client_wait_closed(client, 0);
+                return false;
+            } else {
+                // the rest of a close frame the send buffer had no room for
+                ws_control_flush(client);
+            }
+            ws_reactor_deadline(deadline, client->loop_state_ms + WEBSOCKET_REACTOR_CLOSE_WAIT_MS);
+            break;
+        default:
+            break;
+    }
+    client->loop_state = client->state;
+    return client->run;
+}
+
+/*
+ * Only a connected or closing client has its socket watched, for writing too
+ * while a control frame waits for room in the send buffer.
+ */
+static void ws_reactor_watch(volc_ws_reactor_loop_t* loop, volc_ws_client_t* client)
+{
+    int fd = -1;
+    bool want_write = false;
+    if (__atomic_load_n(&client->loop_connecting, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (VOLC_WS_STATE_CONNECTED == client->state || VOLC_WS_STATE_CLOSING == client->state) {
+        fd = client->sockfd;
+        want_write = client->ctrl_stalled;
+    }
+    if (fd == client->loop_fd && want_write == client->loop_want_write) {
+        return;
+    }
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    // a closed socket has already left the epoll set
+    if (fd >= 0) {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+        ev.data.ptr = client;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0
+            && (errno != EEXIST || epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)) {
+            LOGE("epoll_ctl add fd=%d failed, errno=%d", fd, errno);
+            return;
+        }
+    }
+#endif
+    client->loop_fd = fd;
+    client->loop_want_write = want_write;
+}
+
+static void ws_reactor_unwatch(volc_ws_reactor_loop_t* loop, volc_ws_client_t* client)
+{
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    if (client->loop_fd >= 0 && client->loop_fd == client->sockfd) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, client->loop_fd, NULL);
+    }
+#endif
+    client->loop_fd = -1;
+}
+
+static void ws_reactor_drain_wake(volc_ws_reactor_loop_t* loop)
+{
+    char buf[16];
+    while (read(loop->wake[0], buf, sizeof(buf)) > 0) {
+    }
+}
+
+static void ws_reactor_wait(volc_ws_reactor_loop_t* loop, int timeout_ms)
+{
+    int i = 0;
+    int n = 0;
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    struct epoll_event events[WEBSOCKET_REACTOR_MAX_EVENTS];
+    n = epoll_wait(loop->epfd, events, WEBSOCKET_REACTOR_MAX_EVENTS, timeout_ms);
+    for (i = 0; i < n; i++) {
+        if (NULL == events[i].data.ptr) {
+            ws_reactor_drain_wake(loop);
+        } else if (events[i].events & ~EPOLLOUT) {
+            // room to write only wakes the loop, every client is serviced
+            ((volc_ws_client_t*) events[i].data.ptr)->loop_readable = true;
+        }
+    }
+#else
+    loop->pfds[0].fd = loop->wake[0];
+    loop->pfds[0].events = POLLIN;
+    loop->pfds[0].revents = 0;
+    for (i = 0; i < loop->client_count; i++) {
+        // negative fds are ignored by poll
+        loop->pfds[i + 1].fd = loop->clients[i]->loop_fd;
+        loop->pfds[i + 1].events = POLLIN | (loop->clients[i]->loop_want_write ? POLLOUT : 0);
+        loop->pfds[i + 1].revents = 0;
+    }
+    n = poll(loop->pfds, loop->client_count + 1, timeout_ms);
+    if (n > 0) {
+        if (loop->pfds[0].revents) {
+            ws_reactor_drain_wake(loop);
+        }
+        for (i = 0; i < loop->client_count; i++) {
+            if (loop->pfds[i + 1].revents & ~POLLOUT) {
+                loop->clients[i]->loop_readable = true;
+            }
+        }
+    }
+#endif
+    if (n < 0 && errno != EINTR) {
+        LOGE("reactor wait failed, errno=%d", errno);
+        hal_thread_sleep(10);
+    }
+}
+
+#if defined(PLATFORM_MACOS)
+static void* ws_reactor_task(void* thread_param)
+#else
+static void ws_reactor_task(void* thread_param)
+#endif
+{
+    volc_ws_reactor_loop_t* loop = (volc_ws_reactor_loop_t*) thread_param;
+    volc_ws_client_t* client = NULL;
+    uint64_t deadline = 0;
+    uint64_t now = 0;
+    int timeout_ms = 0;
+    int i = 0;
+    int kept = 0;
+
+    while (loop->run) {
+        ws_reactor_adopt(loop);
+
+        now = hal_get_time_ms();
+        deadline = now + WEBSOCKET_REACTOR_MAX_WAIT_MS;
+        kept = 0;
+        for (i = 0; i < loop->client_count; i++) {
+            client = loop->clients[i];
+            if (ws_reactor_service(client, &deadline)) {
+                ws_reactor_watch(loop, client);
+                // what is left in the TLS record never wakes the wait up
+                if (client->loop_fd >= 0 && ws_tcp_pending(client)) {
+                    client->loop_readable = true;
+                    deadline = now;
+                }
+                loop->clients[kept++] = client;
+                continue;
+            }
+            ws_reactor_unwatch(loop, client);
+            ws_client_release(client);
+            client->loop = NULL;
+            __atomic_sub_fetch(&loop->load, 1, __ATOMIC_RELAXED);
+            // volc_ws_client_stop() may free the client from here on
+            client->exit = true;
+        }
+        loop->client_count = kept;
+
+        now = hal_get_time_ms();
+        timeout_ms = deadline > now ? (int) (deadline - now) : 0;
+        ws_reactor_wait(loop, timeout_ms);
+    }
+    if (loop->tid) {
+        hal_thread_destroy(loop->tid);
+    }
+    loop->exit = true;
+    hal_thread_exit(NULL);
+#if defined(PLATFORM_MACOS)
+    return NULL;
+#else
+    return;
+#endif
+}
+
+static void ws_reactor_loop_deinit(volc_ws_reactor_loop_t* loop)
+{
+    if (loop->connect_event) {
+        hal_event_destroy(loop->connect_event);
+    }
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    if (loop->epfd >= 0) {
+        close(loop->epfd);
+    }
+#else
+    HAL_SAFE_FREE(loop->pfds);
+#endif
+    if (loop->wake[0] >= 0) {
+        close(loop->wake[0]);
+    }
+    if (loop->wake[1] >= 0) {
+        close(loop->wake[1]);
+    }
+    if (loop->mutex) {
+        hal_mutex_destroy(loop->mutex);
+    }
+    HAL_SAFE_FREE(loop->pending);
+    HAL_SAFE_FREE(loop->connecting);
+    HAL_SAFE_FREE(loop->clients);
+}
+
+static int ws_reactor_loop_init(volc_ws_reactor_loop_t* loop)
+{
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    struct epoll_event ev = {0};
+#endif
+    hal_thread_param_t param = {0};
+
+    loop->wake[0] = -1;
+    loop->wake[1] = -1;
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    loop->epfd = -1;
+#endif
+    if (NULL == (loop->mutex = hal_mutex_create())) {
+        return -1;
+    }
+    if (NULL == (loop->connect_event = hal_event_create())) {
+        return -1;
+    }
+    if (pipe(loop->wake) != 0) {
+        loop->wake[0] = -1;
+        loop->wake[1] = -1;
+        LOGE("reactor pipe failed, errno=%d", errno);
+        return -1;
+    }
+    set_socket_non_blocking(loop->wake[0], true);
+    set_socket_non_blocking(loop->wake[1], true);
+#if defined(WEBSOCKET_REACTOR_EPOLL)
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        LOGE("epoll_create1 failed, errno=%d", errno);
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake[0], &ev) < 0) {
+        LOGE("epoll_ctl add wake pipe failed, errno=%d", errno);
+        return -1;
+    }
+#else
+    if (NULL == (loop->pfds = (struct pollfd*) hal_calloc(1, sizeof(struct pollfd)))) {
+        return -1;
+    }
+#endif
+    loop->run = true;
+    snprintf(param.name, sizeof(param.name), "%s", "ws_reactor");
+    param.stack_size = WEBSOCKET_TASK_STACK;
+    param.priority = WEBSOCKET_TASK_PRIORITY;
+    if (hal_thread_create(&loop->tid, &param, ws_reactor_task, (void*) loop) != 0) {
+        LOGE("create ws_reactor_task fail");
+        loop->run = false;
+        return -1;
+    }
+    snprintf(param.name, sizeof(param.name), "%s", "ws_connect");
+    for (; loop->connect_workers < WEBSOCKET_REACTOR_CONNECT_WORKERS; loop->connect_workers++) {
+        __atomic_add_fetch(&loop->connect_running, 1, __ATOMIC_RELAXED);
+        if (hal_thread_create(&loop->connect_tids[loop->connect_workers], &param, ws_reactor_connect_task, (void*) loop) != 0) {
+            __atomic_sub_fetch(&loop->connect_running, 1, __ATOMIC_RELAXED);
+            LOGE("create ws_reactor_connect_task fail");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+volc_ws_reactor_t* volc_ws_reactor_create(int threads)
+{
+    volc_ws_reactor_t* reactor = NULL;
+    int i = 0;
+
+    if (threads <= 0) {
+        threads = 1;
+    }
+    threads = MIN(threads, WEBSOCKET_REACTOR_MAX_THREADS);
+    if (NULL == (reactor = (volc_ws_reactor_t*) hal_calloc(1, sizeof(volc_ws_reactor_t)))) {
+        return NULL;
+    }
+    if (NULL == (reactor->loops = (volc_ws_reactor_loop_t*) hal_calloc(threads, sizeof(volc_ws_reactor_loop_t)))) {
+        HAL_SAFE_FREE(reactor);
+        return NULL;
+    }
+    for (i = 0; i < threads; i++) {
+        reactor->count++;
+        if (ws_reactor_loop_init(&reactor->loops[i]) != 0) {
+            volc_ws_reactor_destroy(reactor);
+            return NULL;
+        }
+    }
+    LOGI("websocket reactor started with %d threads", threads);
+    return reactor;
+}
+
+void volc_ws_reactor_destroy(volc_ws_reactor_t* reactor)
+{
+    volc_ws_reactor_loop_t* loop = NULL;
+    int i = 0;
+    int j = 0;
+
+    if (NULL == reactor) {
+        return;
+    }
+    for (i = 0; i < reactor->count; i++) {
+        loop = &reactor->loops[i];
+        if (loop->run) {
+            loop->run = false;
+            ws_reactor_wake(loop);
+            while (!loop->exit || __atomic_load_n(&loop->connect_running, __ATOMIC_ACQUIRE) > 0) {
+                hal_event_set(loop->connect_event);
+                hal_thread_sleep(10);
+            }
+        }
+        for (j = 0; j < loop->connect_workers; j++) {
+            hal_thread_destroy(loop->connect_tids[j]);
+        }
+        ws_reactor_loop_deinit(loop);
+    }
+    HAL_SAFE_FREE(reactor->loops);
+    HAL_SAFE_FREE(reactor);
+}
+
+int volc_ws_client_start_on(volc_ws_client_t* client, volc_ws_reactor_t* reactor)
+{
+    volc_ws_reactor_loop_t* loop = NULL;
+    int i = 0;
+
+    if (client == NULL || reactor == NULL) {
+        LOGE("The client or reactor has not be initialized");
+        return -1;
+    }
+    if (client->state >= VOLC_WS_STATE_INIT) {
+        LOGE("The client has started");
+        return -1;
+    }
+    loop = &reactor->loops[0];
+    for (i = 1; i < reactor->count; i++) {
+        if (__atomic_load_n(&reactor->loops[i].load, __ATOMIC_RELAXED) < __atomic_load_n(&loop->load, __ATOMIC_RELAXED)) {
+            loop = &reactor->loops[i];
+        }
+    }
+
+    client->run = true;
+    client->exit = false;
+    client->state = VOLC_WS_STATE_INIT;
+    client->loop = loop;
+    client->loop_fd = -1;
+    client->loop_readable = false;
+    client->loop_state = VOLC_WS_STATE_UNKNOW;
+
+    hal_mutex_lock(loop->mutex);
+    if (ws_reactor_reserve(&loop->pending, &loop->pending_capacity, loop->pending_count + 1) != 0) {
+        hal_mutex_unlock(loop->mutex);
+        client->run = false;
+        client->state = VOLC_WS_STATE_UNKNOW;
+        client->loop = NULL;
+        LOGE("reactor pending list alloc fail");
+        return -1;
+    }
+    loop->pending[loop->pending_count++] = client;
+    hal_mutex_unlock(loop->mutex);
+    __atomic_add_fetch(&loop->load, 1, __ATOMIC_RELAXED);
+    ws_reactor_wake(loop);
+    return 0;
+}
+#endif
+
 int volc_ws_client_start(volc_ws_client_t* client)
 {
     int ret;
@@ -1497,6 +2833,12 @@ int volc_ws_client_stop(volc_ws_client_t* client)
     }
     client->run = false;
     client->state = VOLC_WS_STATE_UNKNOW;
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+    volc_ws_reactor_loop_t* loop = client->loop;
+    if (loop) {
+        ws_reactor_wake(loop);
+    }
+#endif
     while(!client->exit) {
         LOGI("wait client exit...");
         hal_thread_sleep(10);
@@ -13,7 +13,14 @@ extern "C" {
 
 #include "volc_platform.h"
 #include "tls_client.h"
+#include "util/volc_net.h"
 #define CONFIG_WEBSOCKET_TLS
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+#define CONFIG_WEBSOCKET_REACTOR
+#endif
+#if defined(ENABLE_WS_DEFLATE)
+#define CONFIG_WEBSOCKET_DEFLATE
+#endif
 
 typedef enum {
     VOLC_WS_STATE_ERROR = -1,
@@ -49,9 +56,13 @@ typedef struct {
     uint8_t opcode;
     bool fin;
     char mask_key[4];
-    int payload_len;
-    int bytes_remaining;
-    bool header_received;
+    bool masked;            // servers must not mask, the unmask pass is skipped unless set
+    bool compressed;        // RSV1 on the first frame, kept for the whole message
+    uint64_t payload_len;
+    uint64_t bytes_remaining;
+    bool header_received;   // header complete, the payload is being read
+    char header[14];        // 2 + 8 byte length + 4 byte mask key, the longest header
+    int header_len;         // bytes of the header read so far
 } volc_ws_frame_state_t;
 
 typedef struct {
@@ -68,10 +79,105 @@ typedef struct {
     uint64_t last_print_ms;
     int sent;
     int received;
+    uint32_t tx_lock_count;     // writes that took the tx lock
+    uint32_t tx_wait_max_ms;    // longest a writer waited for the tx lock
+    uint64_t tx_wait_total_ms;
+    uint64_t deflate_in_bytes;  // payload bytes before compression
+    uint64_t deflate_out_bytes; // compressed payload bytes sent
+    uint64_t deflate_time_us;
+    uint64_t inflate_in_bytes;  // compressed payload bytes received
+    uint64_t inflate_out_bytes;
+    uint64_t inflate_time_us;
+    uint32_t reconnect_count;       // connections restored after a loss
+    uint32_t reconnect_last_ms;     // connection lost to connected again, last time
+    uint32_t reconnect_max_ms;
+    uint64_t reconnect_total_ms;
+    uint32_t ping_sent;
+    uint32_t pong_received;         // pongs that answered our own ping
+    uint32_t rtt_last_us;           // ping to pong, last sample
+    uint32_t rtt_srtt_us;           // smoothed as in RFC 6298, 0 before the first sample
+    uint32_t rtt_var_us;
+    uint32_t dead_peer_count;       // connections dropped for staying silent past dead_ms
 } ws_stats_t;
 
+/**
+ * @brief keepalive driven by inbound traffic: no probe is sent while frames
+ *        keep arriving. After idle_ms of silence a ping goes out, repeated
+ *        every probe_ms, and the peer is declared dead once nothing at all
+ *        has been received for dead_ms. While traffic flows, a ping every
+ *        rtt_ms only measures the RTT.
+ */
+typedef struct {
+    int idle_ms;                // 0: 10000
+    int probe_ms;               // 0: 2000
+    int dead_ms;                // 0: idle_ms + 3 probes, at least idle_ms + probe_ms
+    int rtt_ms;                 // 0: 15000, < 0: off
+} volc_ws_keepalive_config_t;
+
+/**
+ * @brief reconnect schedule: the first retry is immediate, then the delay
+ *        doubles from base_ms up to max_ms, each one jittered down to half.
+ */
+typedef struct {
+    int base_ms;                // 0: 250
+    int max_ms;                 // 0: 5000
+} volc_ws_reconnect_config_t;
+
+/**
+ * @brief permessage-deflate (RFC 7692) offer. Memory is roughly
+ *        (1 << (client_window_bits + 2)) + (1 << (mem_level + 9)) to compress
+ *        plus (1 << server_window_bits) to decompress.
+ */
+typedef struct {
+    bool enable;
+    int client_window_bits;     // 9..15, window used to compress, 0: 15
+    int server_window_bits;     // 8..15, largest window the server may use, 0: 15
+    int mem_level;              // 1..9, 0: 8
+    bool no_context_takeover;   // both sides reset after every message
+    int min_size;               // shorter messages are sent uncompressed
+} volc_ws_deflate_config_t;
+
+/**
+ * @brief serialize a message payload straight into the transmit buffer.
+ *
+ * @return the payload length. A value larger than cap asks for a buffer of
+ *         that size, the writer is then called once more. <= 0 on error.
+ */
+typedef int (*volc_ws_payload_writer_t)(void* ctx, char* buf, int cap);
+
 typedef void (*volc_ws_event_handler_t)(void* user_context, int32_t event_id, void* event_data);
 
+/**
+ * @brief Websocket event data
+ */
+typedef struct {
+    char* data_ptr;
+    int data_len;
+    bool fin;
+    uint8_t op_code;
+    int64_t payload_len;    // of a compressed frame only known with its last chunk, -1 before
+    int64_t payload_offset;
+} volc_ws_event_data_t;
+
+/**
+ * @brief pick where the next read of a data frame lands, so the payload goes
+ *        from the socket (or the TLS record) straight to its final place. The
+ *        VOLC_WS_EVENT_DATA event that follows points at the returned memory.
+ *        Not asked for control frames and compressed messages.
+ *
+ * @param frame op_code, fin, payload_len and payload_offset of the read,
+ *        data_ptr and data_len are not set yet.
+ * @param len in: bytes wanted, out: bytes available at the returned pointer.
+ *
+ * @return NULL to read into the client's own rx buffer.
+ */
+typedef char* (*volc_ws_rx_sink_t)(void* user_context, const volc_ws_event_data_t* frame, int* len);
+
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+typedef struct volc_ws_reactor volc_ws_reactor_t;
+struct volc_ws_reactor_loop;
+#endif
+
 typedef struct {
     char* host;
     char* path;
@@ -81,31 +187,68 @@ typedef struct {
     volc_ws_state_e state;
     //  uint64_t					  keepalive_tick_ms;
     uint64_t reconnect_tick_ms;
-    uint64_t ping_tick_ms;
-    uint64_t pingpong_tick_ms;
+    int reconnect_attempts;     // failed or lost connections since the last stable one
+    int reconnect_delay_ms;     // from reconnect_tick_ms to the next attempt
+    uint64_t connected_ms;
+    uint64_t lost_ms;           // when the connection was lost, 0 while up or never connected
+    volc_ws_reconnect_config_t reconnect;
+    volc_ws_keepalive_config_t keepalive;   // resolved, no zero left
+    uint64_t ping_tick_ms;      // last ping sent
+    uint64_t ping_sent_us;
+    uint32_t ping_seq;          // payload of the last ping, a pong has to echo it
+    bool ping_outstanding;      // ping_seq still waits for its pong, only a newer ping replaces it
+    bool close_sent;            // our close frame is out, no more pings on this connection
+    // control frames owed to the peer, see ws_control_flush()
+    int ctrl_due;               // WS_CTRL_* bits, set by the reader
+    bool ctrl_stalled;          // the reader left part of ctrl_frame unwritten
+    char pong_payload[125];     // of the newest ping, reader only
+    int pong_len;
+    char ctrl_frame[16 + 125];  // guarded by mutex: header and payload being written
+    int ctrl_len;
+    int ctrl_off;               // bytes of ctrl_frame on the wire
+    bool tls_pending;           // the last read left plaintext in mbedtls, reader only
+    uint64_t last_rx_ms;        // last frame header received
     int auto_reconnect;
     volatile bool run;
     volatile bool exit;
     bool wait_for_pong_resp;
     char* rx_buffer;
-    char* tx_buffer;
+    char* tx_buffer;        // MAX_WEBSOCKET_HEADER_SIZE bytes of header headroom + tx_capacity
+    int tx_capacity;
     int buffer_size;
     int rx_retry;
     bool last_fin;
     volc_ws_opcode_e last_opcode;
-    int payload_len;
-    int payload_offset;
+    int64_t payload_len;
+    int64_t payload_offset;
     transport_ws_t* ws_transport;
     int sockfd;
     int is_tls;
+    volc_sock_opt_t sock_opt;
 #if defined(CONFIG_WEBSOCKET_TLS)
     MbedTLSSession* ssl;
+    struct tls_shared* tls_shared;  // reference on the shared tls context
 #endif
     void* user_context;
     volc_ws_event_handler_t ws_event_handler;
-    hal_mutex_t mutex;
+    volc_ws_rx_sink_t rx_sink;
+    hal_mutex_t mutex;      // tx: serializes writers and the socket close, the reader never holds it
+    hal_mutex_t ssl_mutex;  // a single mbedtls call, shared by the reader and the writer
     hal_tid_t tid;
     ws_stats_t stats;
+#if defined(CONFIG_WEBSOCKET_DEFLATE)
+    volc_ws_deflate_config_t deflate_config;
+    struct ws_deflate* deflate;         // set while the extension is negotiated
+#endif
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+    struct volc_ws_reactor_loop* loop;  // NULL when served by its own task
+    int loop_fd;                        // fd watched by the loop, -1 if none
+    bool loop_readable;
+    bool loop_want_write;               // loop_fd is watched for POLLOUT as well
+    bool loop_connecting;               // owned by the loop's connect worker until it clears this
+    volc_ws_state_e loop_state;
+    uint64_t loop_state_ms;
+#endif
 } volc_ws_client_t;
 
 typedef struct {
@@ -119,20 +262,13 @@ typedef struct {
     const char* headers;
     //	bool						disable_pingpong_discon;
     volc_ws_event_handler_t ws_event_handler;
+    volc_ws_rx_sink_t rx_sink;          // optional
+    volc_ws_reconnect_config_t reconnect;
+    volc_ws_keepalive_config_t keepalive;
+    volc_sock_opt_t sock_opt;           // applied to every connection, before connect()
+    volc_ws_deflate_config_t deflate;   // ignored unless built with CONFIG_WEBSOCKET_DEFLATE
 } volc_ws_config_t;
 
-/**
- * @brief Websocket event data
- */
-typedef struct {
-    char* data_ptr;
-    int data_len;
-    bool fin;
-    uint8_t op_code;
-    int payload_len;
-    int payload_offset;
-} volc_ws_event_data_t;
-
 volc_ws_client_t* volc_ws_client_init(const volc_ws_config_t* input);
 int volc_ws_client_destroy(volc_ws_client_t* client);
 #if defined(PLATFORM_MACOS)
@@ -143,7 +279,29 @@ void volc_ws_client_task(void* thread_param);
 int volc_ws_client_start(volc_ws_client_t* client);
 int volc_ws_client_stop(volc_ws_client_t* client);
 
+#if defined(CONFIG_WEBSOCKET_REACTOR)
+/**
+ * @brief event loop threads that serve many clients each, instead of one
+ *        task per client. Uses epoll on linux and poll elsewhere.
+ *
+ * @param threads number of loop threads, clients go to the least loaded one.
+ */
+volc_ws_reactor_t* volc_ws_reactor_create(int threads);
+
+/**
+ * @brief every client started on the reactor has to be stopped before.
+ */
+void volc_ws_reactor_destroy(volc_ws_reactor_t* reactor);
+
+/**
+ * @brief like volc_ws_client_start(), but run the client on a reactor thread.
+ *        Stop it with volc_ws_client_stop() as usual.
+ */
+int volc_ws_client_start_on(volc_ws_client_t* client, volc_ws_reactor_t* reactor);
+#endif
+
 int volc_ws_client_send_text(volc_ws_client_t* client, const char* data, int len, int timeout);
+int volc_ws_client_send_text_with_writer(volc_ws_client_t* client, volc_ws_payload_writer_t writer, void* ctx, int timeout);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,60 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "ws_mask.h"
+
+#include <string.h>
+
+/*
+ * The masking kernel is picked at build time from the target flags, the
+ * 8 byte and byte loops below it finish whatever the vector loop leaves.
+ */
+#if !defined(WS_MASK_FORCE_SCALAR)
+#if defined(__SSE2__)
+#define WS_MASK_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define WS_MASK_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/*
+ * The key repeats every 4 bytes, so once rotated to offset and widened to
+ * 16 / 8 bytes it fits every block and only the tail goes byte by byte.
+ */
+void ws_mask_copy(char* dst, const char* src, int len, const char* mask, uint64_t offset)
+{
+    char key[4];
+    uint32_t key32 = 0;
+    uint64_t key64 = 0;
+    uint64_t v = 0;
+    int i = 0;
+
+    for (i = 0; i < 4; i++) {
+        key[i] = mask[(offset + i) & 3];
+    }
+    memcpy(&key32, key, 4);
+    key64 = ((uint64_t) key32 << 32) | key32;
+    i = 0;
+#if defined(WS_MASK_SSE2)
+    __m128i key128 = _mm_set1_epi32((int) key32);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(block, key128));
+    }
+#elif defined(WS_MASK_NEON)
+    uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8((uint8_t*) (dst + i), veorq_u8(vld1q_u8((const uint8_t*) (src + i)), key128));
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&v, src + i, 8);
+        v ^= key64;
+        memcpy(dst + i, &v, 8);
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
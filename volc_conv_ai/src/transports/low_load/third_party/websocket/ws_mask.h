@@ -0,0 +1,23 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __WS_MASK_H__
+#define __WS_MASK_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief dst[i] = src[i] ^ mask[(offset + i) % 4], dst may be src. offset is
+ *        where src starts in the frame payload, so a payload that arrives in
+ *        pieces is unmasked piece by piece.
+ */
+void ws_mask_copy(char* dst, const char* src, int len, const char* mask, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __WS_MASK_H__ */
@@ -3,7 +3,393 @@
 
 #include "util/volc_base64.h"
 
-#include <mbedtls/base64.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Block kernels are picked at build time from the target flags, anything
+ * they cannot handle (tail, padding, escapes) falls through to the scalar
+ * code below, so every path produces exactly the same output.
+ */
+#if !defined(VOLC_BASE64_FORCE_SCALAR)
+#if defined(__AVX2__)
+#define VOLC_BASE64_AVX2
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#define VOLC_BASE64_SSSE3
+#include <tmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define VOLC_BASE64_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#define BASE64_INVALID 0xFF
+
+static const char s_base64_enc_map[64] = {
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+    'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+    'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+    'w', 'x', 'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/',
+};
+
+// alphabet only, '=', line breaks and json escapes are handled by __decode
+static const uint8_t s_base64_dec_map[256] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,
+     52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,
+    255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,
+    255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+     41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+
+#if defined(VOLC_BASE64_SSSE3) || defined(VOLC_BASE64_AVX2)
+/*
+ * 12 bytes -> 16 six bit indices -> 16 chars, see
+ * http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+ */
+static inline __m128i __enc_reshuffle_128(__m128i in) {
+    __m128i t0, t1, t2, t3;
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+static inline __m128i __enc_translate_128(__m128i in) {
+    const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+    indices = _mm_sub_epi8(indices, mask);
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+}
+
+/*
+ * 16 chars -> 12 bytes, returns false if the block holds anything but the
+ * 64 alphabet chars. See http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html
+ */
+static inline bool __dec_block_128(const uint8_t* src, uint8_t* dst) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    __m128i str = _mm_loadu_si128((const __m128i*)src);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i roll;
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0) {
+        return false;
+    }
+    roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+    str = _mm_add_epi8(str, roll);
+    str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+    str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+    str = _mm_shuffle_epi8(str, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i*)dst, str);
+    return true;
+}
+#endif
+
+#if defined(VOLC_BASE64_AVX2)
+static inline __m256i __enc_reshuffle_256(__m256i in) {
+    __m256i t0, t1, t2, t3;
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(t1, t3);
+}
+
+static inline __m256i __enc_translate_256(__m256i in) {
+    const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+                                         65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+    __m256i mask = _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25));
+    indices = _mm256_sub_epi8(indices, mask);
+    return _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, indices));
+}
+
+static inline bool __dec_block_256(const uint8_t* src, uint8_t* dst) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    __m256i str = _mm256_loadu_si256((const __m256i*)src);
+    __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+    __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+    __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    __m256i roll;
+    if (!_mm256_testz_si256(lo, hi)) {
+        return false;
+    }
+    roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+    str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+    str = _mm256_shuffle_epi8(str, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                    2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    str = _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i*)dst, str);
+    return true;
+}
+#endif
+
+#if defined(VOLC_BASE64_NEON)
+static inline uint8x16x4_t __neon_load_table(const uint8_t* table) {
+    uint8x16x4_t t;
+    t.val[0] = vld1q_u8(table);
+    t.val[1] = vld1q_u8(table + 16);
+    t.val[2] = vld1q_u8(table + 32);
+    t.val[3] = vld1q_u8(table + 48);
+    return t;
+}
+
+static inline uint8x16_t __neon_dec_lookup(uint8x16x4_t lo, uint8x16x4_t hi, uint8x16_t c) {
+    // chars < 64 hit lo, 64..127 hit hi, >= 128 keep their high bit and are rejected
+    uint8x16_t v = vqtbl4q_u8(lo, c);
+    v = vqtbx4q_u8(v, hi, vsubq_u8(c, vdupq_n_u8(64)));
+    return vorrq_u8(v, vandq_u8(c, vdupq_n_u8(0x80)));
+}
+#endif
+
+/*
+ * Encode as many whole blocks as the vector kernel handles, returns the
+ * number of input bytes consumed, *out is advanced past the written chars.
+ */
+static size_t __encode_blocks(uint8_t** out, uint8_t* out_end, const uint8_t* src, size_t slen) {
+    const uint8_t* in = src;
+    const uint8_t* in_end = src + slen;
+    uint8_t* o = *out;
+#if defined(VOLC_BASE64_AVX2)
+    while (in_end - in >= 28 && out_end - o >= 32) {
+        __m256i str = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)in)),
+                                              _mm_loadu_si128((const __m128i*)(in + 12)), 1);
+        _mm256_storeu_si256((__m256i*)o, __enc_translate_256(__enc_reshuffle_256(str)));
+        in += 24;
+        o += 32;
+    }
+#endif
+#if defined(VOLC_BASE64_SSSE3) || defined(VOLC_BASE64_AVX2)
+    while (in_end - in >= 16 && out_end - o >= 16) {
+        __m128i str = _mm_loadu_si128((const __m128i*)in);
+        _mm_storeu_si128((__m128i*)o, __enc_translate_128(__enc_reshuffle_128(str)));
+        in += 12;
+        o += 16;
+    }
+#elif defined(VOLC_BASE64_NEON)
+    const uint8x16x4_t table = __neon_load_table((const uint8_t*)s_base64_enc_map);
+    const uint8x16_t mask_3f = vdupq_n_u8(0x3f);
+    while (in_end - in >= 48 && out_end - o >= 64) {
+        uint8x16x3_t str = vld3q_u8(in);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(str.val[0], 2);
+        idx.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(str.val[1], 4), vshlq_n_u8(str.val[0], 4)), mask_3f);
+        idx.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(str.val[2], 6), vshlq_n_u8(str.val[1], 2)), mask_3f);
+        idx.val[3] = vandq_u8(str.val[2], mask_3f);
+        idx.val[0] = vqtbl4q_u8(table, idx.val[0]);
+        idx.val[1] = vqtbl4q_u8(table, idx.val[1]);
+        idx.val[2] = vqtbl4q_u8(table, idx.val[2]);
+        idx.val[3] = vqtbl4q_u8(table, idx.val[3]);
+        vst4q_u8(o, idx);
+        in += 48;
+        o += 64;
+    }
+#else
+    // word at a time: two 24 bit groups, 8 chars per iteration
+    while (in_end - in >= 6 && out_end - o >= 8) {
+        uint32_t a = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+        uint32_t b = ((uint32_t)in[3] << 16) | ((uint32_t)in[4] << 8) | in[5];
+        o[0] = s_base64_enc_map[(a >> 18) & 0x3f];
+        o[1] = s_base64_enc_map[(a >> 12) & 0x3f];
+        o[2] = s_base64_enc_map[(a >> 6) & 0x3f];
+        o[3] = s_base64_enc_map[a & 0x3f];
+        o[4] = s_base64_enc_map[(b >> 18) & 0x3f];
+        o[5] = s_base64_enc_map[(b >> 12) & 0x3f];
+        o[6] = s_base64_enc_map[(b >> 6) & 0x3f];
+        o[7] = s_base64_enc_map[b & 0x3f];
+        in += 6;
+        o += 8;
+    }
+#endif
+    (void)out_end;
+    *out = o;
+    return in - src;
+}
+
+/*
+ * Decode whole blocks of alphabet chars, stops at the first block holding
+ * anything else (padding, escapes, white space) and leaves it to the scalar
+ * loop. Stores may run past the decoded bytes up to the end of the block, so
+ * out_end must bound what is writable; for in place decoding every store
+ * lands on input that has already been consumed.
+ */
+static size_t __decode_blocks(uint8_t** out, uint8_t* out_end, const uint8_t* src, size_t slen) {
+    const uint8_t* in = src;
+    const uint8_t* in_end = src + slen;
+    uint8_t* o = *out;
+#if defined(VOLC_BASE64_AVX2)
+    while (in_end - in >= 32 && out_end - o >= 32) {
+        if (!__dec_block_256(in, o)) {
+            break;
+        }
+        in += 32;
+        o += 24;
+    }
+#endif
+#if defined(VOLC_BASE64_SSSE3) || defined(VOLC_BASE64_AVX2)
+    while (in_end - in >= 16 && out_end - o >= 16) {
+        if (!__dec_block_128(in, o)) {
+            break;
+        }
+        in += 16;
+        o += 12;
+    }
+#elif defined(VOLC_BASE64_NEON)
+    const uint8x16x4_t lo = __neon_load_table(s_base64_dec_map);
+    const uint8x16x4_t hi = __neon_load_table(s_base64_dec_map + 64);
+    while (in_end - in >= 64 && out_end - o >= 48) {
+        uint8x16x4_t str = vld4q_u8(in);
+        uint8x16x3_t dec;
+        uint8x16_t a = __neon_dec_lookup(lo, hi, str.val[0]);
+        uint8x16_t b = __neon_dec_lookup(lo, hi, str.val[1]);
+        uint8x16_t c = __neon_dec_lookup(lo, hi, str.val[2]);
+        uint8x16_t d = __neon_dec_lookup(lo, hi, str.val[3]);
+        if (vmaxvq_u8(vorrq_u8(vorrq_u8(a, b), vorrq_u8(c, d))) & 0x80) {
+            break;
+        }
+        dec.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+        dec.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+        dec.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+        vst3q_u8(o, dec);
+        in += 64;
+        o += 48;
+    }
+#else
+    // 8 chars per iteration, one validity branch for the whole group
+    while (in_end - in >= 8 && out_end - o >= 6) {
+        uint32_t a0 = s_base64_dec_map[in[0]], a1 = s_base64_dec_map[in[1]];
+        uint32_t a2 = s_base64_dec_map[in[2]], a3 = s_base64_dec_map[in[3]];
+        uint32_t b0 = s_base64_dec_map[in[4]], b1 = s_base64_dec_map[in[5]];
+        uint32_t b2 = s_base64_dec_map[in[6]], b3 = s_base64_dec_map[in[7]];
+        uint32_t a, b;
+        if ((a0 | a1 | a2 | a3 | b0 | b1 | b2 | b3) & 0x80) {
+            break;
+        }
+        a = (a0 << 18) | (a1 << 12) | (a2 << 6) | a3;
+        b = (b0 << 18) | (b1 << 12) | (b2 << 6) | b3;
+        o[0] = (uint8_t)(a >> 16);
+        o[1] = (uint8_t)(a >> 8);
+        o[2] = (uint8_t)a;
+        o[3] = (uint8_t)(b >> 16);
+        o[4] = (uint8_t)(b >> 8);
+        o[5] = (uint8_t)b;
+        in += 8;
+        o += 6;
+    }
+#endif
+    *out = o;
+    return in - src;
+}
+
+/*
+ * Accepts what mbedtls_base64_decode accepts: '=' only at the end and at
+ * most two, a multiple of 4 chars once line breaks are dropped, spaces only
+ * at the end of a line or of the input. json additionally takes the "\/"
+ * escape as '/', a lone '\' is still rejected.
+ */
+static int __decode(uint8_t* dst, uint8_t* dst_end, size_t* olen, const uint8_t* src, size_t slen, bool json) {
+    uint8_t* out = dst;
+    uint32_t acc = 0;
+    int n = 0;
+    int pad = 0;
+    size_t i = 0;
+    size_t j = 0;
+    uint8_t v = 0;
+
+    *olen = 0;
+    i = __decode_blocks(&out, dst_end, src, slen);
+    for (; i < slen; i++) {
+        v = s_base64_dec_map[src[i]];
+        if (v == BASE64_INVALID) {
+            if (src[i] == '=') {
+                if (++pad > 2) {
+                    return -1;
+                }
+                continue;
+            }
+            if (src[i] == ' ') {
+                j = i;
+                while (j < slen && src[j] == ' ') {
+                    j++;
+                }
+                if (j < slen && src[j] != '\n' && !(src[j] == '\r' && j + 1 < slen && src[j + 1] == '\n')) {
+                    return -1;
+                }
+                i = j - 1;
+                continue;
+            }
+            if (src[i] == '\n' || (src[i] == '\r' && i + 1 < slen && src[i + 1] == '\n')) {
+                continue;
+            }
+            if (!json || src[i] != '\\' || i + 1 >= slen || src[i + 1] != '/') {
+                return -1;
+            }
+            v = s_base64_dec_map[src[++i]];
+        }
+        if (pad > 0) {
+            return -1;
+        }
+        acc = (acc << 6) | v;
+        if (++n == 4) {
+            if (dst_end - out < 3) {
+                return -1;
+            }
+            out[0] = (uint8_t)(acc >> 16);
+            out[1] = (uint8_t)(acc >> 8);
+            out[2] = (uint8_t)acc;
+            out += 3;
+            n = 0;
+            acc = 0;
+        }
+    }
+    if (n == 1 || (n + pad) % 4 != 0 || dst_end - out < n - 1) {
+        return -1;
+    }
+    if (n == 2) {
+        *out++ = (uint8_t)(acc >> 4);
+    } else if (n == 3) {
+        *out++ = (uint8_t)(acc >> 10);
+        *out++ = (uint8_t)(acc >> 2);
+    }
+    *olen = out - dst;
+    return 0;
+}
 
 int volc_base64_encoded_length(int len) {
     return (len + 2) / 3 * 4 + 1; // +1 for null terminator
@@ -20,15 +406,47 @@ int volc_base64_decoded_length(const uint8_t* to_decode, int len) {
 }
 
 void volc_base64_encode(unsigned char *dst, size_t dlen, size_t* olen, const unsigned char *src, size_t slen) {
-    int ret = mbedtls_base64_encode(dst, dlen, olen, src, slen);
-    if (ret != 0) {
-        *olen = 0; // If encoding fails, set output length to 0
+    size_t need = (slen + 2) / 3 * 4;
+    uint8_t* out = dst;
+    size_t i = 0;
+    uint32_t acc = 0;
+
+    *olen = 0;
+    if (NULL == dst || dlen < need + 1) {
+        return; // If encoding fails, set output length to 0
     }
+    i = __encode_blocks(&out, dst + need, src, slen);
+    for (; i + 3 <= slen; i += 3) {
+        acc = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+        out[0] = s_base64_enc_map[(acc >> 18) & 0x3f];
+        out[1] = s_base64_enc_map[(acc >> 12) & 0x3f];
+        out[2] = s_base64_enc_map[(acc >> 6) & 0x3f];
+        out[3] = s_base64_enc_map[acc & 0x3f];
+        out += 4;
+    }
+    if (i < slen) {
+        acc = (uint32_t)src[i] << 16;
+        if (i + 1 < slen) {
+            acc |= (uint32_t)src[i + 1] << 8;
+        }
+        out[0] = s_base64_enc_map[(acc >> 18) & 0x3f];
+        out[1] = s_base64_enc_map[(acc >> 12) & 0x3f];
+        out[2] = i + 1 < slen ? s_base64_enc_map[(acc >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    *out = 0;
+    *olen = out - dst;
 }
 
 void volc_base64_decode(unsigned char *dst, size_t dlen, size_t* olen, const unsigned char *src, size_t slen) {
-    int ret = mbedtls_base64_decode(dst, dlen, olen, src, slen);
-    if (ret != 0) {
+    if (NULL == dst || __decode(dst, dst + dlen, olen, src, slen, false) != 0) {
         *olen = 0; // If decoding fails, set output length to 0
     }
-}
\ No newline at end of file
+}
+
+int volc_base64_decode_inplace(unsigned char *dst, size_t* olen, const unsigned char *src, size_t slen) {
+    // in place the output never overtakes the input, so all of src is writable
+    uint8_t* dst_end = dst <= src ? (uint8_t*)src + slen : dst + slen / 4 * 3 + (slen % 4) * 3 / 4;
+    return __decode(dst, dst_end, olen, src, slen, true);
+}
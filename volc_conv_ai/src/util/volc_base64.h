@@ -18,6 +18,16 @@ void volc_base64_encode(unsigned char *dst, size_t dlen, size_t* olen, const uns
 
 void volc_base64_decode(unsigned char *dst, size_t dlen, size_t* olen, const unsigned char *src, size_t slen);
 
+/**
+ * @brief decode without a scratch buffer, dst may alias src as long as dst <= src.
+ *        Same input rules as volc_base64_decode (and mbedtls_base64_decode),
+ *        plus the json "\/" escape so a payload can be decoded as is.
+ *
+ * @return 0: success.
+ *        -1: invalid base64 input.
+ */
+int volc_base64_decode_inplace(unsigned char *dst, size_t* olen, const unsigned char *src, size_t slen);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,36 +5,255 @@
 
 #include "webclient.h"
 #include "tls_certificate.h"
+#include "volc_platform.h"
 #include "util/volc_list.h"
 #include "util/volc_log.h"
+#include "util/volc_net.h"
+
+#define VOLC_HTTP_POOL_SIZE 2
+// below the 60 s idle timeout common on servers and load balancers
+#define VOLC_HTTP_IDLE_MS 30000
+#define VOLC_HTTP_ORIGIN_MAX 128
+
+typedef struct {
+    char origin[VOLC_HTTP_ORIGIN_MAX];    // scheme://host:port, empty when the slot is free
+    struct webclient_session* session;
+    uint64_t expire_ms;
+} http_conn_t;
+
+static http_conn_t s_http_pool[VOLC_HTTP_POOL_SIZE];
+static hal_mutex_t s_http_mutex = NULL;
+static volc_http_stats_t s_http_stats;
+
+static hal_mutex_t __http_mutex(void) {
+    hal_mutex_t mutex = __atomic_load_n(&s_http_mutex, __ATOMIC_ACQUIRE);
+    hal_mutex_t expected = NULL;
+    if (mutex) {
+        return mutex;
+    }
+    mutex = hal_mutex_create();
+    if (NULL == mutex) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&s_http_mutex, &expected, mutex, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // another thread won the race
+        hal_mutex_destroy(mutex);
+        mutex = expected;
+    }
+    return mutex;
+}
+
+// the part of uri before the path
+static int __http_origin(const char* uri, char* origin) {
+    const char* host = strstr(uri, "://");
+    const char* path = NULL;
+    size_t len = 0;
+    if (NULL == host) {
+        return -1;
+    }
+    path = strchr(host + 3, '/');
+    len = path ? (size_t)(path - uri) : strlen(uri);
+    if (len >= VOLC_HTTP_ORIGIN_MAX) {
+        return -1;
+    }
+    memcpy(origin, uri, len);
+    origin[len] = '\0';
+    return 0;
+}
+
+// an idle connection to origin, expired ones are closed on the way
+static struct webclient_session* __http_pool_take(const char* origin) {
+    hal_mutex_t mutex = __http_mutex();
+    struct webclient_session* expired[VOLC_HTTP_POOL_SIZE] = {0};
+    struct webclient_session* session = NULL;
+    uint64_t now = hal_get_time_ms();
+    int i = 0;
+
+    if (NULL == mutex) {
+        return NULL;
+    }
+    hal_mutex_lock(mutex);
+    for (i = 0; i < VOLC_HTTP_POOL_SIZE; i++) {
+        http_conn_t* conn = &s_http_pool[i];
+        if (NULL == conn->session) {
+            continue;
+        }
+        if (now >= conn->expire_ms) {
+            expired[i] = conn->session;
+            s_http_stats.expired++;
+        } else if (NULL == session && 0 == strcmp(conn->origin, origin)) {
+            session = conn->session;
+        } else {
+            continue;
+        }
+        conn->session = NULL;
+        conn->origin[0] = '\0';
+    }
+    hal_mutex_unlock(mutex);
+
+    // closing may write a TLS close_notify, not under the lock
+    for (i = 0; i < VOLC_HTTP_POOL_SIZE; i++) {
+        if (expired[i]) {
+            webclient_close(expired[i]);
+        }
+    }
+    return session;
+}
+
+// park session for the next request to origin, or close it
+static void __http_pool_put(const char* origin, struct webclient_session* session) {
+    hal_mutex_t mutex = __http_mutex();
+    struct webclient_session* evicted = NULL;
+    http_conn_t* slot = NULL;
+    int idle_ms = VOLC_HTTP_IDLE_MS;
+    int i = 0;
+
+    if (NULL == mutex || !webclient_keep_alive(session)) {
+        webclient_close(session);
+        return;
+    }
+    // leave a second of margin to the timeout the server announced
+    if (session->keep_alive_ms > 0 && session->keep_alive_ms - 1000 < idle_ms) {
+        idle_ms = session->keep_alive_ms - 1000;
+    }
+    if (idle_ms <= 0) {
+        webclient_close(session);
+        return;
+    }
+
+    hal_mutex_lock(mutex);
+    for (i = 0; i < VOLC_HTTP_POOL_SIZE; i++) {
+        http_conn_t* conn = &s_http_pool[i];
+        if (NULL == conn->session) {
+            slot = conn;
+            break;
+        }
+        if (NULL == slot || conn->expire_ms < slot->expire_ms) {
+            slot = conn;
+        }
+    }
+    evicted = slot->session;
+    slot->session = session;
+    slot->expire_ms = hal_get_time_ms() + idle_ms;
+    snprintf(slot->origin, sizeof(slot->origin), "%s", origin);
+    hal_mutex_unlock(mutex);
+
+    if (evicted) {
+        webclient_close(evicted);
+    }
+}
+
+void volc_http_pool_flush(void) {
+    hal_mutex_t mutex = __atomic_load_n(&s_http_mutex, __ATOMIC_ACQUIRE);
+    struct webclient_session* idle[VOLC_HTTP_POOL_SIZE] = {0};
+    int i = 0;
+
+    if (NULL == mutex) {
+        // nothing was ever pooled
+        return;
+    }
+    hal_mutex_lock(mutex);
+    for (i = 0; i < VOLC_HTTP_POOL_SIZE; i++) {
+        idle[i] = s_http_pool[i].session;
+        s_http_pool[i].session = NULL;
+        s_http_pool[i].origin[0] = '\0';
+    }
+    hal_mutex_unlock(mutex);
+
+    for (i = 0; i < VOLC_HTTP_POOL_SIZE; i++) {
+        if (idle[i]) {
+            webclient_close(idle[i]);
+        }
+    }
+}
+
+static void __http_stats_count(uint32_t* counter) {
+    hal_mutex_t mutex = __http_mutex();
+    if (mutex) {
+        hal_mutex_lock(mutex);
+    }
+    (*counter)++;
+    if (mutex) {
+        hal_mutex_unlock(mutex);
+    }
+}
 
 char* volc_http_post(const char* uri, const char* post_data, int data_len)
 {
     struct webclient_session* session = NULL;
     char* buffer = NULL;
-    int resp_status;
+    int resp_status = 0;
     size_t res_len = 0;
+    char origin[VOLC_HTTP_ORIGIN_MAX] = {0};
+    bool pooled = (0 == __http_origin(uri, origin));
+    int attempt = 0;
+    volc_sock_opt_t sock_opt = { .no_delay = true };
 
-    /* create webclient session and set header response size */
-    session = webclient_session_create(2048, GLOBAL_ROOT_CERT, GLOBAL_ROOT_CERT_LEN);
-    if (session == NULL) {
-        goto err_out_label;
-    }
+    __http_stats_count(&s_http_stats.requests);
+    for (attempt = 0; attempt < 2; attempt++) {
+        session = pooled ? __http_pool_take(origin) : NULL;
+        if (session) {
+            webclient_session_reset(session);
+        } else {
+            /* create webclient session and set header response size */
+            session = webclient_session_create(2048, GLOBAL_ROOT_CERT, GLOBAL_ROOT_CERT_LEN);
+            if (session == NULL) {
+                goto err_out_label;
+            }
+            // header and body go out in separate writes, Nagle would hold the body for the ACK
+            webclient_set_sock_opt(session, &sock_opt);
+        }
 
-    webclient_header_fields_add(session, "Content-Type: application/json\r\n");
-    webclient_header_fields_add(session, "Content-Length: %d\r\n", strlen(post_data));
+        webclient_header_fields_add(session, "Content-Type: application/json\r\n");
+        webclient_header_fields_add(session, "Content-Length: %d\r\n", strlen(post_data));
+        webclient_header_fields_add(session, "Connection: keep-alive\r\n");
 
-    /* send POST request by default header */
-    if ((resp_status = webclient_post(session, uri, post_data, data_len)) != 200) {
+        /* send POST request by default header */
+        resp_status = webclient_post(session, uri, post_data, data_len);
+        // not idempotent: only a request the server cannot have seen goes again, never after a timeout
+        if (resp_status > 0 || !session->reused || !session->retry_safe) {
+            break;
+        }
+        // the server dropped the idle connection before any answer, send again on a fresh one
+        LOGW("kept connection to %s went stale, retry", origin);
+        __http_stats_count(&s_http_stats.stale_retries);
+        webclient_close(session);
+        session = NULL;
+    }
+    if (session && session->reused) {
+        __http_stats_count(&s_http_stats.reused);
+    }
+
+    if (resp_status != 200) {
         LOGE("webclient POST request failed, response(%d) error.\n", resp_status);
     }
 
-    webclient_response(session, (void**) &buffer, &res_len);
+    if (session) {
+        webclient_response(session, (void**) &buffer, &res_len);
+    }
     LOGD("url: %s, request: %s, response: %s", uri, post_data, buffer);
 err_out_label:
     if (session) {
-        webclient_close(session);
+        if (pooled && resp_status > 0) {
+            __http_pool_put(origin, session);
+        } else {
+            webclient_close(session);
+        }
     }
 
     return buffer;
 }
+
+void volc_http_get_stats(volc_http_stats_t* stats) {
+    hal_mutex_t mutex = __http_mutex();
+    if (NULL == stats) {
+        return;
+    }
+    if (mutex) {
+        hal_mutex_lock(mutex);
+    }
+    *stats = s_http_stats;
+    if (mutex) {
+        hal_mutex_unlock(mutex);
+    }
+}
@@ -4,12 +4,35 @@
 #ifndef __CONV_AI_SRC_UTIL_VOLC_HTTP_H__
 #define __CONV_AI_SRC_UTIL_VOLC_HTTP_H__
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct {
+    uint32_t requests;
+    uint32_t reused;            // sent on a kept connection, one TCP + TLS handshake avoided each
+    uint32_t stale_retries;     // a kept connection was closed by the server, sent again on a new one
+    uint32_t expired;           // idle connections closed by the pool
+} volc_http_stats_t;
+
+/**
+ * @brief POST to uri. Connections are kept alive and pooled per server, the
+ *        next request to the same scheme://host:port reuses an idle one.
+ *
+ * @return the response body, release with hal_free(). NULL on failure.
+ */
 char* volc_http_post(const char* uri, const char* post_data, int data_len);
 
+/**
+ * @brief close every idle pooled connection, process wide. Requests in
+ *        flight are not affected and the pool fills again on demand.
+ */
+void volc_http_pool_flush(void);
+
+void volc_http_get_stats(volc_http_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,387 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "util/volc_net.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "volc_platform.h"
+#include "util/volc_log.h"
+
+#define VOLC_DNS_CACHE_ENTRIES      4
+#define VOLC_DNS_CACHE_HOST_MAX     128
+#define VOLC_DNS_TTL_MS_DEFAULT     (60 * 1000)
+#define VOLC_NET_ATTEMPT_DELAY_MS   250     // RFC 8305 connection attempt delay
+#define VOLC_NET_CONNECT_TIMEOUT_MS (10 * 1000)
+
+typedef struct {
+    char host[VOLC_DNS_CACHE_HOST_MAX];
+    struct sockaddr_storage addrs[VOLC_NET_MAX_ADDRS];
+    int count;
+    uint64_t expire_ms;
+} volc_dns_entry_t;
+
+static volc_dns_entry_t s_dns_cache[VOLC_DNS_CACHE_ENTRIES];
+static hal_mutex_t s_dns_mutex = NULL;
+static int s_dns_ttl_ms = VOLC_DNS_TTL_MS_DEFAULT;
+
+static int __sock_opt_set(int fd, int level, int name, int value, const char* tag) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+        LOGW("[sock=%d] setsockopt %s=%d failed: %s", fd, tag, value, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int volc_sock_opt_apply(int fd, int family, const volc_sock_opt_t* opt) {
+    int ret = 0;
+    if (fd < 0 || NULL == opt) {
+        return -1;
+    }
+    if (opt->no_delay) {
+        ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (opt->send_buffer > 0) {
+        ret |= __sock_opt_set(fd, SOL_SOCKET, SO_SNDBUF, opt->send_buffer, "SO_SNDBUF");
+    }
+    if (opt->recv_buffer > 0) {
+        ret |= __sock_opt_set(fd, SOL_SOCKET, SO_RCVBUF, opt->recv_buffer, "SO_RCVBUF");
+    }
+    if (opt->user_timeout_ms > 0) {
+#if defined(TCP_USER_TIMEOUT)
+        ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, opt->user_timeout_ms, "TCP_USER_TIMEOUT");
+#elif defined(TCP_RXT_CONNDROPTIME)
+        ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_RXT_CONNDROPTIME, (opt->user_timeout_ms + 999) / 1000, "TCP_RXT_CONNDROPTIME");
+#else
+        LOGW("[sock=%d] no TCP_USER_TIMEOUT on this stack, ignored", fd);
+#endif
+    }
+    if (opt->keepalive_idle_s > 0) {
+        ret |= __sock_opt_set(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE)
+        ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_KEEPIDLE, opt->keepalive_idle_s, "TCP_KEEPIDLE");
+#elif defined(TCP_KEEPALIVE)
+        // macOS names the idle time TCP_KEEPALIVE
+        ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_KEEPALIVE, opt->keepalive_idle_s, "TCP_KEEPALIVE");
+#endif
+#if defined(TCP_KEEPINTVL)
+        if (opt->keepalive_interval_s > 0) {
+            ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_KEEPINTVL, opt->keepalive_interval_s, "TCP_KEEPINTVL");
+        }
+#endif
+#if defined(TCP_KEEPCNT)
+        if (opt->keepalive_count > 0) {
+            ret |= __sock_opt_set(fd, IPPROTO_TCP, TCP_KEEPCNT, opt->keepalive_count, "TCP_KEEPCNT");
+        }
+#endif
+    }
+    if (opt->tos > 0) {
+#if defined(IPV6_TCLASS)
+        if (AF_INET6 == family) {
+            ret |= __sock_opt_set(fd, IPPROTO_IPV6, IPV6_TCLASS, opt->tos, "IPV6_TCLASS");
+        } else
+#endif
+        {
+            ret |= __sock_opt_set(fd, IPPROTO_IP, IP_TOS, opt->tos, "IP_TOS");
+        }
+    }
+    return ret ? -1 : 0;
+}
+
+static hal_mutex_t __dns_mutex(void) {
+    hal_mutex_t mutex = __atomic_load_n(&s_dns_mutex, __ATOMIC_ACQUIRE);
+    hal_mutex_t expected = NULL;
+    if (mutex) {
+        return mutex;
+    }
+    mutex = hal_mutex_create();
+    if (NULL == mutex) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n(&s_dns_mutex, &expected, mutex, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // another caller got there first
+        hal_mutex_destroy(mutex);
+        mutex = expected;
+    }
+    return mutex;
+}
+
+static socklen_t __addr_len(const struct sockaddr_storage* addr) {
+    return AF_INET6 == addr->ss_family ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+static void __addr_set_port(struct sockaddr_storage* addr, int port) {
+    if (AF_INET6 == addr->ss_family) {
+        ((struct sockaddr_in6*) addr)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in*) addr)->sin_port = htons(port);
+    }
+}
+
+static volc_dns_entry_t* __dns_find(const char* host, uint64_t now) {
+    int i = 0;
+    for (i = 0; i < VOLC_DNS_CACHE_ENTRIES; i++) {
+        if (s_dns_cache[i].count > 0 && now < s_dns_cache[i].expire_ms && 0 == strcmp(s_dns_cache[i].host, host)) {
+            return &s_dns_cache[i];
+        }
+    }
+    return NULL;
+}
+
+// the family the resolver put first leads, then one of each in turn
+static int __dns_lookup(const char* host, struct sockaddr_storage* addrs, int max) {
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    struct addrinfo* ai = NULL;
+    struct sockaddr_storage v4[VOLC_NET_MAX_ADDRS];
+    struct sockaddr_storage v6[VOLC_NET_MAX_ADDRS];
+    int n4 = 0;
+    int n6 = 0;
+    int i4 = 0;
+    int i6 = 0;
+    int count = 0;
+    bool v6_first = false;
+    int ret = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((ret = getaddrinfo(host, NULL, &hints, &result)) != 0 || NULL == result) {
+        LOGE("getaddrinfo %s failed: %d", host, ret);
+        return -1;
+    }
+    v6_first = AF_INET6 == result->ai_family;
+    for (ai = result; ai; ai = ai->ai_next) {
+        if (AF_INET == ai->ai_family && n4 < VOLC_NET_MAX_ADDRS) {
+            memset(&v4[n4], 0, sizeof(v4[n4]));
+            memcpy(&v4[n4++], ai->ai_addr, sizeof(struct sockaddr_in));
+        } else if (AF_INET6 == ai->ai_family && n6 < VOLC_NET_MAX_ADDRS) {
+            memset(&v6[n6], 0, sizeof(v6[n6]));
+            memcpy(&v6[n6++], ai->ai_addr, sizeof(struct sockaddr_in6));
+        }
+    }
+    freeaddrinfo(result);
+    while (count < max && (i4 < n4 || i6 < n6)) {
+        if ((v6_first || i4 >= n4) && i6 < n6) {
+            addrs[count++] = v6[i6++];
+        } else {
+            addrs[count++] = v4[i4++];
+        }
+        if (i4 < n4 && i6 < n6) {
+            v6_first = !v6_first;
+        }
+    }
+    return count;
+}
+
+int volc_net_resolve(const char* host, int port, struct sockaddr_storage* addrs, int max) {
+    hal_mutex_t mutex = __dns_mutex();
+    volc_dns_entry_t* entry = NULL;
+    uint64_t now = hal_get_time_ms();
+    int ttl_ms = s_dns_ttl_ms;
+    int count = 0;
+    int i = 0;
+
+    if (NULL == host || NULL == addrs || max <= 0) {
+        return -1;
+    }
+    if (max > VOLC_NET_MAX_ADDRS) {
+        max = VOLC_NET_MAX_ADDRS;
+    }
+    if (mutex && ttl_ms > 0) {
+        hal_mutex_lock(mutex);
+        if (NULL != (entry = __dns_find(host, now))) {
+            count = entry->count < max ? entry->count : max;
+            memcpy(addrs, entry->addrs, count * sizeof(addrs[0]));
+        }
+        hal_mutex_unlock(mutex);
+    }
+    if (count > 0) {
+        LOGD("%s resolved from cache, %d addresses", host, count);
+    } else {
+        // resolved without the lock, a slow lookup must not hold back the others
+        if ((count = __dns_lookup(host, addrs, max)) <= 0) {
+            return -1;
+        }
+        if (mutex && ttl_ms > 0 && strlen(host) < VOLC_DNS_CACHE_HOST_MAX) {
+            hal_mutex_lock(mutex);
+            entry = &s_dns_cache[0];
+            for (i = 0; i < VOLC_DNS_CACHE_ENTRIES; i++) {
+                if (0 == strcmp(s_dns_cache[i].host, host)) {
+                    entry = &s_dns_cache[i];
+                    break;
+                }
+                if (s_dns_cache[i].expire_ms < entry->expire_ms) {
+                    entry = &s_dns_cache[i];
+                }
+            }
+            snprintf(entry->host, sizeof(entry->host), "%s", host);
+            memcpy(entry->addrs, addrs, count * sizeof(addrs[0]));
+            entry->count = count;
+            entry->expire_ms = now + ttl_ms;
+            hal_mutex_unlock(mutex);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        __addr_set_port(&addrs[i], port);
+    }
+    return count;
+}
+
+void volc_net_resolve_invalidate(const char* host) {
+    hal_mutex_t mutex = __dns_mutex();
+    int i = 0;
+    if (NULL == host || NULL == mutex) {
+        return;
+    }
+    hal_mutex_lock(mutex);
+    for (i = 0; i < VOLC_DNS_CACHE_ENTRIES; i++) {
+        if (0 == strcmp(s_dns_cache[i].host, host)) {
+            s_dns_cache[i].count = 0;
+            s_dns_cache[i].expire_ms = 0;
+        }
+    }
+    hal_mutex_unlock(mutex);
+}
+
+void volc_net_set_dns_ttl(int ttl_ms) {
+    s_dns_ttl_ms = 0 == ttl_ms ? VOLC_DNS_TTL_MS_DEFAULT : ttl_ms;
+}
+
+static int __set_non_blocking(int fd, bool non_blocking) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(fd, F_SETFL, flags);
+}
+
+// 1: connected already, 0: in progress, -1: failed
+static int __connect_start(const struct sockaddr_storage* addr, const volc_sock_opt_t* opt, int* fd) {
+    *fd = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (*fd < 0) {
+        LOGE("failed to create socket, family %d: %s", addr->ss_family, strerror(errno));
+        return -1;
+    }
+    if (opt) {
+        volc_sock_opt_apply(*fd, addr->ss_family, opt);
+    }
+    if (__set_non_blocking(*fd, true) != 0) {
+        goto err_out_label;
+    }
+    if (connect(*fd, (const struct sockaddr*) addr, __addr_len(addr)) == 0) {
+        return 1;
+    }
+    if (EINPROGRESS == errno) {
+        return 0;
+    }
+    LOGW("[sock=%d] connect() family %d error: %s", *fd, addr->ss_family, strerror(errno));
+err_out_label:
+    close(*fd);
+    *fd = -1;
+    return -1;
+}
+
+int volc_net_connect(const char* host, int port, const volc_sock_opt_t* opt, int timeout_ms) {
+    struct sockaddr_storage addrs[VOLC_NET_MAX_ADDRS];
+    int fds[VOLC_NET_MAX_ADDRS];
+    int count = 0;
+    int started = 0;
+    int pending = 0;
+    int winner = -1;
+    int fd = -1;
+    int i = 0;
+    int ret = 0;
+    uint64_t now = hal_get_time_ms();
+    uint64_t deadline = 0;
+    uint64_t next_start = now;
+
+    if ((count = volc_net_resolve(host, port, addrs, VOLC_NET_MAX_ADDRS)) <= 0) {
+        return -1;
+    }
+    deadline = now + (timeout_ms > 0 ? timeout_ms : VOLC_NET_CONNECT_TIMEOUT_MS);
+    for (i = 0; i < VOLC_NET_MAX_ADDRS; i++) {
+        fds[i] = -1;
+    }
+    while (winner < 0) {
+        now = hal_get_time_ms();
+        if (started < count && (0 == pending || now >= next_start)) {
+            ret = __connect_start(&addrs[started], opt, &fds[started]);
+            if (ret > 0) {
+                winner = started;
+            } else if (0 == ret) {
+                pending++;
+                next_start = now + VOLC_NET_ATTEMPT_DELAY_MS;
+            }
+            started++;
+            continue;
+        }
+        if (0 == pending || now >= deadline) {
+            break;
+        }
+        {
+            // poll(), not select(): the fd numbers of a busy process go past FD_SETSIZE
+            struct pollfd pfds[VOLC_NET_MAX_ADDRS];
+            uint64_t wake = (started < count && next_start < deadline) ? next_start : deadline;
+            int sockerr = 0;
+            socklen_t len = sizeof(sockerr);
+
+            for (i = 0; i < started; i++) {
+                // failed attempts are -1, poll() skips them
+                pfds[i].fd = fds[i];
+                pfds[i].events = POLLOUT;
+                pfds[i].revents = 0;
+            }
+            if ((ret = poll(pfds, started, (int) (wake - now))) < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                LOGE("poll() error: %s", strerror(errno));
+                break;
+            }
+            for (i = 0; i < started && ret > 0 && winner < 0; i++) {
+                if (fds[i] < 0 || 0 == pfds[i].revents) {
+                    continue;
+                }
+                len = sizeof(sockerr);
+                if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &sockerr, &len) == 0 && 0 == sockerr) {
+                    winner = i;
+                    break;
+                }
+                LOGW("[sock=%d] connect attempt %d failed: %s", fds[i], i, strerror(sockerr));
+                close(fds[i]);
+                fds[i] = -1;
+                pending--;
+                // no need to wait out the attempt delay, the next one goes now
+                next_start = hal_get_time_ms();
+            }
+        }
+    }
+    for (i = 0; i < VOLC_NET_MAX_ADDRS; i++) {
+        if (i != winner && fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    if (winner < 0) {
+        LOGE("connect to %s:%d failed, %d of %d addresses tried", host, port, started, count);
+        volc_net_resolve_invalidate(host);
+        return -1;
+    }
+    fd = fds[winner];
+    if (__set_non_blocking(fd, false) != 0) {
+        close(fd);
+        return -1;
+    }
+    LOGD("[sock=%d] connected to %s:%d, address %d of %d, family %d", fd, host, port, winner + 1, count, addrs[winner].ss_family);
+    return fd;
+}
@@ -0,0 +1,76 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __CONV_AI_SRC_UTIL_VOLC_NET_H__
+#define __CONV_AI_SRC_UTIL_VOLC_NET_H__
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief TCP socket tuning, every zero leaves the OS default in place.
+ */
+typedef struct {
+    bool no_delay;              // TCP_NODELAY, no Nagle wait behind a delayed ACK
+    int send_buffer;            // SO_SNDBUF in bytes
+    int recv_buffer;            // SO_RCVBUF in bytes
+    int user_timeout_ms;        // TCP_USER_TIMEOUT, TCP_RXT_CONNDROPTIME on macOS, no lwIP equivalent
+    int keepalive_idle_s;       // > 0 turns on TCP keepalive, idle time before the first probe
+    int keepalive_interval_s;   // between probes
+    int keepalive_count;        // unanswered probes before the connection is dropped
+    int tos;                    // IP_TOS / IPV6_TCLASS byte, DSCP << 2, e.g. 0xb8 for EF
+} volc_sock_opt_t;
+
+/**
+ * @brief apply opt to a TCP socket. Buffer sizes only take full effect
+ *        before connect(). An option the stack does not know is skipped.
+ *
+ * @param family AF_INET or AF_INET6, picks IP_TOS or IPV6_TCLASS.
+ * @return 0: every requested option was set.
+ *        -1: at least one was refused, the others are still applied.
+ */
+int volc_sock_opt_apply(int fd, int family, const volc_sock_opt_t* opt);
+
+#define VOLC_NET_MAX_ADDRS 4
+
+/**
+ * @brief resolve host through a small cache shared by every client in the
+ *        process. The addresses alternate between the two families, the one
+ *        the resolver put first leads (RFC 8305 section 4).
+ *
+ * @param addrs filled with port set, at most max of them.
+ * @return number of addresses, <= 0 on failure.
+ */
+int volc_net_resolve(const char* host, int port, struct sockaddr_storage* addrs, int max);
+
+/**
+ * @brief forget host, the next volc_net_resolve() asks the resolver again.
+ */
+void volc_net_resolve_invalidate(const char* host);
+
+/**
+ * @brief how long a cached answer is used. getaddrinfo() does not report the
+ *        record TTL, so a fixed one stands in for it.
+ *
+ * @param ttl_ms 0: 60 s, < 0: no caching.
+ */
+void volc_net_set_dns_ttl(int ttl_ms);
+
+/**
+ * @brief connect to host, racing its addresses (Happy Eyeballs, RFC 8305):
+ *        a new attempt starts every 250 ms, or as soon as one fails, while
+ *        the earlier ones keep going. The first to complete wins.
+ *
+ * @param opt applied to every attempt before connect(), may be NULL.
+ * @return a connected socket in blocking mode, -1 on failure.
+ */
+int volc_net_connect(const char* host, int port, const volc_sock_opt_t* opt, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __CONV_AI_SRC_UTIL_VOLC_NET_H__ */
@@ -0,0 +1,152 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "util/volc_queue.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "volc_platform.h"
+
+/*
+ * Dmitry Vyukov's bounded queue: a cell is free for the producer at position
+ * pos when seq == pos, and holds data for a consumer when seq == pos + 1.
+ * A consumer returns it with seq = pos + depth.
+ *
+ * Not an SPSC ring on purpose. The send queue has one producer and one
+ * sender, but when it is full the producer claims the oldest item itself to
+ * drop it, while the sender may be claiming the same one. With two claimers
+ * a plain acquire/release read index would hand one cell out twice, the
+ * CAS on dequeue_pos decides who gets it. The CAS on enqueue_pos is kept as
+ * well, so volc_ws_send stays safe when called from more than one thread.
+ */
+typedef struct {
+    size_t seq;
+    size_t pos;
+    volc_queue_item_t item;
+} volc_queue_cell_t;
+
+struct volc_queue {
+    volc_queue_cell_t* cells;
+    size_t mask;
+    size_t enqueue_pos;
+    size_t dequeue_pos;
+};
+
+volc_queue_t* volc_queue_create(int depth, size_t item_size) {
+    volc_queue_t* q = NULL;
+    size_t size = 2;
+    size_t i = 0;
+    if (depth <= 0) {
+        return NULL;
+    }
+    while (size < (size_t)depth) {
+        size <<= 1;
+    }
+    q = (volc_queue_t*)hal_calloc(1, sizeof(volc_queue_t));
+    if (NULL == q) {
+        return NULL;
+    }
+    q->cells = (volc_queue_cell_t*)hal_calloc(size, sizeof(volc_queue_cell_t));
+    if (NULL == q->cells) {
+        HAL_SAFE_FREE(q);
+        return NULL;
+    }
+    q->mask = size - 1;
+    for (i = 0; i < size; i++) {
+        q->cells[i].seq = i;
+        if (item_size > 0 && NULL != (q->cells[i].item.data = (uint8_t*)hal_malloc(item_size))) {
+            q->cells[i].item.capacity = item_size;
+        }
+    }
+    return q;
+}
+
+void volc_queue_destroy(volc_queue_t* q) {
+    size_t i = 0;
+    if (NULL == q) {
+        return;
+    }
+    for (i = 0; i <= q->mask; i++) {
+        HAL_SAFE_FREE(q->cells[i].item.data);
+    }
+    HAL_SAFE_FREE(q->cells);
+    HAL_SAFE_FREE(q);
+}
+
+int volc_queue_push(volc_queue_t* q, const void* data, size_t len, uint32_t flags, uint64_t deadline_ms) {
+    volc_queue_cell_t* cell = NULL;
+    size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    size_t seq = 0;
+    intptr_t diff = 0;
+    uint8_t* new_data = NULL;
+    int ret = 0;
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (len > cell->item.capacity) {
+        new_data = (uint8_t*)hal_realloc(cell->item.data, len);
+        if (NULL == new_data) {
+            len = 0;
+            ret = -2;
+        } else {
+            cell->item.data = new_data;
+            cell->item.capacity = len;
+        }
+    }
+    if (len > 0) {
+        memcpy(cell->item.data, data, len);
+    }
+    cell->item.len = len;
+    cell->item.flags = flags;
+    cell->item.deadline_ms = deadline_ms;
+    cell->pos = pos;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return ret;
+}
+
+volc_queue_item_t* volc_queue_claim(volc_queue_t* q) {
+    volc_queue_cell_t* cell = NULL;
+    size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    size_t seq = 0;
+    intptr_t diff = 0;
+
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return &cell->item;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void volc_queue_release(volc_queue_t* q, volc_queue_item_t* item) {
+    volc_queue_cell_t* cell = (volc_queue_cell_t*)((char*)item - offsetof(volc_queue_cell_t, item));
+    __atomic_store_n(&cell->seq, cell->pos + q->mask + 1, __ATOMIC_RELEASE);
+}
+
+int volc_queue_depth(volc_queue_t* q) {
+    size_t enqueue_pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    size_t dequeue_pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    return (int)(enqueue_pos - dequeue_pos);
+}
@@ -0,0 +1,60 @@
+// Copyright (2025) Beijing Volcano Engine Technology Ltd.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef __CONV_AI_SRC_UTIL_VOLC_QUEUE_H__
+#define __CONV_AI_SRC_UTIL_VOLC_QUEUE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t capacity;
+    uint32_t flags;
+    uint64_t deadline_ms;
+} volc_queue_item_t;
+
+typedef struct volc_queue volc_queue_t;
+
+/**
+ * @brief bounded lock-free MPMC queue of byte buffers (per-cell sequence numbers).
+ *        MPMC because the producer also claims, see volc_queue_claim().
+ *        Cell buffers are kept across uses, so a steady stream of same sized
+ *        items does not allocate after warm up.
+ *
+ * @param depth rounded up to a power of two.
+ * @param item_size initial buffer size of every cell, 0 to allocate on first use.
+ */
+volc_queue_t* volc_queue_create(int depth, size_t item_size);
+
+void volc_queue_destroy(volc_queue_t* q);
+
+/**
+ * @brief copy data into the next free cell, never blocks.
+ *
+ * @return 0: success.
+ *        -1: queue full.
+ *        -2: out of memory, an empty item carrying only flags was queued.
+ */
+int volc_queue_push(volc_queue_t* q, const void* data, size_t len, uint32_t flags, uint64_t deadline_ms);
+
+/**
+ * @brief take ownership of the oldest item, NULL if empty. Safe to call from
+ *        the producer as well, e.g. to drop the oldest item when full.
+ *        The item has to be handed back with volc_queue_release().
+ */
+volc_queue_item_t* volc_queue_claim(volc_queue_t* q);
+
+void volc_queue_release(volc_queue_t* q, volc_queue_item_t* item);
+
+int volc_queue_depth(volc_queue_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __CONV_AI_SRC_UTIL_VOLC_QUEUE_H__ */
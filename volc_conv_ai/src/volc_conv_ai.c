@@ -6,6 +6,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include "volc_platform.h"
+#include "util/volc_http.h"
 #include "util/volc_json.h"
 #include "util/volc_log.h"
 #include "base/volc_device_manager.h"
@@ -25,6 +26,9 @@
 #define MAGIC_LENGTH 4
 #define MAGIC_OFFSET 8
 
+// engines created and not yet destroyed, the http pool is shared by all of them
+static int s_live_engines = 0;
+
 typedef enum {
     VOLC_RT_STATE_NONE = 0,          // Initial state
     VOLC_RT_STATE_CREATED,            // engine created
@@ -93,6 +97,9 @@ static void __realtime_event_2_user_event(void* context, volc_msg_t* msg) {
         case VOLC_MSG_DISCONNECTED:
             event.code = VOLC_EV_DISCONNECTED;
             break;
+        case VOLC_MSG_SESSION_READY:
+            event.code = VOLC_EV_SESSION_READY;
+            break;
         case VOLC_MSG_USER_JOINED:
         case VOLC_MSG_USER_OFFLINE:
             break;
@@ -272,6 +279,7 @@ int volc_create(volc_engine_t* handle, const char* config_json, volc_event_handl
 
     engine->status = VOLC_RT_STATE_CREATED;
     *handle = (volc_engine_t)engine;
+    __atomic_add_fetch(&s_live_engines, 1, __ATOMIC_ACQ_REL);
     cJSON_Delete(config);
     LOGI("Engine created successfully at: %llu ms", hal_get_time_ms());
     return 0;
@@ -310,9 +318,15 @@ void volc_destroy(volc_engine_t handle) {
     }
     _iot_info_free(&engine->info);
     HAL_SAFE_FREE(engine);
+    // idle connections stay for the engines still alive, no socket or TLS
+    // session outlives the last one. An engine created meanwhile only loses
+    // its idle connections, the pool fills again on demand.
+    if (__atomic_sub_fetch(&s_live_engines, 1, __ATOMIC_ACQ_REL) == 0) {
+        volc_http_pool_flush();
+    }
 }
 
-int volc_start(volc_engine_t handle, volc_opt_t* opt) {
+static int __volc_start(volc_engine_t handle, volc_opt_t* opt, bool wait) {
     int ret = 0;
     volc_engine_impl_t* engine = (volc_engine_impl_t*)handle;
     if (engine == NULL || opt == NULL) {
@@ -333,7 +347,11 @@ int volc_start(volc_engine_t handle, volc_opt_t* opt) {
     engine->mode = opt->mode;
     if (opt->mode == VOLC_MODE_WS) {
 #if defined(ENABLE_WS_MODE)
-        ret = volc_ws_start(engine->ws, opt->bot_id, &engine->info, opt->params);
+        if (wait) {
+            ret = volc_ws_start(engine->ws, opt->bot_id, &engine->info, opt->params);
+        } else {
+            ret = volc_ws_start_async(engine->ws, opt->bot_id, &engine->info, opt->params);
+        }
 #else
         LOGE("WS mode is not enabled");
         ret = -1;
@@ -341,6 +359,12 @@ int volc_start(volc_engine_t handle, volc_opt_t* opt) {
     } else if (opt->mode == VOLC_MODE_RTC) {
 #if defined(ENABLE_RTC_MODE)
         ret = volc_rtc_start(engine->rtc, opt->bot_id, &engine->info);
+        // the RTC join is synchronous, async callers still get the ready event they wait for
+        if (ret == 0 && !wait) {
+            volc_msg_t msg = { 0 };
+            msg.code = VOLC_MSG_SESSION_READY;
+            __realtime_event_2_user_event(engine, &msg);
+        }
 #else
         LOGE("RTC mode is not enabled");
         ret = -1;
@@ -352,6 +376,14 @@ int volc_start(volc_engine_t handle, volc_opt_t* opt) {
     return ret;
 }
 
+int volc_start(volc_engine_t handle, volc_opt_t* opt) {
+    return __volc_start(handle, opt, true);
+}
+
+int volc_start_async(volc_engine_t handle, volc_opt_t* opt) {
+    return __volc_start(handle, opt, false);
+}
+
 int volc_stop(volc_engine_t handle) {
     int ret = 0;
     volc_engine_impl_t* engine = (volc_engine_impl_t*)handle;
@@ -589,3 +621,31 @@ int volc_interrupt(volc_engine_t handle) {
 
     return ret;
 }
+
+int volc_get_stats(volc_engine_t handle, volc_stats_t* stats) {
+    int ret = 0;
+    volc_engine_impl_t* engine = (volc_engine_impl_t*)handle;
+    if (engine == NULL || stats == NULL) {
+        LOGE("engine handle or stats is NULL");
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    switch (engine->mode) {
+        case VOLC_MODE_WS:
+#if defined(ENABLE_WS_MODE)
+            ret = volc_ws_get_stats(engine->ws, stats);
+#else
+            LOGE("WS mode is not enabled");
+            ret = -1;
+#endif
+            break;
+        default:
+            break;
+    }
+    volc_http_stats_t http_stats;
+    volc_http_get_stats(&http_stats);
+    stats->http_requests = http_stats.requests;
+    stats->http_conn_reused = http_stats.reused;
+    stats->http_stale_retries = http_stats.stale_retries;
+    return ret;
+}
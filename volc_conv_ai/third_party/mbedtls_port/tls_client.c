@@ -16,9 +16,11 @@
  *
  *  This file is part of mbed TLS (https://tls.mbed.org)
  */
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 
 #if defined(MBEDTLS_USER_CONFIG_FILE)
 #include MBEDTLS_USER_CONFIG_FILE
@@ -39,6 +41,85 @@
 
 static char error_buf[100];
 
+#define TLS_SESSION_CACHE_SIZE 4
+#define TLS_SESSION_KEY_MAX 128
+
+typedef struct {
+  char key[TLS_SESSION_KEY_MAX]; /* host:port, empty when the slot is free */
+  uint64_t used_ms;
+  mbedtls_ssl_session session;
+} tls_session_entry_t;
+
+static tls_session_entry_t s_session_cache[TLS_SESSION_CACHE_SIZE];
+static hal_mutex_t s_tls_mutex = NULL;
+static mbedtls_client_stats_t s_stats;
+
+/*
+ * A profile only sets client preferences: the server picks the suite and
+ * may ignore the max_fragment_length request, so every list keeps both AEAD
+ * families. None of the profiles has been measured against "default" yet,
+ * the names say what they aim at, not what they achieve.
+ */
+typedef struct {
+  const char *name;
+  const int *ciphersuites;      /* NULL: the build default order */
+  bool prefer_x25519;
+  unsigned char max_frag_len;   /* MBEDTLS_SSL_MAX_FRAG_LEN_NONE: 16 KB records */
+} tls_profile_t;
+
+/* ChaCha20-Poly1305 first, AES-GCM after it */
+static const int s_suites_chacha_first[] = {
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+  MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,
+  MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+  MBEDTLS_TLS1_3_AES_256_GCM_SHA384,
+#endif
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+  MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+  MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+  MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+  0
+};
+
+/* AES-GCM first, ChaCha20-Poly1305 after it */
+static const int s_suites_aes_first[] = {
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+  MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+  MBEDTLS_TLS1_3_AES_256_GCM_SHA384,
+  MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,
+#endif
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+  MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+  MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+  MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+  0
+};
+
+static const tls_profile_t s_profiles[] = {
+  { "default", NULL, false, MBEDTLS_SSL_MAX_FRAG_LEN_NONE },
+  { "low-ram", s_suites_chacha_first, true, MBEDTLS_SSL_MAX_FRAG_LEN_4096 },
+  { "low-cpu", s_suites_chacha_first, true, MBEDTLS_SSL_MAX_FRAG_LEN_NONE },
+  { "throughput", s_suites_aes_first, false, MBEDTLS_SSL_MAX_FRAG_LEN_NONE },
+};
+
+static const tls_profile_t *s_profile = &s_profiles[0];
+
+struct tls_shared {
+  int refs;
+  const tls_profile_t *profile;
+  hal_mutex_t rng_mutex;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_x509_crt cacert;
+  mbedtls_ssl_config conf;
+};
+
+static struct tls_shared *s_shared = NULL;
+
 static void _ssl_debug(void *ctx, int level, const char *file, int line, const char *str)
 {
   ((void)level);
@@ -46,15 +127,325 @@ static void _ssl_debug(void *ctx, int level, const char *file, int line, const c
   // LOGD("%s:%04d: %s", file, line, str);
 }
 
+static hal_mutex_t _tls_mutex(void)
+{
+  hal_mutex_t mutex = __atomic_load_n(&s_tls_mutex, __ATOMIC_ACQUIRE);
+  hal_mutex_t expected = NULL;
+  if (mutex) {
+    return mutex;
+  }
+  mutex = hal_mutex_create();
+  if (NULL == mutex) {
+    return NULL;
+  }
+  if (!__atomic_compare_exchange_n(&s_tls_mutex, &expected, mutex, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    /* another thread won the race */
+    hal_mutex_destroy(mutex);
+    mutex = expected;
+  }
+  return mutex;
+}
+
+static int _session_key(const char *host, const char *port, char *key)
+{
+  int len = 0;
+  if (NULL == host) {
+    return -1;
+  }
+  len = snprintf(key, TLS_SESSION_KEY_MAX, "%s:%s", host, port ? port : "");
+  return (len > 0 && len < TLS_SESSION_KEY_MAX) ? 0 : -1;
+}
+
+/* called with the mutex held */
+static tls_session_entry_t *_session_find(const char *key)
+{
+  int i = 0;
+  for (i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (s_session_cache[i].key[0] && 0 == strcmp(s_session_cache[i].key, key)) {
+      return &s_session_cache[i];
+    }
+  }
+  return NULL;
+}
+
+/* called with the mutex held, the least recently used slot makes room */
+static tls_session_entry_t *_session_slot(const char *key)
+{
+  tls_session_entry_t *entry = _session_find(key);
+  int i = 0;
+  if (entry) {
+    return entry;
+  }
+  entry = &s_session_cache[0];
+  for (i = 0; i < TLS_SESSION_CACHE_SIZE; i++) {
+    if (0 == s_session_cache[i].key[0]) {
+      entry = &s_session_cache[i];
+      break;
+    }
+    if (s_session_cache[i].used_ms < entry->used_ms) {
+      entry = &s_session_cache[i];
+    }
+  }
+  if (entry->key[0]) {
+    mbedtls_ssl_session_free(&entry->session);
+  }
+  mbedtls_ssl_session_init(&entry->session);
+  strcpy(entry->key, key);
+  return entry;
+}
+
+/* called with the mutex held */
+static void _session_drop(tls_session_entry_t *entry)
+{
+  mbedtls_ssl_session_free(&entry->session);
+  memset(entry, 0, sizeof(*entry));
+}
+
+/* put the cached session of host:port into the client hello */
+static void _session_offer(MbedTLSSession *session)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  tls_session_entry_t *entry = NULL;
+  char key[TLS_SESSION_KEY_MAX];
+
+  session->session_offered = false;
+  if (NULL == mutex || 0 != _session_key(session->host, session->port, key)) {
+    return;
+  }
+  hal_mutex_lock(mutex);
+  entry = _session_find(key);
+  if (entry) {
+    entry->used_ms = hal_get_time_ms();
+    session->session_offered = (0 == mbedtls_ssl_set_session(&session->ssl, &entry->session));
+  }
+  hal_mutex_unlock(mutex);
+}
+
+/* a session that failed the handshake is not offered again */
+static void _session_forget(MbedTLSSession *session)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  tls_session_entry_t *entry = NULL;
+  char key[TLS_SESSION_KEY_MAX];
+
+  if (NULL == mutex || 0 != _session_key(session->host, session->port, key)) {
+    return;
+  }
+  hal_mutex_lock(mutex);
+  entry = _session_find(key);
+  if (entry) {
+    _session_drop(entry);
+  }
+  hal_mutex_unlock(mutex);
+}
+
+/*
+ * TLS 1.2 has the session right after the handshake, TLS 1.3 only once a
+ * NewSessionTicket arrived. mbedtls hands each one out once.
+ */
+static void _session_store(MbedTLSSession *session)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  tls_session_entry_t *entry = NULL;
+  mbedtls_ssl_session saved;
+  char key[TLS_SESSION_KEY_MAX];
+
+  if (NULL == mutex || 0 != _session_key(session->host, session->port, key)) {
+    return;
+  }
+  mbedtls_ssl_session_init(&saved);
+  if (0 != mbedtls_ssl_get_session(&session->ssl, &saved)) {
+    mbedtls_ssl_session_free(&saved);
+    return;
+  }
+  hal_mutex_lock(mutex);
+  entry = _session_slot(key);
+  mbedtls_ssl_session_free(&entry->session);
+  entry->session = saved;
+  entry->used_ms = hal_get_time_ms();
+  hal_mutex_unlock(mutex);
+}
+
+/* one DRBG serves every handshake, whatever thread runs it */
+static int _shared_random(void *ctx, unsigned char *output, size_t len)
+{
+  struct tls_shared *shared = (struct tls_shared *)ctx;
+  int ret = 0;
+
+  hal_mutex_lock(shared->rng_mutex);
+  ret = mbedtls_ctr_drbg_random(&shared->ctr_drbg, output, len);
+  hal_mutex_unlock(shared->rng_mutex);
+
+  return ret;
+}
+
+static void _shared_free(struct tls_shared *shared)
+{
+  mbedtls_ssl_config_free(&shared->conf);
+  mbedtls_x509_crt_free(&shared->cacert);
+  mbedtls_ctr_drbg_free(&shared->ctr_drbg);
+  mbedtls_entropy_free(&shared->entropy);
+  if (shared->rng_mutex) {
+    hal_mutex_destroy(shared->rng_mutex);
+  }
+  hal_free(shared);
+}
+
+static void _profile_apply(struct tls_shared *shared)
+{
+  const tls_profile_t *profile = shared->profile;
+#if defined(MBEDTLS_VERSION_NUMBER) && MBEDTLS_VERSION_NUMBER >= 0x03010000
+  static const uint16_t groups[] = {
+    MBEDTLS_SSL_IANA_TLS_GROUP_X25519,
+    MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+    MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1,
+    MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+  };
+#endif
+
+  if (profile->ciphersuites) {
+    /* suites the build lacks are skipped by the client hello */
+    mbedtls_ssl_conf_ciphersuites(&shared->conf, profile->ciphersuites);
+  }
+#if defined(MBEDTLS_VERSION_NUMBER) && MBEDTLS_VERSION_NUMBER >= 0x03010000
+  if (profile->prefer_x25519) {
+    mbedtls_ssl_conf_groups(&shared->conf, groups);
+  }
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  if (profile->max_frag_len != MBEDTLS_SSL_MAX_FRAG_LEN_NONE) {
+    mbedtls_ssl_conf_max_frag_len(&shared->conf, profile->max_frag_len);
+  }
+#endif
+}
+
+static struct tls_shared *_shared_create(const void *pers, size_t pers_len)
+{
+  struct tls_shared *shared = NULL;
+  uint64_t start_ms = hal_get_time_ms();
+  int ret = 0;
+
+  shared = (struct tls_shared *)hal_calloc(1, sizeof(*shared));
+  if (NULL == shared) {
+    LOGE("no memory for the shared tls context");
+    return NULL;
+  }
+  mbedtls_entropy_init(&shared->entropy);
+  mbedtls_ctr_drbg_init(&shared->ctr_drbg);
+  mbedtls_x509_crt_init(&shared->cacert);
+  mbedtls_ssl_config_init(&shared->conf);
+
+  shared->rng_mutex = hal_mutex_create();
+  if (NULL == shared->rng_mutex) {
+    LOGE("create rng mutex failed");
+    goto err_out_label;
+  }
+
+  ret = mbedtls_ctr_drbg_seed(&shared->ctr_drbg, mbedtls_entropy_func, &shared->entropy,
+                              (const unsigned char *)pers, pers_len);
+  if (ret != 0) {
+    LOGE("mbedtls_ctr_drbg_seed error, return -0x%x", -ret);
+    goto err_out_label;
+  }
+
+  ret = mbedtls_x509_crt_parse(&shared->cacert, (const unsigned char *)GLOBAL_ROOT_CERT, GLOBAL_ROOT_CERT_LEN);
+  if (ret < 0) {
+    LOGE("mbedtls_x509_crt_parse error,  return -0x%x", -ret);
+    goto err_out_label;
+  }
+
+  ret = mbedtls_ssl_config_defaults(&shared->conf, MBEDTLS_SSL_IS_CLIENT,
+                                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+  if (ret != 0) {
+    LOGE("mbedtls_ssl_config_defaults error, return -0x%x", -ret);
+    goto err_out_label;
+  }
+
+  mbedtls_ssl_conf_authmode(&shared->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&shared->conf, &shared->cacert, NULL);
+  mbedtls_ssl_conf_rng(&shared->conf, _shared_random, shared);
+
+  mbedtls_ssl_conf_dbg(&shared->conf, _ssl_debug, NULL);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && defined(MBEDTLS_SSL_SESSION_TICKETS) && \
+    defined(MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED)
+  /* mbedtls >= 3.6.1 drops TLS 1.3 tickets unless asked to hand them up */
+  mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(&shared->conf,
+                                                          MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+
+  mbedtls_ssl_conf_read_timeout(&shared->conf, 1000);
+
+  shared->profile = s_profile;
+  _profile_apply(shared);
+
+  LOGD("shared tls context (%s) ready in %u ms", shared->profile->name, (unsigned)(hal_get_time_ms() - start_ms));
+  return shared;
+
+err_out_label:
+  _shared_free(shared);
+  return NULL;
+}
+
+static struct tls_shared *_shared_ref(const void *pers, size_t pers_len)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  struct tls_shared *shared = NULL;
+
+  if (NULL == mutex) {
+    return NULL;
+  }
+  hal_mutex_lock(mutex);
+  if (NULL == s_shared) {
+    s_shared = _shared_create(pers, pers_len);
+  }
+  shared = s_shared;
+  if (shared) {
+    shared->refs++;
+  }
+  hal_mutex_unlock(mutex);
+
+  return shared;
+}
+
+static void _shared_unref(struct tls_shared *shared)
+{
+  hal_mutex_t mutex = _tls_mutex();
+
+  if (NULL == shared || NULL == mutex) {
+    return;
+  }
+  hal_mutex_lock(mutex);
+  if (--shared->refs == 0) {
+    if (s_shared == shared) {
+      s_shared = NULL;
+    }
+    _shared_free(shared);
+  }
+  hal_mutex_unlock(mutex);
+}
+
+static int _ssl_verify(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+  MbedTLSSession *session = (MbedTLSSession *)ctx;
+  ((void)crt);
+  ((void)depth);
+  ((void)flags);
+
+  /* a resumed handshake carries no certificate */
+  session->certs_verified++;
+  return 0;
+}
+
 static int mbedtls_ssl_certificate_verify(MbedTLSSession *session)
 {
   int ret = 0;
+  char info[256];
   ret = mbedtls_ssl_get_verify_result(&session->ssl);
   if (ret != 0) {
     LOGE("verify peer certificate fail....");
-    memset(session->buffer, 0x00, session->buffer_len);
-    mbedtls_x509_crt_verify_info((char *)session->buffer, session->buffer_len, "  ! ", ret);
-    LOGE("verification info: %s", session->buffer);
+    memset(info, 0x00, sizeof(info));
+    mbedtls_x509_crt_verify_info(info, sizeof(info), "  ! ", ret);
+    LOGE("verification info: %s", info);
     return -1;
   }
   return 0;
@@ -62,8 +453,6 @@ static int mbedtls_ssl_certificate_verify(MbedTLSSession *session)
 
 int mbedtls_client_init(MbedTLSSession *session, void *entropy, size_t entropyLen)
 {
-  int ret = 0;
-
 #if defined(MBEDTLS_DEBUG_C)
   LOGD("Set debug level (%d)", (int)DEBUG_LEVEL);
   mbedtls_debug_set_threshold((int)DEBUG_LEVEL);
@@ -71,16 +460,12 @@ int mbedtls_client_init(MbedTLSSession *session, void *entropy, size_t entropyLe
 
   mbedtls_net_init(&session->server_fd);
   mbedtls_ssl_init(&session->ssl);
-  mbedtls_ssl_config_init(&session->conf);
-  mbedtls_ctr_drbg_init(&session->ctr_drbg);
-  mbedtls_entropy_init(&session->entropy);
-  mbedtls_x509_crt_init(&session->cacert);
 
-  ret = mbedtls_ctr_drbg_seed(&session->ctr_drbg, mbedtls_entropy_func, &session->entropy,
-                              (unsigned char *)entropy, entropyLen);
-  if (ret != 0) {
-    LOGE("mbedtls_ctr_drbg_seed error, return -0x%x\n", -ret);
-    return ret;
+  /* entropy personalizes the DRBG of whichever session creates it */
+  session->shared = _shared_ref(entropy, entropyLen);
+  if (NULL == session->shared) {
+    LOGE("shared tls context unavailable");
+    return -1;
   }
   LOGD("mbedtls client struct init success...");
 
@@ -95,13 +480,10 @@ int mbedtls_client_close(MbedTLSSession *session)
 
   mbedtls_ssl_close_notify(&session->ssl);
   mbedtls_net_free(&session->server_fd);
-  mbedtls_x509_crt_free(&session->cacert);
-  mbedtls_entropy_free(&session->entropy);
-  mbedtls_ctr_drbg_free(&session->ctr_drbg);
-  mbedtls_ssl_config_free(&session->conf);
   mbedtls_ssl_free(&session->ssl);
+  _shared_unref(session->shared);
+  session->shared = NULL;
 
-  HAL_SAFE_FREE(session->buffer);
   HAL_SAFE_FREE(session->host);
   HAL_SAFE_FREE(session->port);
   HAL_SAFE_FREE(session);
@@ -113,14 +495,11 @@ int mbedtls_client_context(MbedTLSSession *session)
 {
   int ret = 0;
 
-  ret = mbedtls_x509_crt_parse(&session->cacert, (const unsigned char *)GLOBAL_ROOT_CERT, GLOBAL_ROOT_CERT_LEN);
-  if (ret < 0) {
-    LOGE("mbedtls_x509_crt_parse error,  return -0x%x", -ret);
-    return ret;
+  if (NULL == session->shared) {
+    LOGE("mbedtls client not initialized");
+    return -1;
   }
 
-  LOGD("Loading the CA root certificate success...");
-
   /* Hostname set here should match CN in server certificate */
   if (session->host) {
     ret = mbedtls_ssl_set_hostname(&session->ssl, session->host);
@@ -130,26 +509,12 @@ int mbedtls_client_context(MbedTLSSession *session)
     }
   }
 
-  ret = mbedtls_ssl_config_defaults(&session->conf, MBEDTLS_SSL_IS_CLIENT,
-                                    MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
-  if (ret != 0) {
-    LOGE("mbedtls_ssl_config_defaults error, return -0x%x", -ret);
-    return ret;
-  }
-
-  mbedtls_ssl_conf_authmode(&session->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
-  mbedtls_ssl_conf_ca_chain(&session->conf, &session->cacert, NULL);
-  mbedtls_ssl_conf_rng(&session->conf, mbedtls_ctr_drbg_random, &session->ctr_drbg);
-
-  mbedtls_ssl_conf_dbg(&session->conf, _ssl_debug, NULL);
-
-  mbedtls_ssl_conf_read_timeout(&session->conf, 1000);
-
-  ret = mbedtls_ssl_setup(&session->ssl, &session->conf);
+  ret = mbedtls_ssl_setup(&session->ssl, &session->shared->conf);
   if (ret != 0) {
     LOGE("mbedtls_ssl_setup error, return -0x%x", -ret);
     return ret;
   }
+  mbedtls_ssl_set_verify(&session->ssl, _ssl_verify, session);
   LOGD("mbedtls client context init success...");
 
   return 0;
@@ -168,25 +533,135 @@ int mbedtls_client_connect(MbedTLSSession *session)
 
   LOGD("Connected %s:%s success...", session->host, session->port);
 
+  return mbedtls_client_handshake(session);
+}
+
+static void _handshake_done(MbedTLSSession *session, uint64_t start_ms, bool ok)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  uint32_t elapsed_ms = (uint32_t)(hal_get_time_ms() - start_ms);
+
+  if (mutex) {
+    hal_mutex_lock(mutex);
+  }
+  if (ok) {
+    s_stats.handshakes++;
+    s_stats.resumed += session->resumed ? 1 : 0;
+    s_stats.last_ms = elapsed_ms;
+    s_stats.total_ms += elapsed_ms;
+    if (elapsed_ms > s_stats.max_ms) {
+      s_stats.max_ms = elapsed_ms;
+    }
+  } else {
+    s_stats.failed++;
+  }
+  if (mutex) {
+    hal_mutex_unlock(mutex);
+  }
+}
+
+int mbedtls_client_handshake(MbedTLSSession *session)
+{
+  int ret = 0;
+  uint64_t start_ms = hal_get_time_ms();
+
   mbedtls_ssl_set_bio(&session->ssl, &session->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 
+  session->certs_verified = 0;
+  session->resumed = false;
+  _session_offer(session);
+
   while ((ret = mbedtls_ssl_handshake(&session->ssl)) != 0) {
     if (0 != mbedtls_ssl_certificate_verify(session)) {
-      return -1;
+      ret = -1;
+      goto err_out_label;
     }
     if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
       LOGE("mbedtls_ssl_handshake error, return -0x%x", -ret);
-      return ret;
+      goto err_out_label;
     }
   }
 
   if (0 != mbedtls_ssl_certificate_verify(session)) {
-    return -1;
+    ret = -1;
+    goto err_out_label;
   }
 
-  LOGD("Certificate verified success...");
+  session->resumed = session->session_offered && 0 == session->certs_verified;
+  _handshake_done(session, start_ms, true);
+  LOGD("handshake with %s done in %u ms, %s", session->host ? session->host : "",
+      (unsigned)(hal_get_time_ms() - start_ms), session->resumed ? "resumed" : "full");
+
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+  if (mbedtls_ssl_get_version_number(&session->ssl) != MBEDTLS_SSL_VERSION_TLS1_3)
+#endif
+  {
+    _session_store(session);
+  }
 
   return 0;
+
+err_out_label:
+  _handshake_done(session, start_ms, false);
+  if (session->session_offered) {
+    _session_forget(session);
+  }
+  return ret;
+}
+
+/* MSG_DONTWAIT leaves the fd blocking for the writer */
+static int _net_recv_nonblock(void *ctx, unsigned char *buf, size_t len)
+{
+  int fd = ((MbedTLSSession *)ctx)->server_fd.fd;
+  int ret = 0;
+
+  if (fd < 0) {
+    return MBEDTLS_ERR_NET_INVALID_CONTEXT;
+  }
+  ret = (int)recv(fd, buf, len, MSG_DONTWAIT);
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    if (errno == ECONNRESET || errno == EPIPE) {
+      return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    return MBEDTLS_ERR_NET_RECV_FAILED;
+  }
+  return ret;
+}
+
+/* waits like mbedtls_net_send(), except inside mbedtls_client_write_nonblock() */
+static int _net_send(void *ctx, const unsigned char *buf, size_t len)
+{
+  MbedTLSSession *session = (MbedTLSSession *)ctx;
+  int fd = session->server_fd.fd;
+  int ret = 0;
+
+  if (fd < 0) {
+    return MBEDTLS_ERR_NET_INVALID_CONTEXT;
+  }
+  ret = (int)send(fd, buf, len, session->write_nonblock ? MSG_DONTWAIT : 0);
+  if (ret < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+    if (errno == ECONNRESET || errno == EPIPE) {
+      return MBEDTLS_ERR_NET_CONN_RESET;
+    }
+    return MBEDTLS_ERR_NET_SEND_FAILED;
+  }
+  return ret;
+}
+
+void mbedtls_client_set_read_nonblock(MbedTLSSession *session, bool nonblock)
+{
+  session->read_nonblock = nonblock;
+  if (nonblock) {
+    mbedtls_ssl_set_bio(&session->ssl, session, _net_send, _net_recv_nonblock, NULL);
+  } else {
+    mbedtls_ssl_set_bio(&session->ssl, &session->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
+  }
 }
 
 int mbedtls_client_read(MbedTLSSession *session, unsigned char *buf, size_t len)
@@ -199,9 +674,21 @@ int mbedtls_client_read(MbedTLSSession *session, unsigned char *buf, size_t len)
     return -1;
   }
 
-  do {
+  for (;;) {
     ret = mbedtls_ssl_read(&session->ssl, (unsigned char *)buf, len);
-  } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+    if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+      _session_store(session);
+      continue;
+    }
+#endif
+    if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) || session->read_nonblock) {
+      break;
+    }
+  }
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return ret;
+  }
   if (ret <= 0) {
     switch (ret) {
     case MBEDTLS_ERR_SSL_TIMEOUT:
@@ -235,3 +722,124 @@ int mbedtls_client_write(MbedTLSSession *session, const unsigned char *buf, size
 
   return ret;
 }
+
+int mbedtls_client_write_nonblock(MbedTLSSession *session, const unsigned char *buf, size_t len)
+{
+  int ret = 0;
+
+  if (session == NULL || buf == NULL) {
+    return -1;
+  }
+
+  session->write_nonblock = true;
+  ret = mbedtls_ssl_write(&session->ssl, (unsigned char *)buf, len);
+  session->write_nonblock = false;
+  if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+    LOGE("mbedtls_client_write_nonblock data error, return -0x%x", -ret);
+  }
+
+  return ret;
+}
+
+void mbedtls_client_get_stats(mbedtls_client_stats_t *stats)
+{
+  hal_mutex_t mutex = _tls_mutex();
+
+  if (NULL == stats) {
+    return;
+  }
+  if (mutex) {
+    hal_mutex_lock(mutex);
+  }
+  *stats = s_stats;
+  if (mutex) {
+    hal_mutex_unlock(mutex);
+  }
+}
+
+int mbedtls_client_session_export(const char *host, const char *port, unsigned char *buf, size_t len, size_t *olen)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  tls_session_entry_t *entry = NULL;
+  char key[TLS_SESSION_KEY_MAX];
+  int ret = -1;
+
+  if (NULL == mutex || NULL == olen || 0 != _session_key(host, port, key)) {
+    return -1;
+  }
+  hal_mutex_lock(mutex);
+  entry = _session_find(key);
+  if (entry) {
+    ret = mbedtls_ssl_session_save(&entry->session, buf, len, olen);
+  }
+  hal_mutex_unlock(mutex);
+
+  return ret;
+}
+
+int mbedtls_client_session_import(const char *host, const char *port, const unsigned char *buf, size_t len)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  tls_session_entry_t *entry = NULL;
+  mbedtls_ssl_session loaded;
+  char key[TLS_SESSION_KEY_MAX];
+  int ret = 0;
+
+  if (NULL == mutex || NULL == buf || 0 != _session_key(host, port, key)) {
+    return -1;
+  }
+  mbedtls_ssl_session_init(&loaded);
+  ret = mbedtls_ssl_session_load(&loaded, buf, len);
+  if (ret != 0) {
+    LOGW("mbedtls_ssl_session_load error, return -0x%x", -ret);
+    mbedtls_ssl_session_free(&loaded);
+    return ret;
+  }
+  hal_mutex_lock(mutex);
+  entry = _session_slot(key);
+  mbedtls_ssl_session_free(&entry->session);
+  entry->session = loaded;
+  entry->used_ms = hal_get_time_ms();
+  hal_mutex_unlock(mutex);
+
+  return 0;
+}
+
+struct tls_shared *mbedtls_client_retain(void)
+{
+  return _shared_ref(TAG, strlen(TAG));
+}
+
+void mbedtls_client_release(struct tls_shared *shared)
+{
+  _shared_unref(shared);
+}
+
+int mbedtls_client_set_profile(const char *name)
+{
+  hal_mutex_t mutex = _tls_mutex();
+  const tls_profile_t *profile = NULL;
+  size_t i = 0;
+
+  for (i = 0; name && i < sizeof(s_profiles) / sizeof(s_profiles[0]); i++) {
+    if (0 == strcmp(s_profiles[i].name, name)) {
+      profile = &s_profiles[i];
+      break;
+    }
+  }
+  if (NULL == profile || NULL == mutex) {
+    LOGW("unknown tls profile %s", name ? name : "(null)");
+    return -1;
+  }
+
+  hal_mutex_lock(mutex);
+  s_profile = profile;
+  if (s_shared && s_shared->profile != profile) {
+    /* live sessions keep the old config, new ones build a fresh one */
+    s_shared = NULL;
+  }
+  hal_mutex_unlock(mutex);
+  LOGI("tls profile %s", profile->name);
+
+  return 0;
+}
@@ -30,26 +30,83 @@
 #include "mbedtls/timing.h"
 #include "mbedtls/platform.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CA chain, ssl config and DRBG, parsed once and shared by every session */
+struct tls_shared;
+
 typedef struct MbedTLSSession {
   char *host;
   char *port;
 
-  unsigned char *buffer;
-  size_t buffer_len;
-
   mbedtls_ssl_context ssl;
-  mbedtls_ssl_config conf;
-  mbedtls_entropy_context entropy;
-  mbedtls_ctr_drbg_context ctr_drbg;
   mbedtls_net_context server_fd;
-  mbedtls_x509_crt cacert;
+  struct tls_shared *shared;
+
+  bool session_offered; /* a cached session of host:port went into the client hello */
+  bool resumed;         /* the server accepted it, no certificate was verified */
+  int certs_verified;
+  bool read_nonblock;   /* mbedtls_client_read() gives back WANT_READ instead of waiting */
+  bool write_nonblock;  /* set by mbedtls_client_write_nonblock() for the duration of the call */
 } MbedTLSSession;
 
+typedef struct {
+  uint32_t handshakes;        /* completed */
+  uint32_t resumed;           /* of them, abbreviated with a cached session */
+  uint32_t failed;
+  uint32_t last_ms;
+  uint32_t max_ms;
+  uint64_t total_ms;
+} mbedtls_client_stats_t;
+
 extern int mbedtls_client_init(MbedTLSSession *session, void *entropy, size_t entropyLen);
 extern int mbedtls_client_close(MbedTLSSession *session);
 extern int mbedtls_client_context(MbedTLSSession *session);
 extern int mbedtls_client_connect(MbedTLSSession *session);
+/* handshake over session->server_fd, already connected by the caller */
+extern int mbedtls_client_handshake(MbedTLSSession *session);
 extern int mbedtls_client_read(MbedTLSSession *session, unsigned char *buf, size_t len);
+/*
+ * After the handshake: reads take only what the socket already holds and
+ * return MBEDTLS_ERR_SSL_WANT_READ for the rest, writes still block unless
+ * they go through mbedtls_client_write_nonblock().
+ */
+extern void mbedtls_client_set_read_nonblock(MbedTLSSession *session, bool nonblock);
 extern int mbedtls_client_write(MbedTLSSession *session, const unsigned char *buf, size_t len);
+/*
+ * Needs read_nonblock. MBEDTLS_ERR_SSL_WANT_WRITE when the socket takes no
+ * more, mbedtls keeps the record and the retry passes the same buf and len.
+ */
+extern int mbedtls_client_write_nonblock(MbedTLSSession *session, const unsigned char *buf, size_t len);
+
+/*
+ * The shared context is created by the first session and freed with the
+ * last one. A client that reconnects holds a reference of its own in
+ * between, so the CA chain is not parsed again on every connect.
+ */
+extern struct tls_shared *mbedtls_client_retain(void);
+extern void mbedtls_client_release(struct tls_shared *shared);
+
+/*
+ * Process wide, taken by the shared context built next. A profile only sets
+ * what the client asks for (X25519 needs mbedtls 3.1+), none is measured:
+ *   "default"    the cipher order and record size of the mbedtls build
+ *   "low-ram"    ChaCha20 first, X25519, asks for 4 KB max_fragment_length
+ *   "low-cpu"    ChaCha20 first, X25519
+ *   "throughput" AES-GCM first, 16 KB records
+ */
+extern int mbedtls_client_set_profile(const char *name);
+
+/* process wide, every handshake of every session counts */
+extern void mbedtls_client_get_stats(mbedtls_client_stats_t *stats);
+
+/*
+ * Sessions are cached in RAM per host:port and offered by the next handshake
+ * to the same server. To keep them across reboots, export one after a
+ * connection and import it before the first connect.
+ */
+extern int mbedtls_client_session_export(const char *host, const char *port, unsigned char *buf, size_t len, size_t *olen);
+extern int mbedtls_client_session_import(const char *host, const char *port, const unsigned char *buf, size_t len);
 
 #endif
@@ -30,6 +30,7 @@
 #ifdef CONFIG_WEBCLIENT_HTTPS_SUPPORTED
 #include "tls_client.h"
 #endif
+#include "util/volc_net.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -141,6 +142,16 @@ typedef struct webclient_session {
   int (*handle_function)(char *buffer, int size); /* handle function */
 
   bool is_tls; /* HTTPS connect */
+  volc_sock_opt_t sock_opt; /* socket options applied on connect */
+  bool keep_alive; /* the server keeps the connection open after the response */
+  int keep_alive_ms; /* the Keep-Alive timeout announced by the server, 0 if none */
+  bool reused; /* the last request went out on a kept connection */
+  bool answered; /* a byte of the current response has come in */
+  bool retry_safe; /* the request failed unanswered: sending failed, or the connection closed or reset first */
+
+  char *rx_buf; /* read ahead while parsing the response header */
+  size_t rx_pos; /* next unread byte */
+  size_t rx_len; /* bytes held */
 
 #ifdef CONFIG_WEBCLIENT_HTTPS_SUPPORTED
   MbedTLSSession *tls_session; /* mbedtls connect session */
@@ -157,6 +168,21 @@ typedef struct webclient_session {
  */
 struct webclient_session *webclient_session_create(size_t header_sz, const char *cert_buf, size_t cert_len);
 
+/**
+ * @brief forget the last request and response but keep the connection, so
+ *        the next request to the same server goes out on it
+ *
+ * @param session the webclient session
+ * @return 0: reset successfully
+ */
+int webclient_session_reset(struct webclient_session *session);
+
+/**
+ * @brief whether the connection can carry another request: the server did
+ *        not ask to close it and the response body was read to the end
+ */
+bool webclient_keep_alive(struct webclient_session *session);
+
 /**
  * @brief close and release wenclient session
  *
@@ -220,6 +246,9 @@ int webclient_put(struct webclient_session *session, const char *URI, const void
 
 int webclient_set_timeout(struct webclient_session *session, int millisecond);
 
+/* socket options for the next connect of this session */
+int webclient_set_sock_opt(struct webclient_session *session, const volc_sock_opt_t *opt);
+
 /* send or receive data from server */
 int webclient_read(struct webclient_session *session, void *buffer, size_t size);
 int webclient_write(struct webclient_session *session, const void *buffer, size_t size);
@@ -24,6 +24,8 @@
 #include <webclient.h>
 
 #include <sys/errno.h>
+#include <sys/select.h>
+#include <sys/poll.h>
 #include <sys/time.h>
 
 #include <netdb.h>
@@ -38,6 +40,9 @@
 /* default receive or send timeout */
 #define WEBCLIENT_DEFAULT_TIMEO 6
 
+/* header read ahead, a control-plane response header fits in one fill */
+#define WEBCLIENT_RX_BUFSZ 1024
+
 extern long int strtol(const char *nptr, char **endptr, int base);
 
 static int webclient_strncasecmp(const char *a, const char *b, size_t n)
@@ -80,7 +85,7 @@ static int webclient_send(struct webclient_session *session, const void *buffer,
   return send(session->socket, buffer, len, flag);
 }
 
-static int webclient_recv(struct webclient_session *session, void *buffer, size_t len, int flag)
+static int webclient_socket_recv(struct webclient_session *session, void *buffer, size_t len, int flag)
 {
 #ifdef CONFIG_WEBCLIENT_HTTPS_SUPPORTED
   if (session->tls_session) {
@@ -90,6 +95,69 @@ static int webclient_recv(struct webclient_session *session, void *buffer, size_
   return recv(session->socket, buffer, len, flag);
 }
 
+/* body bytes that came in with the header are handed out first */
+static int webclient_recv(struct webclient_session *session, void *buffer, size_t len, int flag)
+{
+  if (session->rx_pos < session->rx_len) {
+    size_t held = session->rx_len - session->rx_pos;
+
+    if (len > held) {
+      len = held;
+    }
+    memcpy(buffer, session->rx_buf + session->rx_pos, len);
+    session->rx_pos += len;
+    return (int)len;
+  }
+  return webclient_socket_recv(session, buffer, len, flag);
+}
+
+/* the connection closed or was reset, as opposed to a receive timeout */
+static bool webclient_peer_gone(struct webclient_session *session, int rc)
+{
+  if (rc == 0) {
+    return true;
+  }
+#if defined(CONFIG_WEBCLIENT_HTTPS_SUPPORTED)
+  if (session->is_tls) {
+    return rc == MBEDTLS_ERR_NET_CONN_RESET || rc == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY;
+  }
+#endif
+  return errno == ECONNRESET || errno == EPIPE || errno == ENOTCONN;
+}
+
+/* one socket or TLS read for as much as has arrived, instead of a byte at a time */
+static int webclient_fill(struct webclient_session *session)
+{
+  int rc;
+
+  if (session->rx_buf == RT_NULL) {
+    session->rx_buf = hal_malloc(WEBCLIENT_RX_BUFSZ);
+    if (session->rx_buf == RT_NULL) {
+      LOGE( "no memory for receive buffer!");
+      return -WEBCLIENT_NOMEM;
+    }
+  }
+
+  do {
+    rc = webclient_socket_recv(session, session->rx_buf, WEBCLIENT_RX_BUFSZ, 0);
+#if defined(CONFIG_WEBCLIENT_HTTPS_SUPPORTED)
+  } while (session->is_tls && (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE));
+#else
+  } while (0);
+#endif
+  if (rc <= 0) {
+    if (!session->answered && webclient_peer_gone(session, rc)) {
+      session->retry_safe = true;
+    }
+    return rc;
+  }
+  session->answered = true;
+  session->rx_pos = 0;
+  session->rx_len = rc;
+
+  return rc;
+}
+
 static int webclient_read_line(struct webclient_session *session, char *buffer, int size)
 {
   int rc, count = 0;
@@ -100,14 +168,12 @@ static int webclient_read_line(struct webclient_session *session, char *buffer,
 
   /* Keep reading until we fill the buffer. */
   while (count < size) {
-    rc = webclient_recv(session, (unsigned char *)&ch, 1, 0);
-#if defined(CONFIG_WEBCLIENT_HTTPS_SUPPORTED)
-    if (session->is_tls && (rc == MBEDTLS_ERR_SSL_WANT_READ || rc == MBEDTLS_ERR_SSL_WANT_WRITE)) {
-      continue;
+    if (session->rx_pos >= session->rx_len) {
+      rc = webclient_fill(session);
+      if (rc <= 0)
+        return rc;
     }
-#endif
-    if (rc <= 0)
-      return rc;
+    ch = session->rx_buf[session->rx_pos++];
 
     if (ch == '\n' && last_ch == '\r')
       break;
@@ -125,6 +191,27 @@ static int webclient_read_line(struct webclient_session *session, char *buffer,
   return count;
 }
 
+/* the zero size chunk ends the body, a kept connection reads past the trailer */
+static void webclient_chunks_end(struct webclient_session *session)
+{
+  char line[64];
+  int length;
+
+  session->chunk_sz = -1;
+  if (session->keep_alive) {
+    do {
+      length = webclient_read_line(session, line, sizeof(line));
+    } while (length > 1);
+    if (length == 1) {
+      return;
+    }
+    session->keep_alive = false;
+  }
+
+   close(session->socket);
+  session->socket = -1;
+}
+
 /**
  * resolve server address
  *
@@ -145,8 +232,7 @@ static int webclient_read_line(struct webclient_session *session, char *buffer,
  * http://[fe80::1]/index.html
  * http://[fe80::1]:80/index.html
  */
-static int webclient_resolve_address(struct webclient_session *session, struct addrinfo **res, const char *url,
-                                     const char **request)
+static int webclient_resolve_address(struct webclient_session *session, const char *url, const char **request)
 {
   int rc = WEBCLIENT_OK;
   char *ptr;
@@ -157,12 +243,8 @@ static int webclient_resolve_address(struct webclient_session *session, struct a
   const char *host_addr = 0;
   int url_len, host_addr_len = 0;
 
-  RT_ASSERT(res);
   RT_ASSERT(request);
 
-  /* make *res == NULL before getaddrinfo */
-  *res = RT_NULL;
-
   url_len = rt_strlen(url);
 
   /* strip protocol(http or https) */
@@ -237,6 +319,8 @@ static int webclient_resolve_address(struct webclient_session *session, struct a
     host_addr_new[host_addr_len] = '\0';
     session->host = host_addr_new;
   }
+  /* the host name is resolved on connect, through the shared dns cache */
+  session->port = atoi(port_str);
 
 #ifdef CONFIG_WEBCLIENT_HTTPS_SUPPORTED
   if (session->tls_session) {
@@ -245,33 +329,12 @@ static int webclient_resolve_address(struct webclient_session *session, struct a
     if (session->tls_session->port == RT_NULL || session->tls_session->host == RT_NULL) {
       return -WEBCLIENT_NOMEM;
     }
-
-    return rc;
   }
 #endif
 
-  /* resolve the host name. */
-  {
-    struct addrinfo hint;
-    int ret;
-
-    rt_memset(&hint, 0, sizeof(hint));
-    ret = getaddrinfo(session->host, port_str, &hint, res);
-    if (ret != 0) {
-      LOGE( "getaddrinfo err: %d '%s'.", ret, session->host);
-      rc = -WEBCLIENT_ERROR;
-      goto __exit;
-    }
-  }
-
 __exit:
   if (rc != WEBCLIENT_OK) {
     HAL_SAFE_FREE(session->host);
-
-    if (*res) {
-      freeaddrinfo(*res);
-      *res = RT_NULL;
-    }
   }
 
   return rc;
@@ -290,13 +353,6 @@ static int webclient_open_tls(struct webclient_session *session, const char *URI
     return -WEBCLIENT_NOMEM;
   }
 
-  session->tls_session->buffer_len = WEBCLIENT_RESPONSE_BUFSZ;
-  session->tls_session->buffer = hal_malloc(session->tls_session->buffer_len);
-  if (session->tls_session->buffer == RT_NULL) {
-    LOGE( "no memory for tls_session buffer!");
-    return -WEBCLIENT_ERROR;
-  }
-
   if ((tls_ret = mbedtls_client_init(session->tls_session, (void *)pers, strlen(pers))) < 0) {
     LOGE( "initialize https client failed return: -0x%x.", -tls_ret);
     return -WEBCLIENT_ERROR;
@@ -306,6 +362,50 @@ static int webclient_open_tls(struct webclient_session *session, const char *URI
 }
 #endif
 
+/* an idle kept connection has nothing to read, readable means closed or an alert */
+static bool webclient_socket_stale(struct webclient_session *session)
+{
+  struct pollfd pfd = {0};
+
+  pfd.fd = session->socket;
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) != 0;
+}
+
+/* keep the open connection when URI goes to the same server */
+static int webclient_reuse(struct webclient_session *session, const char *URI)
+{
+  struct webclient_session probe;
+  const char *req_url = RT_NULL;
+  bool same = false;
+
+  if (!session->keep_alive || session->is_tls != (strncmp(URI, "https://", 8) == 0)) {
+    return -WEBCLIENT_DISCONNECT;
+  }
+
+  rt_memset(&probe, 0x00, sizeof(probe));
+  if (webclient_resolve_address(&probe, URI, &req_url) != WEBCLIENT_OK || req_url == RT_NULL) {
+    return -WEBCLIENT_ERROR;
+  }
+  same = (probe.port == session->port) && session->host && (rt_strcmp(probe.host, session->host) == 0);
+  HAL_SAFE_FREE(probe.host);
+
+  if (!same || webclient_socket_stale(session)) {
+    return -WEBCLIENT_DISCONNECT;
+  }
+
+  HAL_SAFE_FREE(session->req_url);
+  session->req_url = web_strdup(req_url);
+  if (session->req_url == RT_NULL) {
+    return -WEBCLIENT_NOMEM;
+  }
+  LOGD( "reuse connection to %s:%d", session->host, session->port);
+
+  return WEBCLIENT_OK;
+}
+
+static int webclient_clean(struct webclient_session *session);
+
 /**
  * connect to http server.
  *
@@ -320,13 +420,21 @@ static int webclient_connect(struct webclient_session *session, const char *URI)
   int rc = WEBCLIENT_OK;
   int socket_handle;
   struct timeval timeout;
-  struct addrinfo *res = RT_NULL;
   const char *req_url;
 
   RT_ASSERT(session);
   RT_ASSERT(URI);
   LOGD( "uri: %s", URI);
 
+  session->reused = false;
+  if (session->socket >= 0) {
+    if (webclient_reuse(session, URI) == WEBCLIENT_OK) {
+      session->reused = true;
+      return WEBCLIENT_OK;
+    }
+    webclient_clean(session);
+  }
+
   timeout.tv_sec = WEBCLIENT_DEFAULT_TIMEO;
   timeout.tv_usec = 0;
 
@@ -349,18 +457,12 @@ static int webclient_connect(struct webclient_session *session, const char *URI)
   }
 
   /* Check valid IP address and URL */
-  rc = webclient_resolve_address(session, &res, URI, &req_url);
+  rc = webclient_resolve_address(session, URI, &req_url);
   if (rc != WEBCLIENT_OK) {
     LOGE( "connect failed, resolve address error(%d).", rc);
     goto __exit;
   }
 
-  /* Not use 'getaddrinfo()' for https connection */
-  if (session->is_tls == RT_FALSE && res == RT_NULL) {
-    rc = -WEBCLIENT_ERROR;
-    goto __exit;
-  }
-
   /* copy host address */
   if (req_url) {
     session->req_url = web_strdup(req_url);
@@ -379,17 +481,22 @@ static int webclient_connect(struct webclient_session *session, const char *URI)
       return -WEBCLIENT_ERROR;
     }
 
-    if ((tls_ret = mbedtls_client_connect(session->tls_session)) < 0) {
-      LOGE( "connect failed, https client connect return: -0x%x", -tls_ret);
+    socket_handle = volc_net_connect(session->host, session->port, &session->sock_opt, WEBCLIENT_DEFAULT_TIMEO * 1000);
+    if (socket_handle < 0) {
+      LOGE( "connect failed, https client connect %s:%d failed", session->host, session->port);
       return -WEBCLIENT_CONNECT_FAILED;
     }
-
-    socket_handle = session->tls_session->server_fd.fd;
+    session->tls_session->server_fd.fd = socket_handle;
 
     /* set recv timeout option */
     setsockopt(socket_handle, SOL_SOCKET, SO_RCVTIMEO, (void *)&timeout, sizeof(timeout));
     setsockopt(socket_handle, SOL_SOCKET, SO_SNDTIMEO, (void *)&timeout, sizeof(timeout));
 
+    if ((tls_ret = mbedtls_client_handshake(session->tls_session)) < 0) {
+      LOGE( "connect failed, https client handshake return: -0x%x", -tls_ret);
+      return -WEBCLIENT_CONNECT_FAILED;
+    }
+
     session->socket = socket_handle;
 
     return WEBCLIENT_OK;
@@ -397,35 +504,20 @@ static int webclient_connect(struct webclient_session *session, const char *URI)
 #endif
 
   {
-    socket_handle = socket(res->ai_family, SOCK_STREAM, IPPROTO_TCP);
-
+    socket_handle = volc_net_connect(session->host, session->port, &session->sock_opt, WEBCLIENT_DEFAULT_TIMEO * 1000);
     if (socket_handle < 0) {
-      LOGE( "connect failed, create socket(%d) error.", socket_handle);
-      rc = -WEBCLIENT_NOSOCKET;
+      LOGE( "connect failed, connect %s:%d error.", session->host, session->port);
+      rc = -WEBCLIENT_CONNECT_FAILED;
       goto __exit;
     }
 
     /* set receive and send timeout option */
     setsockopt(socket_handle, SOL_SOCKET, SO_RCVTIMEO, (void *)&timeout, sizeof(timeout));
     setsockopt(socket_handle, SOL_SOCKET, SO_SNDTIMEO, (void *)&timeout, sizeof(timeout));
-    struct sockaddr_in *ipv4 = (struct sockaddr_in *)res->ai_addr;
-    int port = ntohs(ipv4->sin_port);
-    if (connect(socket_handle, res->ai_addr, res->ai_addrlen) != 0) {
-      /* connect failed, close socket */
-      LOGE( "connect failed, connect socket(%d) error.", socket_handle);
-       close(socket_handle);
-      rc = -WEBCLIENT_CONNECT_FAILED;
-      goto __exit;
-    }
-    session->port = ntohs(((struct sockaddr_in *)res->ai_addr)->sin_port);
     session->socket = socket_handle;
   }
 
 __exit:
-  if (res) {
-    freeaddrinfo(res);
-  }
-
   return rc;
 }
 
@@ -650,6 +742,8 @@ int webclient_handle_response(struct webclient_session *session)
   char *mime_buffer = RT_NULL;
   char *mime_ptr = RT_NULL;
   const char *transfer_encoding;
+  const char *connection;
+  const char *keep_alive;
   int i;
 
   RT_ASSERT(session);
@@ -657,6 +751,20 @@ int webclient_handle_response(struct webclient_session *session)
   /* clean header buffer and size */
   rt_memset(session->header->buffer, 0x00, session->header->size);
   session->header->length = 0;
+  session->resp_status = 0;
+  session->content_length = -1;
+  session->chunk_sz = 0;
+  session->chunk_offset = 0;
+  session->keep_alive = false;
+  session->keep_alive_ms = 0;
+  session->answered = false;
+  session->retry_safe = false;
+
+  /* webclient_write() closes the socket when sending fails */
+  if (session->socket < 0) {
+    session->retry_safe = true;
+    return -WEBCLIENT_DISCONNECT;
+  }
 
    LOGD( "response header:");
   /* We now need to read the header information */
@@ -719,14 +827,32 @@ int webclient_handle_response(struct webclient_session *session)
   }
   session->content_remainder = session->content_length ? (size_t)session->content_length : 0xFFFFFFFF;
 
+  /* HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 only when asked */
+  connection = webclient_header_fields_get(session, "Connection");
+  if (connection) {
+    session->keep_alive = (webclient_strncasecmp(connection, "keep-alive", 10) == 0);
+  } else {
+    session->keep_alive = (strncmp(session->header->buffer, "HTTP/1.1", 8) == 0);
+  }
+  keep_alive = webclient_header_fields_get(session, "Keep-Alive");
+  if (keep_alive && (keep_alive = webclient_strstri(keep_alive, "timeout=")) != RT_NULL) {
+    session->keep_alive_ms = atoi(keep_alive + 8) * 1000;
+  }
+
   transfer_encoding = webclient_header_fields_get(session, "Transfer-Encoding");
   if (transfer_encoding && rt_strcmp(transfer_encoding, "chunked") == 0) {
     char line[16];
 
     /* chunk mode, we should get the first chunk size */
-    webclient_read_line(session, line, session->header->size);
+    webclient_read_line(session, line, sizeof(line));
     session->chunk_sz = strtol(line, RT_NULL, 16);
     session->chunk_offset = 0;
+    if (session->chunk_sz == 0) {
+      webclient_chunks_end(session);
+    }
+  } else if (session->content_length < 0) {
+    /* the body runs until the server closes */
+    session->keep_alive = false;
   }
 
   HAL_SAFE_FREE(mime_ptr);
@@ -774,8 +900,6 @@ struct webclient_session *webclient_session_create(size_t header_sz, const char
   return session;
 }
 
-static int webclient_clean(struct webclient_session *session);
-
 int webclient_get(struct webclient_session *session, const char *URI)
 {
   int rc = WEBCLIENT_OK;
@@ -1102,6 +1226,23 @@ int webclient_set_timeout(struct webclient_session *session, int millisecond)
   return 0;
 }
 
+/**
+ * set the socket options used when the session connects.
+ *
+ * @param session http session
+ * @param opt socket options, copied
+ *
+ * @return 0: success
+ */
+int webclient_set_sock_opt(struct webclient_session *session, const volc_sock_opt_t *opt)
+{
+  RT_ASSERT(session);
+  RT_ASSERT(opt);
+
+  session->sock_opt = *opt;
+  return 0;
+}
+
 static int webclient_next_chunk(struct webclient_session *session)
 {
   char line[64];
@@ -1132,9 +1273,7 @@ static int webclient_next_chunk(struct webclient_session *session)
 
   if (session->chunk_sz == 0) {
     /* end of chunks */
-     close(session->socket);
-    session->socket = -1;
-    session->chunk_sz = -1;
+    webclient_chunks_end(session);
   }
 
   return session->chunk_sz;
@@ -1319,6 +1458,9 @@ static int webclient_clean(struct webclient_session *session)
 #ifdef CONFIG_WEBCLIENT_HTTPS_SUPPORTED
   if (session->tls_session) {
     mbedtls_client_close(session->tls_session);
+    session->tls_session = RT_NULL;
+    session->socket = -1;
+    session->is_tls = false;
   } else {
     if (session->socket >= 0) {
        close(session->socket);
@@ -1336,10 +1478,42 @@ static int webclient_clean(struct webclient_session *session)
   HAL_SAFE_FREE(session->req_url);
 
   session->content_length = -1;
+  session->keep_alive = false;
+  session->rx_pos = 0;
+  session->rx_len = 0;
 
   return 0;
 }
 
+int webclient_session_reset(struct webclient_session *session)
+{
+  RT_ASSERT(session);
+
+  rt_memset(session->header->buffer, 0x00, session->header->size);
+  session->header->length = 0;
+  session->resp_status = 0;
+  session->content_length = -1;
+  session->content_remainder = 0;
+  session->chunk_sz = 0;
+  session->chunk_offset = 0;
+
+  return 0;
+}
+
+bool webclient_keep_alive(struct webclient_session *session)
+{
+  RT_ASSERT(session);
+
+  /* anything read past the body would be mistaken for the next response */
+  if (session->socket < 0 || !session->keep_alive || session->rx_pos < session->rx_len) {
+    return false;
+  }
+  if (session->chunk_sz) {
+    return session->chunk_sz < 0;
+  }
+  return session->content_length == 0 || (session->content_length > 0 && session->content_remainder == 0);
+}
+
 /**
  * close a webclient client session.
  *
@@ -1358,6 +1532,7 @@ int webclient_close(struct webclient_session *session)
   }
 
   HAL_SAFE_FREE(session->header);
+  HAL_SAFE_FREE(session->rx_buf);
 
 #ifdef CONFIG_WEBCLIENT_HTTPS_SUPPORTED
   HAL_SAFE_FREE(session->cert_buf);